@@ -0,0 +1,122 @@
+/**
+ * @brief トークナイザーのマイクロベンチマーク
+ *
+ * 演算子の多い入力と, コメント・空白・長い識別子の多い入力を機械生成風に作り,
+ * tokenize() と tokenize_parallel() のスループットを測る.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rw2rvc2.h"
+
+/**
+ * @brief 演算子の多い入力
+ */
+static const char *OPERATOR_LINES[] = {
+	"\ta <<= b >> c >= d != e && f || g;\n",
+	"\tvalue_1 = (x1 + 0x1f) * y2 - 017 % z3; /* comment */\n",
+	"\tif (a <= b) { c += d; } else { c -= d >> 2; }\n",
+	"\treturn foo(a, b, c) == bar(d) ^ ~e | !f;\n",
+	NULL,
+};
+
+/**
+ * @brief コメント・空白・長い識別子の多い入力
+ */
+static const char *COMMENT_LINES[] = {
+	"/*\n * generated by some code generator. do not edit.\n * this block explains the next statement.\n */\n",
+	"\t\t\t\tgenerated_variable_name_0001 = another_generated_identifier_0002;    /* trailing comment */\n",
+	"\n\n        \n",
+	"\t\t/* a long comment that spans a single line but is quite a bit longer than most tokens */\n",
+	NULL,
+};
+
+/**
+ * @brief ベンチマーク用の入力を生成する
+ * @param[in] lines  繰り返す行 (NULL終端)
+ * @param[in] size   おおよその入力サイズ(バイト)
+ * @return 生成した入力文字列
+ */
+static char *generate_input(const char **lines, size_t size)
+{
+	char *buf = malloc(size + 256);
+	size_t len = 0;
+	size_t i = 0;
+
+	if (buf == NULL) {
+		fprintf(stderr, "memory allocation failed\n");
+		exit(1);
+	}
+
+	while (len < size) {
+		size_t l;
+
+		if (lines[i] == NULL)
+			i = 0;
+
+		l = strlen(lines[i]);
+		memcpy(buf + len, lines[i], l);
+		len += l;
+		i++;
+	}
+	buf[len] = '\0';
+
+	return buf;
+}
+
+/**
+ * @brief 経過時間(秒)を返す
+ */
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/**
+ * @brief 1種類の入力について計測する
+ * @param[in] name   入力の名前
+ * @param[in] lines  繰り返す行 (NULL終端)
+ * @param[in] size   おおよその入力サイズ(バイト)
+ */
+static void bench(const char *name, const char **lines, size_t size)
+{
+	char *buf = generate_input(lines, size);
+	struct token_stream_t tokens;
+	struct timespec start;
+	double sec;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tokenize(&tokens, buf);
+	sec = elapsed(&start);
+
+	printf("lex (%s): %zu bytes, %zu tokens, %.3f sec, %.1f MB/s\n", name, strlen(buf), tokens.tail, sec,
+	       strlen(buf) / sec / (1 << 20));
+
+	release_token_stream(&tokens);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tokenize_parallel(&tokens, buf, 0);
+	sec = elapsed(&start);
+
+	printf("lex (%s, parallel): %zu bytes, %zu tokens, %.3f sec, %.1f MB/s\n", name, strlen(buf), tokens.tail, sec,
+	       strlen(buf) / sec / (1 << 20));
+
+	release_token_stream(&tokens);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	size_t size = (argc > 1) ? strtoul(argv[1], NULL, 0) : (8 << 20);
+
+	bench("operators", OPERATOR_LINES, size);
+	bench("comments", COMMENT_LINES, size);
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * @brief パーサーのマイクロベンチマーク
+ *
+ * 深い括弧の入れ子を含む式と, 演算子の多い式と, 1つの長い式を生成し, parse() にかかる時間を測る.
+ * 式の大きさに対して線形に増えることを確かめる.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rw2rvc2.h"
+
+/**
+ * @brief 入れ子の深さdepthの括弧で囲んだ式を返す関数を生成する
+ * @param[in] depth  括弧の深さ
+ * @param[in] count  繰り返す文の数
+ * @return 生成した入力文字列
+ */
+static char *generate_nested(size_t depth, size_t count)
+{
+	size_t size = 64 + count * (depth * 8 + 32);
+	char *buf = malloc(size);
+	size_t len = 0;
+	size_t i, j;
+
+	if (buf == NULL) {
+		fprintf(stderr, "memory allocation failed\n");
+		exit(1);
+	}
+
+	len += sprintf(buf + len, "int main() {\n");
+	for (i = 0; i < count; i++) {
+		len += sprintf(buf + len, "\tx = ");
+		for (j = 0; j < depth; j++)
+			len += sprintf(buf + len, "(");
+		len += sprintf(buf + len, "1");
+		for (j = 0; j < depth; j++)
+			len += sprintf(buf + len, " + %zu)", j);
+		len += sprintf(buf + len, ";\n");
+	}
+	sprintf(buf + len, "\treturn x;\n}\n");
+
+	return buf;
+}
+
+/**
+ * @brief 演算子の多い文を繰り返す関数を生成する
+ * @param[in] count  繰り返す文の数
+ * @return 生成した入力文字列
+ */
+static char *generate_arithmetic(size_t count)
+{
+	const char *line = "\tx = a * b + c - d / e % f << 2 >= g == h & i ^ j | k && l || -m + (n - 1) * 3;\n";
+	char *buf = malloc(64 + count * strlen(line));
+	size_t len = 0;
+	size_t i;
+
+	if (buf == NULL) {
+		fprintf(stderr, "memory allocation failed\n");
+		exit(1);
+	}
+
+	len += sprintf(buf + len, "int main() {\n");
+	for (i = 0; i < count; i++)
+		len += sprintf(buf + len, "%s", line);
+	sprintf(buf + len, "\treturn x;\n}\n");
+
+	return buf;
+}
+
+/**
+ * @brief count項の和を返す関数を生成する
+ * @param[in] count  項の数
+ * @return 生成した入力文字列
+ */
+static char *generate_chain(size_t count)
+{
+	char *buf = malloc(64 + count * 4);
+	size_t len = 0;
+	size_t i;
+
+	if (buf == NULL) {
+		fprintf(stderr, "memory allocation failed\n");
+		exit(1);
+	}
+
+	len += sprintf(buf + len, "int main() {\n\treturn x");
+	for (i = 1; i < count; i++)
+		len += sprintf(buf + len, " + x");
+	sprintf(buf + len, ";\n}\n");
+
+	return buf;
+}
+
+/**
+ * @brief 経過時間(秒)を返す
+ */
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/**
+ * @brief 1種類の入力について計測する
+ * @param[in] name  入力の名前
+ * @param[in] buf   入力文字列
+ */
+static void bench(const char *name, const char *buf)
+{
+	struct token_stream_t tokens;
+	struct timespec start;
+	double sec;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	init_token_stream(&tokens, buf);
+	parse(&tokens);
+	sec = elapsed(&start);
+
+	printf("parse (%s): %zu bytes, %.3f sec, %.1f MB/s\n", name, strlen(buf), sec, strlen(buf) / sec / (1 << 20));
+
+	release_token_stream(&tokens);
+}
+
+int main(void)
+{
+	size_t depth;
+	char name[64];
+	char *buf;
+
+	for (depth = 4; depth <= 64; depth *= 2) {
+		buf = generate_nested(depth, 64 * 1024 / depth);
+		sprintf(name, "nested %zu", depth);
+		bench(name, buf);
+		free(buf);
+	}
+
+	buf = generate_arithmetic(64 * 1024);
+	bench("arithmetic", buf);
+	free(buf);
+
+	buf = generate_chain(1024 * 1024);
+	bench("chain", buf);
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,273 @@
+/**
+ * @brief インクリメンタルパースのマイクロベンチマーク
+ *
+ * 関数を多数並べた入力を生成し, 1つの関数の中を1文字ずつ編集したときに reparse_edit() にかかる時間を,
+ * 入力全体を parse() する時間と比べる. 編集後のASTが入力全体をパースし直した結果と一致することも確かめる.
+ * 末尾にパースできない関数がある入力でも, 先頭の関数を編集する時間を測る.
+ */
+#define _GNU_SOURCE /* open_memstream() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rw2rvc2.h"
+
+/**
+ * @brief 関数1つ分の行
+ */
+static const char *FUNCTION_LINES[] = {
+	"int f%zu(int a) {\n",
+	"\tg = a + 1;\n",
+	"\tif (g > 2) {\n",
+	"\t\tg = g * 3;\n",
+	"\t} else {\n",
+	"\t\tg = g - 1;\n",
+	"\t}\n",
+	"\th = (g << 2) | a;\n",
+	"\treturn g + h;\n",
+	"}\n",
+	NULL,
+};
+
+/**
+ * @brief パースできない関数
+ */
+static const char BROKEN_FUNCTION[] = "int broken(int a) {\n\treturn a +;\n}\n";
+
+/**
+ * @brief 経過時間(秒)を返す
+ */
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/**
+ * @brief count個の関数を並べた入力を生成する
+ * @param[in] count  関数の数
+ * @return 生成した入力文字列
+ */
+static char *generate_functions(size_t count)
+{
+	char *buf = malloc(64 + count * 256);
+	size_t len = 0;
+	size_t i, j;
+
+	if (buf == NULL) {
+		fprintf(stderr, "memory allocation failed\n");
+		exit(1);
+	}
+
+	len += sprintf(buf + len, "int g;\nint h;\n");
+	for (i = 0; i < count; i++) {
+		for (j = 0; FUNCTION_LINES[j] != NULL; j++)
+			len += sprintf(buf + len, FUNCTION_LINES[j], i);
+	}
+
+	return buf;
+}
+
+/**
+ * @brief 文字列の一部を置き換える
+ */
+static void edit_text(char *buf, size_t begin, size_t end, const char *text)
+{
+	size_t len = strlen(text);
+
+	memmove(buf + begin + len, buf + end, strlen(buf + end) + 1);
+	memcpy(buf + begin, text, len);
+}
+
+/**
+ * @brief ASTのダンプを文字列で返す
+ */
+static char *dump_node(node_id_t node)
+{
+	char *dump = NULL;
+	size_t size;
+	FILE *fp = open_memstream(&dump, &size);
+
+	show_node(fp, node, 0);
+	fclose(fp);
+
+	return dump;
+}
+
+/**
+ * @brief 入力全体をパースし直した結果と比べる
+ * @return 一致すればtrue
+ */
+static bool check(const struct incremental_parser_t *ip, const char *buf)
+{
+	struct token_stream_t tokens;
+	struct node_mark_t mark = node_mark();
+	char *expected, *actual;
+	bool ok;
+
+	init_token_stream(&tokens, buf);
+	expected = dump_node(parse(&tokens));
+	release_token_stream(&tokens);
+	release_nodes(mark);
+
+	actual = dump_node(ip->program);
+	ok = (strcmp(expected, actual) == 0);
+
+	free(expected);
+	free(actual);
+
+	return ok;
+}
+
+int main(void)
+{
+	const size_t FUNCTIONS = 5000; /* 約50000行 */
+	const size_t EDITS = 1000;
+	struct incremental_parser_t ip;
+	struct token_stream_t tokens;
+	struct timespec start;
+	struct node_mark_t first;
+	double full, sec;
+	char *buf = generate_functions(FUNCTIONS);
+	char *buf_edit;
+	size_t at, i;
+
+	/* 入力全体のパース */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	init_token_stream(&tokens, buf);
+	parse(&tokens);
+	full = elapsed(&start);
+	release_token_stream(&tokens);
+
+	printf("parse (full): %zu bytes, %.3f sec\n", strlen(buf), full);
+
+	if (init_incremental_parser(&ip, buf) != 0) {
+		fprintf(stderr, "initial parse failed\n");
+		return 1;
+	}
+
+	/* 中ほどの関数の "a + 1" の定数を書き換える */
+	buf_edit = realloc(buf, strlen(buf) + EDITS + 64);
+	if (buf_edit == NULL) {
+		fprintf(stderr, "memory allocation failed\n");
+		return 1;
+	}
+	buf = buf_edit;
+	at = strstr(strstr(buf, "int f2500("), "a + 1") - buf + 4;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < EDITS; i++) {
+		const char digit[2] = {'1' + i % 9, '\0'};
+
+		reparse_edit(&ip, at, at + 1, digit, 1);
+		buf[at] = digit[0];
+		if (i == 0)
+			first = node_mark();
+	}
+	sec = elapsed(&start) / EDITS;
+
+	/* 同じ関数の編集ではノードアリーナを巻き戻して使い回す */
+	if (node_mark().len != first.len || node_mark().lists_len != first.lists_len) {
+		fprintf(stderr, "node arena grew while editing the same function\n");
+		return 1;
+	}
+
+	printf("reparse (one-char edit): %.1f usec/edit, %.0fx faster than full parse\n", sec * 1e6, full / sec);
+
+	if (!check(&ip, buf)) {
+		fprintf(stderr, "reparse result differs from full parse\n");
+		return 1;
+	}
+
+	/* '{' を入れて壊し, 同じ関数の次の行の前に '}' を足して直す */
+	at = strstr(strstr(buf, "int f2500("), "\tg = a") - buf;
+	if (reparse_edit(&ip, at, at, "{", 1) == 0) {
+		fprintf(stderr, "unbalanced brace was accepted\n");
+		return 1;
+	}
+	edit_text(buf, at, at, "{");
+
+	at = strstr(buf + at, "\n") - buf;
+	if (reparse_edit(&ip, at, at, "}", 1) != 0) {
+		fprintf(stderr, "closing brace did not recover\n");
+		return 1;
+	}
+	edit_text(buf, at, at, "}");
+
+	if (!check(&ip, buf)) {
+		fprintf(stderr, "reparse result differs from full parse after recovery\n");
+		return 1;
+	}
+
+	/* コメントで後ろの関数を隠し, 閉じる */
+	at = strstr(buf, "int f4000(") - buf;
+	reparse_edit(&ip, at, at, "/*", 2);
+	edit_text(buf, at, at, "/*");
+	at = strstr(buf, "int f4002(") - buf;
+	reparse_edit(&ip, at, at, "*/", 2);
+	edit_text(buf, at, at, "*/");
+
+	if (!check(&ip, buf)) {
+		fprintf(stderr, "reparse result differs from full parse after comment\n");
+		return 1;
+	}
+
+	release_incremental_parser(&ip);
+
+	/* 末尾にパースできない関数を足し, 先頭の関数を編集する */
+	buf_edit = realloc(buf, strlen(buf) + sizeof(BROKEN_FUNCTION) + 8);
+	if (buf_edit == NULL) {
+		fprintf(stderr, "memory allocation failed\n");
+		return 1;
+	}
+	buf = buf_edit;
+	strcat(buf, BROKEN_FUNCTION);
+
+	if (init_incremental_parser(&ip, buf) == 0) {
+		fprintf(stderr, "broken function was accepted\n");
+		return 1;
+	}
+
+	at = strstr(strstr(buf, "int f1("), "a + 1") - buf + 4;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < EDITS; i++) {
+		const char digit[2] = {'1' + i % 9, '\0'};
+
+		reparse_edit(&ip, at, at + 1, digit, 1);
+		buf[at] = digit[0];
+	}
+	sec = elapsed(&start) / EDITS;
+
+	printf("reparse (one-char edit, error at the end): %.1f usec/edit, %.0fx faster than full parse\n", sec * 1e6,
+	       full / sec);
+
+	/* エラーの区間はパースできない関数だけ */
+	if (ip.num_errors != 1 || !ip.segments[ip.num_segments - 1].error ||
+	    strcmp(ip.segments[ip.num_segments - 1].text, BROKEN_FUNCTION) != 0) {
+		fprintf(stderr, "error segment is not limited to the broken function\n");
+		return 1;
+	}
+
+	/* 直す */
+	at = strstr(buf, "a +;") - buf + 3;
+	if (reparse_edit(&ip, at, at, " 1", 2) != 0) {
+		fprintf(stderr, "broken function did not recover\n");
+		return 1;
+	}
+	edit_text(buf, at, at, " 1");
+
+	if (!check(&ip, buf)) {
+		fprintf(stderr, "reparse result differs from full parse after fixing the error\n");
+		return 1;
+	}
+
+	release_incremental_parser(&ip);
+	free(buf);
+
+	return 0;
+}
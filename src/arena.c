@@ -0,0 +1,170 @@
+/**
+ * @brief セッションアリーナ
+ *
+ * 1回のコンパイルの間に作るIR, 変数, 辞書は1つのアリーナからポインタを進めるだけで割り当て,
+ * 個別には解放しない. コンパイルが終わったら arena_release() でまとめて捨てる.
+ *
+ * チャンクは足りなくなるたびに倍の大きさで確保するので, 数はわずかで済む. 解放するときは最後の
+ * (一番大きい) チャンクだけを残して次のセッションで使い回す.
+ *
+ * 後から大きさを変える領域 (IRの列や辞書の表など) はチャンクに置くと古い領域が無駄になるので,
+ * 個別のブロックとしてrealloc()し, アリーナにつないでおいて一緒に解放する.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rw2rvc2.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024) /**< 最初のチャンクの大きさ */
+
+/**
+ * @brief アリーナのチャンク
+ */
+struct arena_chunk_t {
+	struct arena_chunk_t *prev; /**< 前に確保したチャンク */
+	size_t size;		    /**< dataのバイト数 */
+	max_align_t data[];	    /**< 割り当てる領域 */
+};
+
+/**
+ * @brief 大きさを変えられるブロック
+ */
+struct arena_block_t {
+	struct arena_block_t *prev; /**< 前のブロック */
+	struct arena_block_t *next; /**< 次のブロック */
+	size_t size;		    /**< dataのバイト数 */
+	max_align_t data[];	    /**< 割り当てる領域 */
+};
+
+/**
+ * @brief コンパイル1回分のアリーナ
+ */
+struct arena_t session_arena;
+
+/**
+ * @brief 新しいチャンクを確保して使い始める
+ * @param[in] arena  アリーナ
+ * @param[in] size   少なくとも必要なバイト数
+ */
+static void new_chunk(struct arena_t *arena, size_t size)
+{
+	struct arena_chunk_t *chunk;
+	size_t s = (arena->chunk == NULL) ? ARENA_CHUNK_SIZE : arena->chunk->size * 2;
+
+	while (s < size)
+		s *= 2;
+
+	if ((chunk = malloc(sizeof(struct arena_chunk_t) + s)) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+
+	chunk->prev = arena->chunk;
+	chunk->size = s;
+
+	mem_stats.arena_chunks++;
+	mem_stats.arena_reserved += s;
+
+	arena->chunk = chunk;
+	arena->ptr = (char *)chunk->data;
+	arena->end = (char *)chunk->data + s;
+}
+
+/**
+ * @brief アリーナから割り当てる
+ */
+void *arena_alloc(struct arena_t *arena, size_t size, size_t align)
+{
+	uintptr_t p = ((uintptr_t)arena->ptr + align - 1) & ~(uintptr_t)(align - 1);
+
+	if (arena->chunk == NULL || p > (uintptr_t)arena->end || size > (uintptr_t)arena->end - p) {
+		new_chunk(arena, size + align);
+		p = ((uintptr_t)arena->ptr + align - 1) & ~(uintptr_t)(align - 1);
+	}
+
+	arena->ptr = (char *)p + size;
+
+	mem_stats.arena_allocs++;
+	mem_stats.arena_used += size;
+
+	return (void *)p;
+}
+
+/**
+ * @brief アリーナにつないだブロックを確保・拡大する
+ */
+void *arena_resize(struct arena_t *arena, void *ptr, size_t size)
+{
+	struct arena_block_t *block = NULL;
+	size_t old = 0;
+
+	if (ptr != NULL) {
+		block = (struct arena_block_t *)((char *)ptr - offsetof(struct arena_block_t, data));
+		old = block->size;
+	}
+
+	if ((block = realloc(block, sizeof(struct arena_block_t) + size)) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+
+	block->size = size;
+
+	/* ブロックは大きさのとおりに確保するので, 広げた分は確保した量にも割り当てた量にも足す */
+	mem_stats.arena_resizes++;
+	mem_stats.arena_block_bytes = mem_stats.arena_block_bytes - old + size;
+	if (size > old) {
+		mem_stats.arena_reserved += size - old;
+		mem_stats.arena_used += size - old;
+	}
+	if (mem_stats.arena_block_bytes > mem_stats.arena_block_peak)
+		mem_stats.arena_block_peak = mem_stats.arena_block_bytes;
+	if (ptr == NULL)
+		mem_stats.arena_blocks++;
+
+	/* 新しいブロックは先頭につなぎ, 動いたブロックは前後からつなぎ直す */
+	if (ptr == NULL) {
+		block->prev = NULL;
+		block->next = arena->blocks;
+		if (arena->blocks != NULL)
+			arena->blocks->prev = block;
+		arena->blocks = block;
+	} else {
+		if (block->prev != NULL)
+			block->prev->next = block;
+		else
+			arena->blocks = block;
+		if (block->next != NULL)
+			block->next->prev = block;
+	}
+
+	return block->data;
+}
+
+/**
+ * @brief アリーナから割り当てたものをまとめて解放する
+ */
+void arena_release(struct arena_t *arena)
+{
+	struct arena_chunk_t *chunk, *prev;
+	struct arena_block_t *block, *next;
+
+	for (block = arena->blocks; block != NULL; block = next) {
+		next = block->next;
+		mem_stats.arena_blocks--;
+		mem_stats.arena_block_bytes -= block->size;
+		free(block);
+	}
+	arena->blocks = NULL;
+
+	if (arena->chunk == NULL)
+		return;
+
+	for (chunk = arena->chunk->prev; chunk != NULL; chunk = prev) {
+		prev = chunk->prev;
+		free(chunk);
+	}
+
+	arena->chunk->prev = NULL;
+	arena->ptr = (char *)arena->chunk->data;
+}
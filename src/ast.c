@@ -0,0 +1,204 @@
+/**
+ * @brief ノードアリーナ
+ *
+ * ノードと子リストをそれぞれ1つの配列に連続して置き, 子は32ビットの添字で指す.
+ * 子リストはパース中にscratchへ積み, 完成してからlistsへまとめて写す.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "rw2rvc2.h"
+
+/**
+ * @brief ノードアリーナ
+ */
+struct node_arena_t node_arena;
+
+/**
+ * @brief ノードアリーナを初期化する
+ *
+ * 添字0はノードなし・空のリストを表すので使わずに空けておく.
+ */
+static void init_node_arena(void)
+{
+	grow_array(&node_arena.nodes, &node_arena.capacity, sizeof(struct node_t), 1);
+	memset(&node_arena.nodes[0], 0, sizeof(struct node_t));
+	node_arena.len = 1;
+
+	grow_array(&node_arena.lists, &node_arena.lists_capacity, sizeof(node_id_t), 1);
+	node_arena.lists[0] = 0;
+	node_arena.lists_len = 1;
+}
+
+/**
+ * @brief 新規ノードをつくる
+ */
+node_id_t new_node(node_type_t type, node_id_t lhs, node_id_t rhs)
+{
+	struct node_t *node;
+
+	if (node_arena.len == 0)
+		init_node_arena();
+
+	/* 添字を32ビットに収める */
+	if (node_arena.len >= UINT32_MAX) {
+		error_printf("too many nodes\n");
+		exit(1);
+	}
+
+	if (node_arena.len >= node_arena.capacity)
+		grow_array(&node_arena.nodes, &node_arena.capacity, sizeof(struct node_t), node_arena.len + 1);
+
+	node = &node_arena.nodes[node_arena.len];
+	node->type = type;
+	node->lhs = lhs;
+	node->rhs = rhs;
+	node->value = -1;
+
+	return node_arena.len++;
+}
+
+/**
+ * @brief ノードアリーナの使用位置を取得する
+ */
+struct node_mark_t node_mark(void)
+{
+	struct node_mark_t mark;
+
+	mark.len = node_arena.len;
+	mark.lists_len = node_arena.lists_len;
+
+	return mark;
+}
+
+/**
+ * @brief ノードアリーナを使用位置まで戻す
+ */
+void release_nodes(struct node_mark_t mark)
+{
+	node_arena.len = mark.len;
+	node_arena.lists_len = mark.lists_len;
+}
+
+/**
+ * @brief 子リストの作成を始める
+ */
+size_t list_begin(void)
+{
+	return node_arena.scratch_len;
+}
+
+/**
+ * @brief 作成中の子リストに子を足す
+ */
+void list_push(node_id_t child)
+{
+	if (node_arena.scratch_len >= node_arena.scratch_capacity)
+		grow_array(&node_arena.scratch, &node_arena.scratch_capacity, sizeof(node_id_t),
+			   node_arena.scratch_len + 1);
+
+	node_arena.scratch[node_arena.scratch_len++] = child;
+}
+
+/**
+ * @brief 子リストの作成を終え, ノードアリーナに連続して置く
+ */
+list_id_t list_end(size_t mark)
+{
+	size_t n = node_arena.scratch_len - mark;
+	list_id_t list;
+
+	if (n == 0)
+		return 0;
+
+	if (node_arena.len == 0)
+		init_node_arena();
+
+	if (node_arena.lists_len + 1 + n > UINT32_MAX) {
+		error_printf("too many nodes\n");
+		exit(1);
+	}
+
+	if (node_arena.lists_len + 1 + n > node_arena.lists_capacity)
+		grow_array(&node_arena.lists, &node_arena.lists_capacity, sizeof(node_id_t),
+			   node_arena.lists_len + 1 + n);
+
+	list = node_arena.lists_len;
+	node_arena.lists[list] = n;
+	memcpy(&node_arena.lists[list + 1], &node_arena.scratch[mark], sizeof(node_id_t) * n);
+
+	node_arena.lists_len += 1 + n;
+	node_arena.scratch_len = mark;
+
+	return list;
+}
+
+/**
+ * @brief 2つのND_PROGRAMの子リストをつなげる
+ */
+node_id_t concat_programs(node_id_t first, node_id_t second)
+{
+	node_id_t program;
+	size_t mark, i;
+
+	if (first == NODE_NULL)
+		return second;
+	if (second == NODE_NULL)
+		return first;
+
+	mark = list_begin();
+	for (i = 0; i < list_length(get_node(first)->list); i++)
+		list_push(list_at(get_node(first)->list, i));
+	for (i = 0; i < list_length(get_node(second)->list); i++)
+		list_push(list_at(get_node(second)->list, i));
+
+	program = new_node(ND_PROGRAM, NODE_NULL, NODE_NULL);
+	get_node(program)->list = list_end(mark);
+
+	return program;
+}
+
+/**
+ * @brief 空のノードアリーナに保存したノードと子リストを読み込む
+ */
+void load_node_arena(const struct node_t *nodes, size_t len, const node_id_t *lists, size_t lists_len)
+{
+	if (node_arena.len != 0) {
+		error_printf("unexpected error in %s() (node arena is not empty)\n", __FUNCTION__);
+		exit(1);
+	}
+
+	grow_array(&node_arena.nodes, &node_arena.capacity, sizeof(struct node_t), len);
+	memcpy(node_arena.nodes, nodes, sizeof(struct node_t) * len);
+	node_arena.len = len;
+
+	grow_array(&node_arena.lists, &node_arena.lists_capacity, sizeof(node_id_t), lists_len);
+	memcpy(node_arena.lists, lists, sizeof(node_id_t) * lists_len);
+	node_arena.lists_len = lists_len;
+}
+
+/**
+ * @brief ノードの名前を取得する
+ */
+const char *node_name(node_id_t id)
+{
+	const struct node_t *node;
+
+	if (id == NODE_NULL)
+		return NULL;
+
+	node = get_node(id);
+
+	switch (node->type) {
+	case ND_IDENT:
+	case ND_TYPE:
+		return intern_name(node->name);
+	case ND_FUNC_CALL:
+		/* 呼び出す関数の名前 */
+		if (node->lhs != NODE_NULL && get_node(node->lhs)->type == ND_IDENT)
+			return intern_name(get_node(node->lhs)->name);
+		return NULL;
+	default:
+		return NULL;
+	}
+}
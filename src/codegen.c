@@ -5,25 +5,25 @@
  * @copyright 2018- Katsuki Kobayashi. All rights reserved.
  */
 #include <stdio.h>
+#include <string.h>
 
 #include "rw2rvc2.h"
 
 /**
- * @brief RISC-Vのアセンブラを生成する
+ * @brief 変数のデータを生成する
  */
-void gen_riscv(struct vector_t *irv, struct dict_t *d)
+void gen_riscv_data(struct dict_t *d)
 {
-	struct ir_t *ir;
 	unsigned int i;
-	int j;
 
 	printf("	.section .data\n");
 	for (i = 0; i < d->len; i++) {
 		struct variable_t *v = (d->dict)[i].value;
 		if (v->scope_level == 0) {
-			if (v->node->rhs != NULL && (v->node->rhs->type == ND_CONST && v->node->rhs->value != 0)) {
+			node_id_t init = get_node(v->node)->rhs;
+			if (init != NODE_NULL && (get_node(init)->type == ND_CONST && get_node(init)->value != 0)) {
 				printf("%s:\n", (d->dict)[i].key);
-				printf("	.word	%d\n", v->node->rhs->value);
+				printf("	.word	%d\n", get_node(init)->value);
 			}
 		}
 	}
@@ -33,25 +33,152 @@ void gen_riscv(struct vector_t *irv, struct dict_t *d)
 	for (i = 0; i < d->len; i++) {
 		struct variable_t *v = (d->dict)[i].value;
 		if (v->scope_level == 0) {
-			if (v->node->rhs == NULL || (v->node->rhs->type == ND_CONST && v->node->rhs->value == 0))
+			node_id_t init = get_node(v->node)->rhs;
+			if (init == NODE_NULL || (get_node(init)->type == ND_CONST && get_node(init)->value == 0))
 				printf("	.comm %s, 4, 4\n", (d->dict)[i].key);
 		} else {
 			/* @todo スタック上への割り当て  */
+			/* 仮引数とローカル変数のラベルは他の翻訳単位と共有しない */
+			printf("	.local %s\n", (d->dict)[i].key);
 			printf("	.comm %s, 4, 4\n", (d->dict)[i].key);
 		}
 	}
 
 	printf("\n");
+}
+
+/**
+ * @brief 演算のIRに対応する命令
+ */
+static const struct {
+	const char *reg; /**< レジスタを取る命令 */
+	const char *imm; /**< 即値を取る命令 (なければNULL) */
+} ARITH_INSNS[] = {
+	[IR_PLUS] = {"add", "addi"},	  //
+	[IR_MINUS] = {"sub", "addi"},	  /* 符号を反転した即値を足す */
+	[IR_MUL] = {"mul", NULL},	  //
+	[IR_DIV] = {"div", NULL},	  //
+	[IR_MOD] = {"rem", NULL},	  //
+	[IR_AND] = {"and", "andi"},	  //
+	[IR_OR] = {"or", "ori"},	  //
+	[IR_XOR] = {"xor", "xori"},	  //
+	[IR_SLT] = {"slt", "slti"},	  //
+	[IR_SLET] = {"slt", "slti"},	  /* 結果を反転する */
+	[IR_LEFT_OP] = {"sllw", "slliw"}, //
+	[IR_RIGHT_OP] = {"srl", "srli"},
+};
+
+/**
+ * @brief 第2オペランドを即値のまま命令にできるか判断する
+ */
+bool riscv_imm_operand(ir_type_t op, int value)
+{
+	switch (op) {
+	case IR_PLUS:
+	case IR_AND:
+	case IR_OR:
+	case IR_XOR:
+	case IR_SLT:
+	case IR_SLET:
+		return value >= -2048 && value <= 2047;
+
+	case IR_MINUS:
+		return value >= -2047 && value <= 2048;
+
+	/* シフト量はレジスタのときと同じく下位のビットだけを使う */
+	case IR_LEFT_OP:
+	case IR_RIGHT_OP:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief 値を使うオペランドがあることを確かめる
+ *
+ * なければIR生成の誤りで, そのまま生成すると関係のないレジスタを読むので止める.
+ */
+static void check_operand(const struct ir_t *ir, int k)
+{
+	if (ir->kind[k] == IR_OPERAND_NONE) {
+		error_printf("internal error: IR %d has no value operand\n", ir->op);
+		exit(1);
+	}
+}
+
+/**
+ * @brief レジスタとして使うオペランドの名前を返す
+ *
+ * 即値は0だけで, zeroレジスタにする.
+ */
+static const char *reg_operand(const struct ir_t *ir, int k)
+{
+	check_operand(ir, k);
+
+	return (ir->kind[k] == IR_OPERAND_IMM) ? "zero" : get_temp_reg_str(ir->src[k]);
+}
+
+/**
+ * @brief 演算のIRのコードを生成する
+ */
+static void gen_arith(const struct ir_t *ir)
+{
+	const char *dst = get_temp_reg_str(ir->dst);
+	int imm = ir->src[1];
+
+	if (ir->kind[1] == IR_OPERAND_IMM && riscv_imm_operand(ir->op, imm)) {
+		if (ir->op == IR_MINUS)
+			imm = -imm;
+		else if (ir->op == IR_LEFT_OP)
+			imm &= 31;
+		else if (ir->op == IR_RIGHT_OP)
+			imm &= 63;
+
+		printf("	%s	%s, %s, %d\n", ARITH_INSNS[ir->op].imm, dst, reg_operand(ir, 0), imm);
+	} else {
+		printf("	%s	%s, %s, %s\n", ARITH_INSNS[ir->op].reg, dst, reg_operand(ir, 0), reg_operand(ir, 1));
+	}
+
+	if (ir->op == IR_SLET)
+		printf("	xori	%s, %s, 1\n", dst, dst);
+}
+
+/**
+ * @brief レジスタにオペランドの値を入れる
+ * @param[in] reg  入れるレジスタ
+ * @param[in] ir   IR
+ * @param[in] k    オペランド
+ */
+static void gen_move(const char *reg, const struct ir_t *ir, int k)
+{
+	check_operand(ir, k);
+
+	if (ir->kind[k] == IR_OPERAND_IMM)
+		printf("	li	%s, %d\n", reg, ir->src[k]);
+	else if (strcmp(reg, get_temp_reg_str(ir->src[k])) != 0)
+		printf("	mv	%s, %s\n", reg, get_temp_reg_str(ir->src[k]));
+}
+
+/**
+ * @brief IRの列から関数のコードを生成する
+ */
+void gen_riscv_text(struct ir_list_t *irv)
+{
+	struct ir_t *ir;
+	unsigned int i;
+	int j;
 
 	for (i = 0; i < irv->len; i++) {
-		ir = irv->data[i];
+		ir = &irv->data[i];
 
 		switch (ir->op) {
 		case IR_FUNC_DEF:
 			printf("	.section .text\n");
-			printf("	.global %s\n", ir->name);
-			printf("	.type %s, @function\n", ir->name);
-			printf("%s:\n", ir->name);
+			printf("	.global %s\n", ir_name(ir));
+			printf("	.type %s, @function\n", ir_name(ir));
+			printf("%s:\n", ir_name(ir));
 			printf("	sd	ra, -%d(sp)\n", COMPILE_WORD_SIZE);
 			printf("	sd	s0, -%d(sp)\n", COMPILE_WORD_SIZE * 2);
 			printf("	mv	s0, sp\n");
@@ -61,7 +188,7 @@ void gen_riscv(struct vector_t *irv, struct dict_t *d)
 		case IR_FUNC_CALL: {
 			struct using_regs_list_t *using_regs;
 
-			using_regs = get_using_regs(ir->rhs);
+			using_regs = get_using_regs(ir->src[1]);
 
 			printf("	addi	sp, sp, -%d\n",
 			       using_regs->num * COMPILE_WORD_SIZE + COMPILE_WORD_SIZE);
@@ -71,7 +198,11 @@ void gen_riscv(struct vector_t *irv, struct dict_t *d)
 				printf("	sd	%s, %d(sp)\n", get_temp_reg_str(using_regs->list[j]),
 				       j * COMPILE_WORD_SIZE + COMPILE_WORD_SIZE);
 
-			printf("	call	%s\n", ir->name);
+			printf("	call	%s\n", ir_name(ir));
+
+			/* 戻ったa0を戻す前に受け取る */
+			if (ir->dst >= 0)
+				printf("	mv	%s, a0\n", get_temp_reg_str(ir->dst));
 
 			for (j = using_regs->num - 1; j >= 0; j--)
 				printf("	ld	%s, %d(sp)\n", get_temp_reg_str(using_regs->list[j]),
@@ -79,37 +210,33 @@ void gen_riscv(struct vector_t *irv, struct dict_t *d)
 
 			printf("	ld	ra, 0(sp)\n");
 			printf("	addi	sp, sp, %d\n", using_regs->num * COMPILE_WORD_SIZE + COMPILE_WORD_SIZE);
-			printf("	mv	%s, a0\n", get_temp_reg_str(ir->lhs));
 			break;
 		}
 
 		case IR_FUNC_PARAM:
-			printf("	sw	%s, 0(%s)\n", get_temp_reg_str(ir->rhs), get_temp_reg_str(ir->lhs));
+			printf("	la	%s, %s\n", get_temp_reg_str(ir->dst), ir_name(ir));
+			printf("	sw	a%d, 0(%s)\n", ir->src[0], get_temp_reg_str(ir->dst));
 			break;
 
-		case IR_FUNC_ARG:
-			printf("	mv	%s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->rhs));
-			break;
+		case IR_FUNC_ARG: {
+			char reg[8];
 
-		case IR_FUNC_END:
-			printf("	.size %s, . - %s\n\n", ir->name, ir->name);
+			snprintf(reg, sizeof(reg), "a%d", ir->src[0]);
+			gen_move(reg, ir, 1);
 			break;
+		}
 
-		case IR_IMM:
-			printf("	li	%s, %d\n", get_temp_reg_str(ir->lhs), ir->rhs);
+		case IR_FUNC_END:
+			printf("	.size %s, . - %s\n\n", ir_name(ir), ir_name(ir));
 			break;
 
 		case IR_MOV:
-			printf("	mv	%s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->rhs));
-			break;
-
-		case IR_LOADADDR:
-			printf("	la	%s, %s\n", get_temp_reg_str(ir->lhs), ir->name);
+			gen_move(get_temp_reg_str(ir->dst), ir, 0);
 			break;
 
 		case IR_RETURN:
-			if (ir->lhs != -1)
-				printf("	mv	a0, %s\n", get_temp_reg_str(ir->lhs));
+			if (ir->kind[0] != IR_OPERAND_NONE)
+				gen_move("a0", ir, 0);
 			printf("	ld	ra, -%d(s0)\n", COMPILE_WORD_SIZE);
 			printf("	ld	s0, -%d(s0)\n", COMPILE_WORD_SIZE * 2);
 			printf("	addi	sp, sp, %d\n", COMPILE_WORD_SIZE * 2);
@@ -117,96 +244,59 @@ void gen_riscv(struct vector_t *irv, struct dict_t *d)
 			break;
 
 		case IR_PLUS:
-			printf("	add	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			break;
-
 		case IR_MINUS:
-			printf("	sub	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			break;
-
 		case IR_MUL:
-			printf("	mul	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			break;
-
 		case IR_DIV:
-			printf("	div	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			break;
-
 		case IR_MOD:
-			printf("	rem	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			break;
-
 		case IR_AND:
-			printf("	and	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			break;
-
 		case IR_OR:
-			printf("	or	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			break;
-
 		case IR_XOR:
-			printf("	xor	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
+		case IR_SLT:
+		case IR_SLET:
+		case IR_LEFT_OP:
+		case IR_RIGHT_OP:
+			gen_arith(ir);
 			break;
 
 		case IR_NOT:
-			printf("	not	%s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs));
+			printf("	not	%s, %s\n", get_temp_reg_str(ir->dst), reg_operand(ir, 0));
 			break;
 
 		case IR_STORE:
-			printf("	sw	%s, 0(%s)\n", get_temp_reg_str(ir->rhs), get_temp_reg_str(ir->lhs));
+			printf("	la	%s, %s\n", get_temp_reg_str(ir->dst), ir_name(ir));
+			printf("	sw	%s, 0(%s)\n", reg_operand(ir, 1), get_temp_reg_str(ir->dst));
 			break;
 
 		case IR_LOAD:
-			printf("	lw	%s, 0(%s)\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->rhs));
+			printf("	la	%s, %s\n", get_temp_reg_str(ir->dst), ir_name(ir));
+			printf("	lw	%s, 0(%s)\n", get_temp_reg_str(ir->dst), get_temp_reg_str(ir->dst));
 			break;
 
 		case IR_BEQZ:
-			printf("	beqz	%s, .L%d\n", get_temp_reg_str(ir->lhs), ir->rhs);
-			break;
-
-		case IR_SLT:
-			printf("	slt	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			break;
-
-		case IR_SLET:
-			printf("	slt	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			printf("	xori	%s, %s, 1\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs));
-			break;
-
-		case IR_LEFT_OP:
-			printf("	sllw	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
-			break;
-
-		case IR_RIGHT_OP:
-			printf("	srl	%s, %s, %s\n", get_temp_reg_str(ir->lhs), get_temp_reg_str(ir->lhs),
-			       get_temp_reg_str(ir->rhs));
+			/* 条件が定数なら分岐を決めてしまう */
+			check_operand(ir, 0);
+			if (ir->kind[0] != IR_OPERAND_IMM)
+				printf("	beqz	%s, .L%d\n", get_temp_reg_str(ir->src[0]), ir->src[1]);
+			else if (ir->src[0] == 0)
+				printf("	j	.L%d\n", ir->src[1]);
 			break;
 
 		case IR_JUMP:
-			printf("	j	.L%d\n", ir->lhs);
+			printf("	j	.L%d\n", ir->src[0]);
 			break;
 
 		case IR_LABEL:
-			printf(".L%d:\n", ir->lhs);
-			break;
-
-		case IR_EQ_OP:
-		case IR_NE_OP:
-		case IR_KILL:
-		case IR_KILL_ARG:
-		case IR_NOP:
+			printf(".L%d:\n", ir->src[0]);
 			break;
 		}
 	}
 }
+
+/**
+ * @brief RISC-Vのアセンブラを生成する
+ */
+void gen_riscv(struct ir_list_t *irv, struct dict_t *d)
+{
+	gen_riscv_data(d);
+	gen_riscv_text(irv);
+}
@@ -5,12 +5,12 @@
 /**
  * @brief トークナイザーの出力を表示する
  */
-void show_token(FILE *file, struct vector_t *tokens)
+void show_token(FILE *file, struct token_stream_t *tokens)
 {
 	unsigned int i;
 
-	for (i = 0; i < tokens->len; i++) {
-		token_type_t tt = ((struct token_t *)(tokens->data[i]))->type;
+	for (i = 0; i < tokens->tail; i++) {
+		token_type_t tt = tokens->types[i];
 		fprintf(file, ASM_COMMENTOUT_STR "%02d: %s(%d)\n", i, get_token_str(tt), tt);
 	}
 }
@@ -88,13 +88,89 @@ static void print_indent(FILE *file, unsigned int indent)
 		fputc(' ', file);
 }
 
+/**
+ * @brief show_node()が積む表示項目
+ */
+struct show_item_t {
+	const char *label;   /**< 見出し (NULLなら見出しなし) */
+	int index;	     /**< 見出しの番号 (-1なら番号なし) */
+	const char *name;    /**< 名前 (NULLでなければ名前の行を表示する) */
+	node_id_t id;	     /**< ノード */
+	unsigned int indent; /**< インデント段数 */
+};
+
+/**
+ * @brief show_node()のスタック
+ */
+static struct {
+	struct show_item_t *items; /**< 表示項目の配列 */
+	size_t len;		   /**< 積んでいる項目の数 */
+	size_t capacity;	   /**< itemsの容量 */
+} show_stack;
+
+/**
+ * @brief 表示項目を積む
+ */
+static void push_show_item(const char *label, int index, const char *name, node_id_t id, unsigned int indent)
+{
+	struct show_item_t *item;
+
+	if (show_stack.len >= show_stack.capacity)
+		grow_array(&show_stack.items, &show_stack.capacity, sizeof(struct show_item_t), show_stack.len + 1);
+
+	item = &show_stack.items[show_stack.len++];
+	item->label = label;
+	item->index = index;
+	item->name = name;
+	item->id = id;
+	item->indent = indent;
+}
+
+/**
+ * @brief 子ノードを見出し付きで表示するように積む
+ * @param[in] label   見出し
+ * @param[in] child   子ノード (NODE_NULLなら何もしない)
+ * @param[in] indent  親のインデント段数
+ */
+static void push_show_child(const char *label, node_id_t child, unsigned int indent)
+{
+	if (child != NODE_NULL)
+		push_show_item(label, -1, NULL, child, indent + 1);
+}
+
+/**
+ * @brief 子リストの要素を番号付きの見出しで表示するように積む
+ * @param[in] label   見出し
+ * @param[in] list    子リスト
+ * @param[in] indent  親のインデント段数
+ * @note 先頭の要素から表示されるように, 末尾から積む.
+ */
+static void push_show_list(const char *label, list_id_t list, unsigned int indent)
+{
+	size_t i;
+
+	for (i = list_length(list); i > 0; i--)
+		push_show_item(label, i - 1, NULL, list_at(list, i - 1), indent + 1);
+}
+
+/**
+ * @brief ノードの名前を表示するように積む
+ * @param[in] name    名前 (NULLなら何もしない)
+ * @param[in] indent  親のインデント段数
+ */
+static void push_show_name(const char *name, unsigned int indent)
+{
+	if (name != NULL)
+		push_show_item(NULL, -1, name, NODE_NULL, indent + 1);
+}
+
 /**
  * @brief パーサーの出力を表示する
  * @param[out] file   出力先
  * @param[in]  node   ノードデータ
  * @param[in]  indent インデント段数
  */
-void show_node(FILE *file, struct node_t *node, unsigned int indent)
+void show_node(FILE *file, node_id_t node, unsigned int indent)
 {
 	const char *table[] = {
 		TRANS_ELEMENT(ND_PLUS),		       /**< + */
@@ -132,83 +208,120 @@ void show_node(FILE *file, struct node_t *node, unsigned int indent)
 		TRANS_ELEMENT(ND_FUNC_PARAM),	  /**< 関数パラメータ */
 		TRANS_ELEMENT(ND_PROGRAM),	     /**< プログラム (スタートポイント) */
 	};
-	size_t i;
+	const struct node_t *n;
+	struct show_item_t item;
+	size_t base = show_stack.len;
+	int value;
 
-	if (node == NULL)
+	if (node == NODE_NULL)
 		return;
 
-	fprintf(file, ASM_COMMENTOUT_STR);
-	print_indent(file, indent);
+	/* 子は表示する順と逆に積み, 積んだ順と逆に取り出して前順に表示する */
+	push_show_item(NULL, -1, NULL, node, indent);
 
-	fprintf(file, "%s: %d\n", table[node->type], node->value);
+	while (show_stack.len > base) {
+		item = show_stack.items[--show_stack.len];
 
-	if (node->list != NULL) {
-		for (i = 0; i < node->list->len; i++) {
+		if (item.name != NULL) {
 			fprintf(file, ASM_COMMENTOUT_STR);
-			print_indent(file, indent + 1);
-			color_printf(file, COL_GREEN, "list%d:\n", i);
-			show_node(file, node->list->data[i], indent + 1);
+			print_indent(file, item.indent);
+			color_printf(file, COL_GREEN, "name: ");
+			fprintf(file, "%s\n", item.name);
+			continue;
 		}
-	}
 
-	if (node->parameter_list != NULL) {
-		for (i = 0; i < node->parameter_list->len; i++) {
+		if (item.label != NULL) {
 			fprintf(file, ASM_COMMENTOUT_STR);
-			print_indent(file, indent + 1);
-			color_printf(file, COL_GREEN, "parameter_list%d:\n", i);
-			show_node(file, node->parameter_list->data[i], indent + 1);
+			print_indent(file, item.indent);
+			if (item.index >= 0)
+				color_printf(file, COL_GREEN, "%s%d:\n", item.label, item.index);
+			else
+				color_printf(file, COL_GREEN, "%s:\n", item.label);
 		}
-	}
 
-	if (node->condition != NULL) {
-		fprintf(file, ASM_COMMENTOUT_STR);
-		print_indent(file, indent + 1);
-		color_printf(file, COL_GREEN, "condition:\n");
-		show_node(file, node->condition, indent + 1);
-	}
+		n = get_node(item.id);
 
-	if (node->consequence != NULL) {
-		fprintf(file, ASM_COMMENTOUT_STR);
-		print_indent(file, indent + 1);
-		color_printf(file, COL_GREEN, "consequence:\n");
-		show_node(file, node->consequence, indent + 1);
-	}
+		/* 値を持たないノードは -1 を表示する */
+		if (n->type == ND_CONST || n->type == ND_FUNC_ARG)
+			value = n->value;
+		else if (n->type == ND_VAR_INIT_DLIST)
+			value = 0;
+		else
+			value = -1;
 
-	if (node->alternative != NULL) {
 		fprintf(file, ASM_COMMENTOUT_STR);
-		print_indent(file, indent + 1);
-		color_printf(file, COL_GREEN, "alternative:\n");
-		show_node(file, node->alternative, indent + 1);
-	}
+		print_indent(file, item.indent);
 
-	if (node->name != NULL) {
-		fprintf(file, ASM_COMMENTOUT_STR);
-		print_indent(file, indent + 1);
-		color_printf(file, COL_GREEN, "name: ");
-		fprintf(file, "%s\n", node->name);
-	}
+		fprintf(file, "%s: %d\n", table[n->type], value);
 
-	if (node->lhs != NULL) {
-		fprintf(file, ASM_COMMENTOUT_STR);
-		print_indent(file, indent + 1);
-		color_printf(file, COL_GREEN, "lhs:\n");
-		show_node(file, node->lhs, indent + 1);
+		switch (n->type) {
+		case ND_PROGRAM:
+		case ND_COMPOUND_STATEMENTS:
+		case ND_VAR_INIT_DLIST:
+			push_show_list("list", n->list, item.indent);
+			break;
+		case ND_FUNC_CALL:
+			push_show_child("lhs", n->lhs, item.indent);
+			push_show_name(node_name(item.id), item.indent);
+			push_show_list("list", n->list, item.indent);
+			break;
+		case ND_IDENT:
+			push_show_child("rhs", n->rhs, item.indent);
+			push_show_name(node_name(item.id), item.indent);
+			push_show_list("parameter_list", n->parameter_list, item.indent);
+			break;
+		case ND_TYPE:
+			push_show_child("lhs", n->lhs, item.indent);
+			push_show_name(node_name(item.id), item.indent);
+			break;
+		case ND_IF:
+			push_show_child("alternative", n->alternative, item.indent);
+			push_show_child("consequence", n->consequence, item.indent);
+			push_show_child("condition", n->condition, item.indent);
+			break;
+		case ND_CONST:
+		case ND_RETURN:
+		case ND_EXPRESSION:
+			break;
+		default:
+			push_show_child("rhs", n->rhs, item.indent);
+			push_show_child("lhs", n->lhs, item.indent);
+			break;
+		}
 	}
+}
 
-	if (node->rhs != NULL) {
-		fprintf(file, ASM_COMMENTOUT_STR);
-		print_indent(file, indent + 1);
-		color_printf(file, COL_GREEN, "rhs:\n");
-		show_node(file, node->rhs, indent + 1);
+/**
+ * @brief IRのオペランドを表示する
+ */
+static void show_ir_operand(FILE *file, const struct ir_t *ir, int k)
+{
+	const char *sep = (k == 0) ? " " : ", ";
+
+	switch (ir->kind[k]) {
+	case IR_OPERAND_REG:
+		fprintf(file, "%sr%d", sep, ir->src[k]);
+		break;
+	case IR_OPERAND_IMM:
+		fprintf(file, "%s#%d", sep, ir->src[k]);
+		break;
+	case IR_OPERAND_SYM:
+		fprintf(file, "%s%s", sep, intern_name(ir->src[k]));
+		break;
+	case IR_OPERAND_LABEL:
+		fprintf(file, "%s.L%d", sep, ir->src[k]);
+		break;
+	default:
+		break;
 	}
 }
 
 /**
  * @brief IRの出力を表示する
  * @param[out] file  出力先
- * @param[in]  irv   IRベクター
+ * @param[in]  irv   IRの列
  */
-void show_ir(FILE *file, struct vector_t *irv)
+void show_ir(FILE *file, struct ir_list_t *irv)
 {
 	struct ir_t *ir;
 	unsigned int i;
@@ -216,46 +329,45 @@ void show_ir(FILE *file, struct vector_t *irv)
 	struct using_regs_list_t *using_regs;
 
 	const char *OP2STR[] = {
-		TRANS_ELEMENT(IR_PLUS),	//
+		TRANS_ELEMENT(IR_PLUS),	       //
 		TRANS_ELEMENT(IR_MINUS),       //
-		TRANS_ELEMENT(IR_MUL),	 //
-		TRANS_ELEMENT(IR_DIV),	 //
-		TRANS_ELEMENT(IR_MOD),	 /**< 剰余を求める a0 % a1 */
-		TRANS_ELEMENT(IR_AND),	 /**< 論理積 */
-		TRANS_ELEMENT(IR_OR),	  /**< 論理和 */
-		TRANS_ELEMENT(IR_NOT),	 /**< 論理否定 */
-		TRANS_ELEMENT(IR_XOR),	 /**< 排他的論理和 */
-		TRANS_ELEMENT(IR_EQ_OP),       /**< == */
-		TRANS_ELEMENT(IR_NE_OP),       /**< != */
-		TRANS_ELEMENT(IR_SLT),	 /**< < */
-		TRANS_ELEMENT(IR_SLET),	/**< <= */
+		TRANS_ELEMENT(IR_MUL),	       //
+		TRANS_ELEMENT(IR_DIV),	       //
+		TRANS_ELEMENT(IR_MOD),	       /**< 剰余を求める a0 % a1 */
+		TRANS_ELEMENT(IR_AND),	       /**< 論理積 */
+		TRANS_ELEMENT(IR_OR),	       /**< 論理和 */
+		TRANS_ELEMENT(IR_NOT),	       /**< 論理否定 */
+		TRANS_ELEMENT(IR_XOR),	       /**< 排他的論理和 */
+		TRANS_ELEMENT(IR_SLT),	       /**< < */
+		TRANS_ELEMENT(IR_SLET),	       /**< >= */
 		TRANS_ELEMENT(IR_LEFT_OP),     /**< << */
 		TRANS_ELEMENT(IR_RIGHT_OP),    /**< >> */
 		TRANS_ELEMENT(IR_RETURN),      //
-		TRANS_ELEMENT(IR_IMM),	 //
-		TRANS_ELEMENT(IR_MOV),	 //
-		TRANS_ELEMENT(IR_KILL),	//
-		TRANS_ELEMENT(IR_KILL_ARG),    /**< アーギュメントレジスタを解放する */
-		TRANS_ELEMENT(IR_LOAD),	//
+		TRANS_ELEMENT(IR_MOV),	       //
+		TRANS_ELEMENT(IR_LOAD),	       //
 		TRANS_ELEMENT(IR_STORE),       //
-		TRANS_ELEMENT(IR_LOADADDR),    //
-		TRANS_ELEMENT(IR_BEQZ),	/**< lhs がゼロならブランチする */
-		TRANS_ELEMENT(IR_JUMP),	/**< ジャンプする */
+		TRANS_ELEMENT(IR_BEQZ),	       /**< src1 がゼロならブランチする */
+		TRANS_ELEMENT(IR_JUMP),	       /**< ジャンプする */
 		TRANS_ELEMENT(IR_LABEL),       /**< ラベルを生成 */
 		TRANS_ELEMENT(IR_FUNC_DEF),    /**< 関数定義 */
 		TRANS_ELEMENT(IR_FUNC_CALL),   /**< 関数呼び出し */
 		TRANS_ELEMENT(IR_FUNC_END),    /**< 関数定義終端 */
 		TRANS_ELEMENT(IR_FUNC_ARG),    /**< 関数引数 */
 		TRANS_ELEMENT(IR_FUNC_PARAM),  /**< 関数パラメータ */
-		TRANS_ELEMENT(IR_NOP),
 	};
 
 	for (i = 0; i < irv->len; i++) {
-		ir = irv->data[i];
-		fprintf(file, ASM_COMMENTOUT_STR "%s(%d) %d %d %s\n", OP2STR[ir->op], ir->op, ir->lhs, ir->rhs,
-			ir->name);
+		ir = &irv->data[i];
+		fprintf(file, ASM_COMMENTOUT_STR "%s(%d)", OP2STR[ir->op], ir->op);
+		if (ir->dst >= 0)
+			fprintf(file, " r%d =", ir->dst);
+		show_ir_operand(file, ir, 0);
+		show_ir_operand(file, ir, 1);
+		fprintf(file, "\n");
 
-		if (ir->op == IR_FUNC_CALL && (using_regs = get_using_regs(ir->rhs)) != NULL) {
+		/* 使用中レジスタはallocate_regs()の後に記録される */
+		if (ir->op == IR_FUNC_CALL && ir->kind[1] == IR_OPERAND_IMM &&
+		    (using_regs = get_using_regs(ir->src[1])) != NULL) {
 			fprintf(file, ASM_COMMENTOUT_STR "  regs: ");
 
 			for (j = 0; j < using_regs->num; j++)
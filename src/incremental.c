@@ -0,0 +1,442 @@
+/**
+ * @brief インクリメンタルパーサー
+ *
+ * 入力をexternal_declarationごとの区間に分けて持ち, 編集を受けると影響する区間だけを
+ * 字句解析・パースし直して, ND_PROGRAMの子リストに差し替える.
+ *
+ * 区間の境界はトークンの先頭なので, 境界の前後の文字が変わらなければ字句解析の結果は区間をまたがない.
+ * パースも文脈に依存しないので, 区間ごとにパースした結果は入力全体をパースした結果と一致する.
+ *
+ * パースできなかったexternal_declarationは, エラーの位置より後で行頭にある型名の直前までを
+ * エラーの区間1つにし, そこから続きをパースする. エラーがあっても編集のたびにパースし直すのは
+ * 編集した区間とそれに隣り合うエラーの区間だけなので, 時間はエラーの位置によらない.
+ *
+ * ノードは共通のアリーナにつくる. 同じ区間を続けて編集すると, 前回パースし直したノードはアリーナの
+ * 末尾に並んでいるので, 巻き戻してから新しいノードをつくる. 離れた区間の編集や, 子リストを
+ * 作り直したときに捨てたノードは, パーサーを解放するまでアリーナに残る.
+ */
+#include <setjmp.h>
+#include <string.h>
+
+#include "rw2rvc2.h"
+
+/**
+ * @brief パースし直す範囲の入力
+ */
+static struct {
+	char *buf;	 /**< 入力文字列 */
+	size_t len;	 /**< bufの長さ */
+	size_t capacity; /**< bufの容量 */
+} region;
+
+/**
+ * @brief パースし直した区間
+ */
+struct parsed_t {
+	size_t begin;	/**< 範囲の入力中のオフセット */
+	size_t len;	/**< 長さ */
+	node_id_t node; /**< パース結果のノード */
+	bool error;	/**< パースできなかったか */
+};
+
+/**
+ * @brief パースし直した区間の配列
+ */
+static struct {
+	struct parsed_t *segs; /**< 区間の配列 */
+	size_t len;	       /**< 区間の数 */
+	size_t capacity;       /**< segsの容量 */
+	bool open_end;	       /**< 範囲の末尾まで読んでもexternal_declarationが終わらなかったか */
+} parsed;
+
+/**
+ * @brief パースし直す範囲の末尾に文字列を足す
+ */
+static void append_region(const char *s, size_t len)
+{
+	if (region.len + len + 1 > region.capacity)
+		grow_array(&region.buf, &region.capacity, sizeof(char), region.len + len + 1);
+
+	memcpy(region.buf + region.len, s, len);
+	region.len += len;
+	region.buf[region.len] = '\0';
+}
+
+/**
+ * @brief パースし直す範囲の一部を置き換える
+ */
+static void splice_region(size_t begin, size_t end, const char *s, size_t len)
+{
+	size_t tail = region.len - end;
+
+	if (region.len - (end - begin) + len + 1 > region.capacity)
+		grow_array(&region.buf, &region.capacity, sizeof(char), region.len - (end - begin) + len + 1);
+
+	memmove(region.buf + begin + len, region.buf + end, tail);
+	memcpy(region.buf + begin, s, len);
+	region.len = begin + len + tail;
+	region.buf[region.len] = '\0';
+}
+
+/**
+ * @brief ノードアリーナの使用位置が同じか判断する
+ */
+static bool same_mark(struct node_mark_t a, struct node_mark_t b)
+{
+	return a.len == b.len && a.lists_len == b.lists_len;
+}
+
+/**
+ * @brief 閉じていないコメントで終わるかどうか判断する
+ * @param[in] p  入力文字列へのポインタ
+ * @return  true or false
+ */
+static bool ends_in_comment(const char *p)
+{
+	while ((p = strstr(p, "/*")) != NULL) {
+		p = scan_comment_end(p + 2);
+
+		if (*p == '\0')
+			return true;
+		p += 2;
+	}
+
+	return false;
+}
+
+/**
+ * @brief パースし直した区間を足す
+ */
+static void push_parsed(size_t begin, size_t len, node_id_t node, bool error)
+{
+	struct parsed_t *seg;
+
+	if (parsed.len >= parsed.capacity)
+		grow_array(&parsed.segs, &parsed.capacity, sizeof(struct parsed_t), parsed.len + 1);
+
+	seg = &parsed.segs[parsed.len++];
+	seg->begin = begin;
+	seg->len = len;
+	seg->node = node;
+	seg->error = error;
+}
+
+/**
+ * @brief パースできなかったexternal_declarationの後で, 次のexternal_declarationの先頭まで読み飛ばす
+ * @param[in,out] tokens  トークンストリーム (エラーの位置にある)
+ * @param[in,out] base    トークンストリームの先頭の範囲中のオフセット
+ * @param[in]     start   パースできなかったexternal_declarationの先頭のオフセット
+ * @return 次の先頭のオフセット. 見つからなければ範囲の長さ.
+ *
+ * 次の先頭は, エラーの位置から後で行頭にある型名 (int) とする. 字句解析できない文字があれば,
+ * その次の文字からトークンストリームをつくり直す.
+ */
+static size_t skip_to_declaration(struct token_stream_t *tokens, size_t *base, size_t start)
+{
+	jmp_buf env;
+	token_type_t t;
+	size_t offset;
+
+	syntax_error_jmp = &env;
+
+	if (setjmp(env) != 0) {
+		offset = tokens->p - region.buf + 1;
+		release_token_stream(tokens);
+		init_token_stream(tokens, region.buf + offset);
+		*base = offset;
+	}
+
+	for (;;) {
+		t = peek_token(tokens);
+		offset = *base + tokens->offsets[tokens->pos & tokens->mask];
+
+		if (t == TK_EOF || (t == TK_INT && offset > start && region.buf[offset - 1] == '\n'))
+			break;
+		advance_token(tokens);
+	}
+
+	syntax_error_jmp = NULL;
+
+	return offset;
+}
+
+/**
+ * @brief パースし直す範囲をexternal_declarationごとにパースする
+ * @return 全てパースできたら0, できなければ-1
+ *
+ * 結果はparsedに入れる. 空白とコメントだけの範囲はノードを持たない区間1つにする.
+ * パースできなかったexternal_declarationは次の先頭までをエラーの区間にして, 続きをパースする.
+ */
+static int parse_region(void)
+{
+	struct token_stream_t tokens;
+	size_t base = 0, start = 0, next;
+	node_id_t n;
+	int ret = 0;
+
+	parsed.len = 0;
+	parsed.open_end = false;
+	init_token_stream(&tokens, region.buf);
+
+	for (;;) {
+		if (parse_external_declaration(&tokens, &n) == 0) {
+			if (n == NODE_NULL && peek_token(&tokens) == TK_EOF)
+				break;
+
+			/* 次の区間は次のトークンから. EOFの位置は入力の末尾. */
+			if (n != NODE_NULL) {
+				next = base + tokens.offsets[tokens.pos & tokens.mask];
+				push_parsed(start, next - start, n, false);
+				start = next;
+				continue;
+			}
+		}
+
+		/*
+		 * パースできなかった. 範囲の末尾 (EOF) で止まったなら, 後ろの入力を足せばパースできるかもしれない.
+		 * 字句解析のエラーならエラーの位置のトークンはまだない.
+		 */
+		ret = -1;
+		if (tokens.pos < tokens.tail && peek_token(&tokens) == TK_EOF)
+			parsed.open_end = true;
+
+		next = skip_to_declaration(&tokens, &base, start);
+		push_parsed(start, next - start, NODE_NULL, true);
+		start = next;
+	}
+
+	release_token_stream(&tokens);
+
+	if (start < region.len)
+		push_parsed(start, region.len - start, NODE_NULL, false);
+
+	return ret;
+}
+
+/**
+ * @brief 注目する区間を1つ前に動かす
+ */
+static void cursor_prev(struct incremental_parser_t *ip)
+{
+	const struct parse_segment_t *seg = &ip->segments[--ip->cursor];
+
+	ip->cursor_offset -= seg->len;
+	if (seg->node != NODE_NULL)
+		ip->cursor_nodes--;
+}
+
+/**
+ * @brief 注目する区間を1つ後ろに動かす
+ */
+static void cursor_next(struct incremental_parser_t *ip)
+{
+	const struct parse_segment_t *seg = &ip->segments[ip->cursor++];
+
+	ip->cursor_offset += seg->len;
+	if (seg->node != NODE_NULL)
+		ip->cursor_nodes++;
+}
+
+/**
+ * @brief 入力中のオフセットを含む区間に注目する
+ *
+ * 前回の位置から辿るので, 編集が近ければ区間の数によらない.
+ */
+static void seek_segment(struct incremental_parser_t *ip, size_t offset)
+{
+	while (ip->cursor > 0 && offset < ip->cursor_offset)
+		cursor_prev(ip);
+
+	while (ip->cursor + 1 < ip->num_segments && offset >= ip->cursor_offset + ip->segments[ip->cursor].len)
+		cursor_next(ip);
+}
+
+/**
+ * @brief 注目している区間から[a, e)をパースし直した区間に置き換える
+ * @param[in] ip     インクリメンタルパーサー
+ * @param[in] e      置き換える最後の区間の次
+ *
+ * aはip->cursorである.
+ */
+static void replace_segments(struct incremental_parser_t *ip, size_t e)
+{
+	struct parse_segment_t *seg;
+	size_t a = ip->cursor, k = ip->cursor_nodes;
+	size_t old_nodes = 0, new_nodes = 0;
+	size_t i, mark;
+
+	for (i = a; i < e; i++) {
+		if (ip->segments[i].node != NODE_NULL)
+			old_nodes++;
+		if (ip->segments[i].error)
+			ip->num_errors--;
+		free(ip->segments[i].text);
+	}
+
+	if (ip->num_segments - (e - a) + parsed.len > ip->capacity)
+		grow_array(&ip->segments, &ip->capacity, sizeof(struct parse_segment_t),
+			   ip->num_segments - (e - a) + parsed.len);
+
+	if (parsed.len != e - a) {
+		memmove(&ip->segments[a + parsed.len], &ip->segments[e],
+			sizeof(struct parse_segment_t) * (ip->num_segments - e));
+		ip->num_segments = ip->num_segments - (e - a) + parsed.len;
+	}
+
+	for (i = 0; i < parsed.len; i++) {
+		seg = &ip->segments[a + i];
+		seg->len = parsed.segs[i].len;
+		seg->node = parsed.segs[i].node;
+		seg->error = parsed.segs[i].error;
+
+		if ((seg->text = malloc(seg->len + 1)) == NULL) {
+			color_printf(stderr, COL_RED, "memory allocation failed\n");
+			exit(1);
+		}
+		memcpy(seg->text, region.buf + parsed.segs[i].begin, seg->len);
+		seg->text[seg->len] = '\0';
+
+		if (seg->node != NODE_NULL)
+			new_nodes++;
+		if (seg->error)
+			ip->num_errors++;
+	}
+
+	/* 新しいノードは[a, a + parsed.len)の区間だけが持つ */
+	ip->tail_first = a;
+	ip->tail_count = parsed.len;
+
+	/* 子の数が変わらなければ子リストをその場で差し替え, 変われば作り直す */
+	if (old_nodes == new_nodes) {
+		for (i = 0; i < parsed.len; i++)
+			if (parsed.segs[i].node != NODE_NULL)
+				list_set(get_node(ip->program)->list, k++, parsed.segs[i].node);
+		return;
+	}
+
+	/* 作り直した子リストも末尾に置くので, 巻き戻すと子リストまで捨ててしまう */
+	ip->tail_count = 0;
+
+	mark = list_begin();
+	for (i = 0; i < ip->num_segments; i++)
+		if (ip->segments[i].node != NODE_NULL)
+			list_push(ip->segments[i].node);
+	get_node(ip->program)->list = list_end(mark);
+}
+
+/**
+ * @brief インクリメンタルパーサーを初期化し, 入力全体をパースする
+ */
+int init_incremental_parser(struct incremental_parser_t *ip, const char *code)
+{
+	ip->segments = NULL;
+	ip->num_segments = 0;
+	ip->capacity = 0;
+	ip->len = strlen(code);
+	ip->base = node_mark();
+	ip->num_errors = 0;
+	ip->program = new_node(ND_PROGRAM, NODE_NULL, NODE_NULL);
+	get_node(ip->program)->list = 0;
+	ip->cursor = 0;
+	ip->cursor_offset = 0;
+	ip->cursor_nodes = 0;
+	ip->tail_count = 0;
+
+	region.len = 0;
+	append_region(code, ip->len);
+
+	ip->tail = node_mark();
+	parse_region();
+	replace_segments(ip, 0);
+	ip->tail_end = node_mark();
+
+	return (ip->num_errors == 0) ? 0 : -1;
+}
+
+/**
+ * @brief 入力を編集し, 影響を受けるexternal_declarationだけをパースし直す
+ *
+ * 編集範囲と, その直前・直後の1文字を含む区間をパースし直す. 直前・直後の文字を含めるのは,
+ * 区間の境界で隣のトークンとつながる場合に備えるためである. 隣り合う区間がパースできなかった
+ * 区間なら, 編集によって閉じていない括弧が閉じることもあるので, それらも含める.
+ * 閉じていないコメントで終われば, コメントが閉じるまで後ろの区間を倍々に足していく.
+ * 範囲の末尾でexternal_declarationが終わらなければ, 同じく後ろの区間を倍々に足してパースし直す.
+ */
+int reparse_edit(struct incremental_parser_t *ip, size_t begin, size_t end, const char *text, size_t len)
+{
+	size_t pos, e, i, n;
+
+	if (begin > end || end > ip->len) {
+		error_printf("invalid edit range: %zu-%zu (length %zu)\n", begin, end, ip->len);
+		exit(1);
+	}
+
+	/* 編集範囲にかかる区間[cursor, e)を探す */
+	seek_segment(ip, (begin > 0) ? begin - 1 : 0);
+
+	for (e = ip->cursor, pos = ip->cursor_offset; e < ip->num_segments && end >= pos; e++)
+		pos += ip->segments[e].len;
+
+	/* 隣り合うパースできなかった区間も含める */
+	while (ip->cursor > 0 && ip->segments[ip->cursor - 1].error)
+		cursor_prev(ip);
+	while (e < ip->num_segments && ip->segments[e].error)
+		e++;
+
+	region.len = 0;
+	append_region("", 0);
+	for (i = ip->cursor; i < e; i++)
+		append_region(ip->segments[i].text, ip->segments[i].len);
+	splice_region(begin - ip->cursor_offset, end - ip->cursor_offset, text, len);
+
+	for (n = 1; e < ip->num_segments && ends_in_comment(region.buf); n *= 2) {
+		for (i = 0; i < n && e < ip->num_segments; i++, e++)
+			append_region(ip->segments[e].text, ip->segments[e].len);
+	}
+
+	ip->len = ip->len - (end - begin) + len;
+
+	/* 前回パースし直したノードを全て置き換え, その後に他のノードがなければ巻き戻して使い回す */
+	if (ip->tail_count > 0 && ip->tail_first >= ip->cursor && ip->tail_first + ip->tail_count <= e &&
+	    same_mark(node_mark(), ip->tail_end))
+		release_nodes(ip->tail);
+
+	ip->tail = node_mark();
+	for (n = 1;; n *= 2) {
+		parse_region();
+		if (!parsed.open_end || e >= ip->num_segments)
+			break;
+
+		release_nodes(ip->tail);
+		for (i = 0; i < n && e < ip->num_segments; i++, e++)
+			append_region(ip->segments[e].text, ip->segments[e].len);
+	}
+	replace_segments(ip, e);
+	ip->tail_end = node_mark();
+
+	return (ip->num_errors == 0) ? 0 : -1;
+}
+
+/**
+ * @brief インクリメンタルパーサーを解放する
+ */
+void release_incremental_parser(struct incremental_parser_t *ip)
+{
+	size_t i;
+
+	for (i = 0; i < ip->num_segments; i++)
+		free(ip->segments[i].text);
+	free(ip->segments);
+
+	/* 後から他のノードをつくっていなければ, ノードも捨てる */
+	if (same_mark(node_mark(), ip->tail_end))
+		release_nodes(ip->base);
+
+	ip->segments = NULL;
+	ip->num_segments = 0;
+	ip->capacity = 0;
+	ip->len = 0;
+	ip->cursor = 0;
+	ip->cursor_offset = 0;
+	ip->cursor_nodes = 0;
+}
@@ -17,342 +17,503 @@ static ir_type_t CONVERSION_NODE_TO_IR[] = {
 };
 
 /**
- * @brief allocate memory to a new IR
- * @return allocated ir_t, or NULL if failed
+ * @brief オペランドがないことを表す
  */
-static struct ir_t *allocate_ir(void)
-{
-	const size_t ALLOCATE_SIZE = 256;
-	static struct ir_t *ir_array = NULL;
-	static size_t index = 0;
-
-	/* initial allocation */
-	if (ir_array == NULL || index >= ALLOCATE_SIZE) {
-		if ((ir_array = (struct ir_t *)malloc(sizeof(struct ir_t) * ALLOCATE_SIZE)) == NULL) {
-			error_printf("memmory allocation failed\n");
-			exit(1);
-		}
-		index = 0;
-	}
+static const struct ir_operand_t NO_OPERAND = {IR_OPERAND_NONE, 0};
 
-	index++;
+/**
+ * @brief 次に使う仮想レジスタの番号 (gen_ir()ごとに0から振る)
+ */
+static int regno;
 
-	return &ir_array[index - 1];
+/**
+ * @brief オペランドを作る
+ */
+static struct ir_operand_t operand(ir_operand_kind_t kind, int value)
+{
+	struct ir_operand_t o = {kind, value};
+
+	return o;
 }
 
 /**
- * @brief 新しいIR行を作成つくる
+ * @brief IRの列の末尾に新しいIR行を足す
+ * @param[in] l     IRの列
  * @param[in] op    IRのタイプ
- * @param[in] lhs   LHS
- * @param[in] rhs   RHS
- * @param[in] name  identifier名
- * @return 作成したIRへのポインタ
+ * @param[in] dst   結果のレジスタ (なければ-1)
+ * @param[in] src1  src1
+ * @param[in] src2  src2
  */
-static struct ir_t *new_ir(ir_type_t op, int lhs, int rhs, char *name)
+static void push_ir(struct ir_list_t *l, ir_type_t op, int dst, struct ir_operand_t src1, struct ir_operand_t src2)
 {
-	struct ir_t *ir = allocate_ir();
+	const size_t INITIAL_CAPACITY = 64;
+	struct ir_t *ir;
+
+	if (l->len >= l->capacity) {
+		l->capacity = (l->capacity == 0) ? INITIAL_CAPACITY : l->capacity * 2;
+		l->data = arena_resize(l->arena, l->data, sizeof(struct ir_t) * l->capacity);
+	}
 
+	ir = &l->data[l->len++];
 	ir->op = op;
-	ir->lhs = lhs;
-	ir->rhs = rhs;
-	ir->name = name;
+	ir->kind[0] = src1.kind;
+	ir->kind[1] = src2.kind;
+	ir->dst = dst;
+	ir->src[0] = src1.value;
+	ir->src[1] = src2.value;
 
-	return ir;
+	mem_stats.irs++;
 }
 
 /**
- * @brief 新しい変数データにメモリを割り当てる
- * @param[in] node    変数ノード
- * @param[in] slevel  スコープレベル
+ * @brief 結果を新しい仮想レジスタに置くIRを足す
+ * @return 結果のレジスタ
  */
-static struct variable_t *new_variable(struct node_t *node, int slevel)
+static struct ir_operand_t push_value(struct ir_list_t *v, ir_type_t op, struct ir_operand_t src1,
+				      struct ir_operand_t src2)
 {
-	const size_t ALLOCATE_SIZE = 256;
-	static struct variable_t *var_array = NULL;
-	static size_t index = 0;
-
-	/* assert */
-	if (node == NULL || node->type != ND_IDENT /* @TODO たぶんおかしい*/) {
-		error_printf("unexpected error in %s() (unexpected node type: %d)\n", __FUNCTION__,
-			     (node == NULL) ? -1 : node->type);
-		exit(1);
-	}
+	int dst = regno++;
 
-	if (var_array == NULL || index >= ALLOCATE_SIZE) {
-		if ((var_array = (struct variable_t *)malloc(sizeof(struct variable_t) * ALLOCATE_SIZE)) == NULL) {
-			error_printf("memory allocation error\n");
-			exit(1);
-		}
-		index = 0;
-	}
+	push_ir(v, op, dst, src1, src2);
 
-	var_array[index].node = node;
-	var_array[index].scope_level = slevel;
+	return operand(IR_OPERAND_REG, dst);
+}
 
-	index++;
+/**
+ * @brief 0以外の即値をレジスタに移す
+ *
+ * 0はzeroレジスタで表せるので, 即値のまま返す.
+ */
+static struct ir_operand_t to_reg(struct ir_list_t *v, struct ir_operand_t o)
+{
+	if (o.kind != IR_OPERAND_IMM || o.value == 0)
+		return o;
 
-	return &var_array[index - 1];
+	return push_value(v, IR_MOV, o, NO_OPERAND);
 }
 
 /**
- * @brief IR生成 サブ関数
- * @param[in] v            IRのベクタ
- * @param[in] d            変数の辞書
- * @param[in] node         パースしたノード
- * @param[in] scode_level  スコープレベル
- * @return 上段に渡す結果レジスタ, もしくはそれに相当する値
+ * @brief ビット反転のIRを足す (即値はその場で反転する)
  */
-static int gen_ir_sub(struct vector_t *v, struct dict_t *d, struct node_t *node, int scope_level)
+static struct ir_operand_t push_not(struct ir_list_t *v, struct ir_operand_t src)
 {
-	static int regno = 0;
-	static int label = 0;
-	struct node_t *n = NULL;
-	int lhs, rhs;
-	int r = regno;
-	int l = label;
-	int i = 0;
-	size_t j = 0;
-
-	if (node == NULL)
-		return -1;
+	if (src.kind == IR_OPERAND_IMM)
+		return operand(IR_OPERAND_IMM, ~src.value);
 
-	if (node->type == ND_PROGRAM || node->type == ND_COMPOUND_STATEMENTS) {
+	return push_value(v, IR_NOT, src, NO_OPERAND);
+}
 
-		for (j = 0; j < node->list->len; j++)
-			gen_ir_sub(v, d, node->list->data[j], scope_level + 1);
+/**
+ * @brief 2項のIRを足す
+ *
+ * src1は0以外の即値を取れないので, 入れ替えられる演算は即値をsrc2に回し, できなければレジスタに移す.
+ * src2も命令に即値で書けなければレジスタに移す.
+ */
+static struct ir_operand_t push_binary(struct ir_list_t *v, ir_type_t op, struct ir_operand_t src1,
+				       struct ir_operand_t src2)
+{
+	struct ir_operand_t tmp;
 
-		return -1;
+	if (src1.kind == IR_OPERAND_IMM && src2.kind != IR_OPERAND_IMM &&
+	    (op == IR_PLUS || op == IR_MUL || op == IR_AND || op == IR_OR || op == IR_XOR)) {
+		tmp = src1;
+		src1 = src2;
+		src2 = tmp; /* swap */
 	}
 
-	/* 静的変数の宣言 */
-	if (node->type == ND_VAR_DEC_STATIC) {
-		/* node->lhs: 型, node->rhs: INIT_DLIST  */
+	src1 = to_reg(v, src1);
+	if (src2.kind == IR_OPERAND_IMM && !riscv_imm_operand(op, src2.value))
+		src2 = to_reg(v, src2);
 
-		/* 型名だけの行は何もしない */
-		if (node->rhs == NULL)
-			return -1;
-
-		if (node->rhs->type != ND_VAR_INIT_DLIST) {
-			error_printf("unexpected error\n");
-			exit(1);
-		}
+	return push_value(v, op, src1, src2);
+}
 
-		for (j = 0; j < node->rhs->list->len; j++) {
-			n = node->rhs->list->data[j];
-			dict_append(d, n->name, new_variable(n, 0));
-
-#if 0
-			if (n->rhs != NULL) {
-				rhs = gen_ir_sub(v, d, n->rhs, scope_level);
-				vector_push(v, new_ir(IR_LOADADDR, regno++, -1, n->name));
-				vector_push(v, new_ir(IR_STORE, regno - 1, rhs, NULL));
-				vector_push(v, new_ir(IR_KILL, rhs, 0, NULL));
-				vector_push(v, new_ir(IR_KILL, regno - 1, 0, NULL));
-			}
-#endif
-		}
+/**
+ * @brief 二項演算子のIRを生成する
+ * @param[in] v     IRの列
+ * @param[in] type  ノードタイプ
+ * @param[in] lhs   左辺の結果
+ * @param[in] rhs   右辺の結果
+ * @return 演算結果
+ */
+static struct ir_operand_t gen_binary_operator(struct ir_list_t *v, node_type_t type, struct ir_operand_t lhs,
+					       struct ir_operand_t rhs)
+{
+	struct ir_operand_t tmp;
 
-		return -1;
-	}
+	switch (type) {
+	case ND_AND_OP:
+		/* a && b = ~(~a || ~b) */
+		lhs = push_not(v, lhs);
+		rhs = push_not(v, rhs);
+		return push_not(v, push_binary(v, IR_OR, lhs, rhs));
 
-	/* ローカル変数の宣言 */
-	if (node->type == ND_VAR_DEC) {
-		error_printf("local variable is not supported yet... %s\n", node->name);
-		exit(1);
-		/* NOTREACHED */
-	}
+	case ND_EQ_OP:
+		return push_not(v, push_binary(v, IR_MINUS, lhs, rhs));
 
-	if (node->type == ND_RETURN) {
-		lhs = gen_ir_sub(v, d, node->expression, scope_level);
-		vector_push(v, new_ir(IR_RETURN, lhs, 0, NULL));
-		vector_push(v, new_ir(IR_KILL, lhs, 0, NULL));
-		return r;
-	}
+	case ND_NE_OP:
+		return push_binary(v, IR_MINUS, lhs, rhs);
 
-	if (node->type == ND_CONST) {
-		vector_push(v, new_ir(IR_IMM, regno++, node->value, NULL));
-		return r;
-	}
+	case ND_LESS_OP:
+	case ND_GREATER_OP:
+	case ND_LE_OP:
+	case ND_GE_OP:
+		if (type == ND_GREATER_OP || type == ND_LE_OP) {
+			tmp = lhs;
+			lhs = rhs;
+			rhs = tmp; /* swap */
+		}
 
-	if (node->type == ND_ASSIGN) {
-		rhs = gen_ir_sub(v, d, node->rhs, scope_level);
-		lhs = gen_ir_sub(v, d, node->lhs, scope_level);
-		vector_push(v, new_ir(IR_LOADADDR, regno++, -1, node->lhs->name));
-		vector_push(v, new_ir(IR_STORE, regno - 1, rhs, NULL));
-		vector_push(v, new_ir(IR_KILL, lhs, 0, NULL));
-		vector_push(v, new_ir(IR_KILL, rhs, 0, NULL));
-		vector_push(v, new_ir(IR_KILL, regno - 1, 0, NULL));
-		return -1;
-	}
+		return push_binary(v, (type == ND_LESS_OP || type == ND_GREATER_OP) ? IR_SLT : IR_SLET, lhs, rhs);
 
-	if (node->type == ND_IDENT) {
-		if (dict_lookup(d, node->name) == NULL) {
-			error_printf("uninitialized identifier: %s\n", node->name);
-			exit(1);
-		}
-		vector_push(v, new_ir(IR_LOADADDR, regno++, 0, node->name));
-		vector_push(v, new_ir(IR_LOAD, regno, regno - 1, NULL));
-		vector_push(v, new_ir(IR_KILL, regno - 1, 0, NULL));
-		regno++;
-		return (regno - 1);
-	}
+	case ND_LEFT_OP:
+	case ND_RIGHT_OP:
+		return push_binary(v, (type == ND_LEFT_OP) ? IR_LEFT_OP : IR_RIGHT_OP, lhs, rhs);
 
-	if (node->type == ND_IF) {
-		lhs = gen_ir_sub(v, d, node->condition, scope_level);
-		vector_push(v, new_ir(IR_BEQZ, lhs, label++, NULL));
-		vector_push(v, new_ir(IR_KILL, lhs, 0, NULL));
-
-		gen_ir_sub(v, d, node->consequence, scope_level);    // then
-
-		if (node->alternative != NULL) {
-			int l2 = label++;
-			vector_push(v, new_ir(IR_JUMP, l2, 0, NULL));
-			vector_push(v, new_ir(IR_LABEL, l, 0, NULL));
-			gen_ir_sub(v, d, node->alternative, scope_level);    // else
-			vector_push(v, new_ir(IR_LABEL, l2, 0, NULL));
-		} else {
-			vector_push(v, new_ir(IR_LABEL, l, 0, NULL));
-		}
+	default:
+		/* ND_PLUS, ND_MINUS, ND_MUL, ND_DIV, ND_MOD, ND_OR_OP, ND_AND, ND_OR, ND_XOR */
+		return push_binary(v, CONVERSION_NODE_TO_IR[type], lhs, rhs);
 	}
+}
 
-	if (node->type == ND_PLUS || node->type == ND_MINUS || node->type == ND_MUL || node->type == ND_DIV ||
-	    node->type == ND_MOD || node->type == ND_OR_OP || node->type == ND_AND || node->type == ND_OR ||
-	    node->type == ND_XOR) {
-
-		if (node->lhs != NULL) {
-			lhs = gen_ir_sub(v, d, node->lhs, scope_level);
-		} else {
-			if (node->type == ND_PLUS || node->type == ND_MINUS) {
-				lhs = regno;
-				vector_push(v, new_ir(IR_IMM, regno++, 0, NULL));
-			} else {
-				error_printf("unexpected error\n");
-				exit(1);
-			}
-		}
-		rhs = gen_ir_sub(v, d, node->rhs, scope_level);
+/**
+ * @brief IR生成のフレーム
+ *
+ * 再帰で書いた場合のgen_ir_sub()の1回の呼び出しに当たり, 子の結果を待つ間の状態を持つ.
+ */
+struct gen_frame_t {
+	node_id_t id;		 /**< ノード */
+	int scope_level;	 /**< スコープレベル */
+	int state;		 /**< 次に再開する位置 (0: 最初から) */
+	int l;			 /**< 入った時点のlabel */
+	int l2;			 /**< elseの後のラベル */
+	struct ir_operand_t lhs; /**< 左辺の結果 */
+	size_t j;		 /**< 次に処理する子リストの要素 */
+};
 
-		vector_push(v, new_ir(CONVERSION_NODE_TO_IR[node->type], lhs, rhs, NULL));
-		vector_push(v, new_ir(IR_KILL, rhs, 0, NULL));
-		return lhs;
-	}
+/**
+ * @brief IR生成のスタック
+ */
+static struct {
+	struct gen_frame_t *frames; /**< フレームの配列 */
+	size_t len;		    /**< 積んでいるフレームの数 */
+	size_t capacity;	    /**< framesの容量 */
+} gen_stack;
 
-	if (node->type == ND_AND_OP) {
-		/* a && b = ~(~a || ~b) */
-		lhs = gen_ir_sub(v, d, node->lhs, scope_level);
-		rhs = gen_ir_sub(v, d, node->rhs, scope_level);
-
-		vector_push(v, new_ir(IR_NOT, lhs, 0, NULL));
-		vector_push(v, new_ir(IR_NOT, rhs, 0, NULL));
-		vector_push(v, new_ir(IR_OR, lhs, rhs, NULL));
-		vector_push(v, new_ir(IR_KILL, rhs, 0, NULL));
-		vector_push(v, new_ir(IR_NOT, lhs, 0, NULL));
-		return lhs;
-	}
+/**
+ * @brief IR生成のスタックにフレームを積む
+ * @param[in] id           ノード
+ * @param[in] scope_level  スコープレベル
+ * @param[in] label        現在のlabel
+ */
+static void push_gen_frame(node_id_t id, int scope_level, int label)
+{
+	struct gen_frame_t *f;
 
-	if (node->type == ND_EQ_OP || node->type == ND_NE_OP) {
-		lhs = gen_ir_sub(v, d, node->lhs, scope_level);
-		rhs = gen_ir_sub(v, d, node->rhs, scope_level);
+	if (gen_stack.len >= gen_stack.capacity)
+		grow_array(&gen_stack.frames, &gen_stack.capacity, sizeof(struct gen_frame_t), gen_stack.len + 1);
 
-		vector_push(v, new_ir(IR_MINUS, lhs, rhs, NULL));
+	f = &gen_stack.frames[gen_stack.len++];
+	f->id = id;
+	f->scope_level = scope_level;
+	f->state = 0;
+	f->l = label;
+	f->j = 0;
+}
 
-		if (node->type == ND_EQ_OP) {
-			vector_push(v, new_ir(IR_NOT, lhs, 0, NULL));
+/**
+ * @brief IR生成 サブ関数
+ * @param[in] v            IRの列
+ * @param[in] root         パースしたノード
+ * @param[in] scope_level  スコープレベル
+ * @return 式の結果 (レジスタか即値). 値を持たなければIR_OPERAND_NONE.
+ *
+ * 子の結果を待つ位置をフレームとしてgen_stackに積んで, ノードを後順に辿る.
+ * 式や "else if" が長く続いてもCのスタックは使わない.
+ * 子を処理するときはフレームのstateを進めて子のフレームを積み, 子が終わるとretに結果が入る.
+ */
+static struct ir_operand_t gen_ir_sub(struct ir_list_t *v, node_id_t root, int scope_level)
+{
+	static int label = 0;
+	size_t base = gen_stack.len;
+	struct gen_frame_t *f;
+	const struct node_t *node, *n, *decl;
+	struct ir_operand_t ret = NO_OPERAND; /* 最後に終わった子の結果 */
+	struct ir_operand_t name;
+	int i;
+	size_t j;
+
+	push_gen_frame(root, scope_level, label);
+
+	while (gen_stack.len > base) {
+		/* フレームを積むとfは無効になるので, 積んだらすぐにbreakする */
+		f = &gen_stack.frames[gen_stack.len - 1];
+
+		if (f->id == NODE_NULL) {
+			ret = NO_OPERAND;
+			gen_stack.len--;
+			continue;
 		}
 
-		vector_push(v, new_ir(IR_KILL, rhs, 0, NULL));
-		return lhs;
-	}
+		/* IR生成中はノードを作らないので, ポインタは無効にならない */
+		node = get_node(f->id);
 
-	if (node->type == ND_LESS_OP || node->type == ND_GREATER_OP || node->type == ND_LE_OP ||
-	    node->type == ND_GE_OP) {
-		lhs = gen_ir_sub(v, d, node->lhs, scope_level);
-		rhs = gen_ir_sub(v, d, node->rhs, scope_level);
+		switch (node->type) {
+		case ND_PROGRAM:
+		case ND_COMPOUND_STATEMENTS:
+			if (f->j < list_length(node->list)) {
+				j = f->j++;
+				push_gen_frame(list_at(node->list, j), f->scope_level + 1, label);
+				break;
+			}
 
-		if (node->type == ND_GREATER_OP || node->type == ND_LE_OP) {
-			int tmp;
-			tmp = lhs;
-			lhs = rhs;
-			rhs = tmp; /* swap */
-		}
+			ret = NO_OPERAND;
+			gen_stack.len--;
+			break;
 
-		if (node->type == ND_LESS_OP || node->type == ND_GREATER_OP)
-			vector_push(v, new_ir(IR_SLT, lhs, rhs, NULL));
-		else
-			vector_push(v, new_ir(IR_SLET, lhs, rhs, NULL));
+		/* 静的変数の宣言はresolve_names()で辞書に登録済み */
+		case ND_VAR_DEC_STATIC:
+			ret = NO_OPERAND;
+			gen_stack.len--;
+			break;
 
-		vector_push(v, new_ir(IR_KILL, rhs, 0, NULL));
+		/* ローカル変数の宣言 */
+		case ND_VAR_DEC:
+			error_printf("local variable is not supported yet... %s\n", node_name(f->id));
+			exit(1);
+			/* NOTREACHED */
+			break;
+
+		case ND_RETURN:
+			if (f->state == 0) {
+				f->state = 1;
+				push_gen_frame(node->expression, f->scope_level, label);
+				break;
+			}
 
-		return lhs;
-	}
+			/* "return;" 以外で値がなければIR生成の誤り */
+			if (node->expression != NODE_NULL && ret.kind == IR_OPERAND_NONE) {
+				error_printf("internal error: return value has no operand\n");
+				exit(1);
+			}
 
-	if (node->type == ND_LEFT_OP || node->type == ND_RIGHT_OP) {
-		lhs = gen_ir_sub(v, d, node->lhs, scope_level);
-		rhs = gen_ir_sub(v, d, node->rhs, scope_level);
+			push_ir(v, IR_RETURN, -1, ret, NO_OPERAND);
+			ret = NO_OPERAND;
+			gen_stack.len--;
+			break;
+
+		case ND_CONST:
+			/* 定数はIRにせず, 使う所で即値のオペランドにする */
+			ret = operand(IR_OPERAND_IMM, node->value);
+			gen_stack.len--;
+			break;
+
+		case ND_ASSIGN:
+			/* 左辺は名前だけを使うので, IRは生成しない */
+			if (f->state == 0) {
+				f->state = 1;
+				push_gen_frame(node->rhs, f->scope_level, label);
+				break;
+			}
 
-		vector_push(v, new_ir((node->type == ND_LEFT_OP) ? IR_LEFT_OP : IR_RIGHT_OP, lhs, rhs, NULL));
-		vector_push(v, new_ir(IR_KILL, rhs, 0, NULL));
+			if (get_node(node->lhs)->type != ND_IDENT) {
+				error_printf("lvalue required as left operand of assignment\n");
+				exit(1);
+			}
 
-		return lhs;
-	}
+			/* 代入式の値は格納した値 */
+			name = operand(IR_OPERAND_SYM, variable_label(node->lhs));
+			ret = to_reg(v, ret);
+			push_ir(v, IR_STORE, -1, name, ret);
+			gen_stack.len--;
+			break;
+
+		case ND_IDENT:
+			ret = push_value(v, IR_LOAD, operand(IR_OPERAND_SYM, variable_label(f->id)), NO_OPERAND);
+			gen_stack.len--;
+			break;
+
+		case ND_IF:
+			if (f->state == 0) {
+				f->state = 1;
+				push_gen_frame(node->condition, f->scope_level, label);
+				break;
+			}
 
-	if (node->type == ND_EXPRESSION) {
-		return gen_ir_sub(v, d, node->expression, scope_level);
-	}
+			if (f->state == 1) {
+				push_ir(v, IR_BEQZ, -1, ret, operand(IR_OPERAND_LABEL, label++));
 
-	if (node->type == ND_FUNC_DEF) {
-		vector_push(v, new_ir(IR_FUNC_DEF, -1, -1, node->lhs->lhs->name));
-
-		/* for parameters */
-		if (node->lhs->lhs->parameter_list != NULL) {
-			for (j = 0; j < node->lhs->lhs->parameter_list->len; j++) {
-				n = node->lhs->lhs->parameter_list->data[j];
-				dict_append(d, n->rhs->name, new_variable(n->rhs, scope_level));
-				vector_push(v, new_ir(IR_LOADADDR, regno++, -1, n->rhs->name));
-				vector_push(v, new_ir(IR_FUNC_PARAM, regno - 1, i, n->rhs->name));
-				regno++; /* arg reg用の番号を確保……  */
-				vector_push(v, new_ir(IR_KILL, regno - 2, -1, NULL));
-				vector_push(v, new_ir(IR_KILL_ARG, i, -1, NULL));
-				i++;
+				f->state = 2;
+				push_gen_frame(node->consequence, f->scope_level, label); // then
+				break;
 			}
-		}
 
-		vector_push(v, new_ir(IR_FUNC_END, gen_ir_sub(v, d, node->rhs, scope_level), -1, node->lhs->lhs->name));
+			if (f->state == 2 && node->alternative != NODE_NULL) {
+				f->l2 = label++;
+				push_ir(v, IR_JUMP, -1, operand(IR_OPERAND_LABEL, f->l2), NO_OPERAND);
+				push_ir(v, IR_LABEL, -1, operand(IR_OPERAND_LABEL, f->l), NO_OPERAND);
 
-		return -1;
-	}
+				f->state = 3;
+				push_gen_frame(node->alternative, f->scope_level, label); // else
+				break;
+			}
 
-	if (node->type == ND_FUNC_CALL) {
-		if (node->list != NULL) {
-			for (j = 0; j < node->list->len; j++) {
-				n = node->list->data[j];
+			push_ir(v, IR_LABEL, -1, operand(IR_OPERAND_LABEL, (f->state == 3) ? f->l2 : f->l), NO_OPERAND);
+			ret = NO_OPERAND;
+			gen_stack.len--;
+			break;
+
+		case ND_PLUS:
+		case ND_MINUS:
+		case ND_MUL:
+		case ND_DIV:
+		case ND_MOD:
+		case ND_OR_OP:
+		case ND_AND:
+		case ND_OR:
+		case ND_XOR:
+		case ND_AND_OP:
+		case ND_EQ_OP:
+		case ND_NE_OP:
+		case ND_LESS_OP:
+		case ND_GREATER_OP:
+		case ND_LE_OP:
+		case ND_GE_OP:
+		case ND_LEFT_OP:
+		case ND_RIGHT_OP:
+			if (f->state == 0) {
+				if (node->lhs != NODE_NULL) {
+					f->state = 1;
+					push_gen_frame(node->lhs, f->scope_level, label);
+					break;
+				}
 
-				if (n->type == ND_FUNC_ARG) {
-					rhs = gen_ir_sub(v, d, n->lhs, scope_level);
-					vector_push(v, new_ir(IR_FUNC_ARG, n->value, rhs, NULL));
-					vector_push(v, new_ir(IR_KILL, rhs, 0, NULL));
-					vector_push(v, new_ir(IR_KILL_ARG, n->value, 0, NULL));
+				/* 単項の '+' '-' は 0 との演算にする */
+				if (node->type == ND_PLUS || node->type == ND_MINUS) {
+					f->lhs = operand(IR_OPERAND_IMM, 0);
 				} else {
-					error_printf("unexpected node\n");
+					error_printf("unexpected error\n");
+					exit(1);
 				}
+
+				f->state = 2;
+				push_gen_frame(node->rhs, f->scope_level, label);
+				break;
 			}
+
+			if (f->state == 1) {
+				f->lhs = ret;
+				f->state = 2;
+				push_gen_frame(node->rhs, f->scope_level, label);
+				break;
+			}
+
+			ret = gen_binary_operator(v, node->type, f->lhs, ret);
+			gen_stack.len--;
+			break;
+
+		case ND_EXPRESSION:
+			/* 子の結果をそのまま返すので, このフレームを子のフレームに置き換える */
+			f->id = node->expression;
+			f->state = 0;
+			f->l = label;
+			f->j = 0;
+			break;
+
+		case ND_FUNC_DEF:
+			/* node->lhs: 型 (lhsに宣言子), node->rhs: 本体 */
+			decl = get_node(get_node(node->lhs)->lhs);
+			name = operand(IR_OPERAND_SYM, decl->name);
+
+			if (f->state == 0) {
+				push_ir(v, IR_FUNC_DEF, -1, name, NO_OPERAND);
+
+				/* for parameters */
+				for (i = 0; (size_t)i < list_length(decl->parameter_list); i++) {
+					n = get_node(list_at(decl->parameter_list, i));
+					push_ir(v, IR_FUNC_PARAM, -1, operand(IR_OPERAND_IMM, i),
+						operand(IR_OPERAND_SYM, variable_label(n->rhs)));
+				}
+
+				f->state = 1;
+				push_gen_frame(node->rhs, f->scope_level, label);
+				break;
+			}
+
+			push_ir(v, IR_FUNC_END, -1, name, NO_OPERAND);
+			ret = NO_OPERAND;
+			gen_stack.len--;
+			break;
+
+		case ND_FUNC_CALL:
+			/* 引数の式が終わった */
+			if (f->state == 1) {
+				n = get_node(list_at(node->list, f->j));
+				push_ir(v, IR_FUNC_ARG, -1, operand(IR_OPERAND_IMM, n->value), ret);
+				f->j++;
+				f->state = 0;
+			}
+
+			while (f->j < list_length(node->list) && get_node(list_at(node->list, f->j))->type != ND_FUNC_ARG) {
+				error_printf("unexpected node\n");
+				f->j++;
+			}
+
+			if (f->j < list_length(node->list)) {
+				f->state = 1;
+				push_gen_frame(get_node(list_at(node->list, f->j))->lhs, f->scope_level, label);
+				break;
+			}
+
+			/* 使用中レジスタの記録はallocate_regs()がsrc2に入れる */
+			name = operand(IR_OPERAND_SYM, get_node(node->lhs)->name);
+			ret = push_value(v, IR_FUNC_CALL, name, operand(IR_OPERAND_NONE, -1));
+			gen_stack.len--;
+			break;
+
+		default:
+			ret = NO_OPERAND;
+			gen_stack.len--;
+			break;
 		}
-		vector_push(v, new_ir(IR_FUNC_CALL, regno++, -1, node->name));
-		return r;
 	}
 
-	return r;
+	return ret;
 }
 
 /**
  * @brief 中間表現(IR)を生成する
  */
-struct vector_t *gen_ir(struct node_t *node, struct dict_t *d)
+struct ir_list_t *gen_ir(node_id_t node, struct arena_t *arena)
 {
-	struct vector_t *v = NULL;
+	struct ir_list_t *v = ARENA_NEW(arena, struct ir_list_t);
+
+	v->data = NULL;
+	v->len = 0;
+	v->capacity = 0;
+	v->arena = arena;
 
-	v = new_vector();
-	gen_ir_sub(v, d, node, 0);
+	/* ラベルはファイル全体で, レジスタはIRの列ごとに振る */
+	regno = 0;
+
+	gen_ir_sub(v, node, 0);
+
+	v->regs = regno;
 
 	return v;
 }
+
+/**
+ * @brief IRの名前を取得する
+ */
+const char *ir_name(const struct ir_t *ir)
+{
+	int k;
+
+	for (k = 0; k < 2; k++) {
+		if (ir->kind[k] == IR_OPERAND_SYM)
+			return intern_name(ir->src[k]);
+	}
+
+	return NULL;
+}
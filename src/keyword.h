@@ -0,0 +1,24 @@
+/**
+ * @brief 予約語の完全ハッシュ表
+ * @note tools/gen_keyword.py が生成したファイルです. 直接編集しないでください.
+ */
+#if !defined(KEYWORD_H_INCLUDED)
+#define KEYWORD_H_INCLUDED
+
+#define KEYWORD_TABLE_SIZE	16
+#define KEYWORD_HASH_LEN	1
+#define KEYWORD_HASH_FIRST	1
+#define KEYWORD_MAX_LEN		6
+
+static const struct keyword_t {
+	const char *word;	/**< 予約語 */
+	size_t len;		/**< 予約語の長さ (0: 空き) */
+	token_type_t tkval;	/**< トークンタイプ */
+} KEYWORD_TABLE[KEYWORD_TABLE_SIZE] = {
+	[0] = {"int", 3, TK_INT},
+	[1] = {"if", 2, TK_IF},
+	[6] = {"return", 6, TK_RETURN},
+	[10] = {"goto", 4, TK_GOTO},
+	[14] = {"else", 4, TK_ELSE},
+};
+#endif
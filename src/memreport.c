@@ -0,0 +1,65 @@
+/**
+ * @brief メモリ使用量の報告 (-fmem-report)
+ *
+ * 各部分はmem_statsのカウンタを足すだけにして, 常に数えておく. 数えるのは割り当てや
+ * 拡大のように回数の少ない所と, 辞書の探索だけである.
+ */
+#include <sys/resource.h>
+
+#include "rw2rvc2.h"
+
+/**
+ * @brief メモリ使用量のカウンタ
+ */
+struct mem_stats_t mem_stats;
+
+/**
+ * @brief 割合を求める
+ */
+static double ratio(size_t a, size_t b)
+{
+	return (b == 0) ? 0.0 : (double)a / b;
+}
+
+/**
+ * @brief メモリ使用量を表示する
+ */
+void print_mem_report(void)
+{
+	struct rusage ru;
+	FILE *fp = stderr;
+
+	fprintf(fp, "=====[mem-report]=====\n");
+
+	/*
+	 * 関数ごとのアリーナは巻き戻して使い回すので, 割り当てた合計は確保した量を超えることがある.
+	 * 大きさを変えるブロック (IRの列, 辞書) も広げた分を両方に含める.
+	 */
+	fprintf(fp, "arenas: %zu chunks, %zu bytes reserved in total, %zu bytes allocated in total, %zu allocations\n",
+		mem_stats.arena_chunks, mem_stats.arena_reserved, mem_stats.arena_used, mem_stats.arena_allocs);
+	fprintf(fp, "  ir:       %zu objects, %zu bytes\n", mem_stats.irs, mem_stats.irs * sizeof(struct ir_t));
+	fprintf(fp, "  variable: %zu objects, %zu bytes\n", mem_stats.variables,
+		mem_stats.variables * sizeof(struct variable_t));
+	fprintf(fp, "  dict:     %zu objects, %zu bytes\n", mem_stats.dicts, mem_stats.dicts * sizeof(struct dict_t));
+	fprintf(fp, "  blocks:   %zu resizes, %zu live blocks (%zu bytes), %zu bytes at peak\n", mem_stats.arena_resizes,
+		mem_stats.arena_blocks, mem_stats.arena_block_bytes, mem_stats.arena_block_peak);
+
+	fprintf(fp, "node arena: %zu/%zu nodes (%zu bytes reserved), %zu/%zu list slots (%zu bytes reserved)\n",
+		node_arena.len, node_arena.capacity, node_arena.capacity * sizeof(struct node_t), node_arena.lists_len,
+		node_arena.lists_capacity, node_arena.lists_capacity * sizeof(node_id_t));
+
+	fprintf(fp, "token buffer: %zu resizes, %zu tokens at most\n", mem_stats.token_resizes,
+		mem_stats.token_capacity);
+
+	fprintf(fp, "intern pool: %zu bytes reserved, %zu bytes used (%.1f%%)\n", mem_stats.intern_reserved,
+		mem_stats.intern_used, ratio(mem_stats.intern_used, mem_stats.intern_reserved) * 100);
+
+	fprintf(fp, "dict: %zu lookups, %zu probes (%.2f per lookup)\n", mem_stats.dict_lookups,
+		mem_stats.dict_probes, ratio(mem_stats.dict_probes, mem_stats.dict_lookups));
+
+	fprintf(fp, "regalloc: %zu snapshots, %zu bytes reserved\n", mem_stats.reg_snapshots,
+		mem_stats.reg_snapshots_reserved);
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		fprintf(fp, "peak RSS: %ld KB\n", ru.ru_maxrss);
+}
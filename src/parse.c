@@ -1,33 +1,45 @@
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "rw2rvc2.h"
 
 /* static関数のプロトタイプ宣言. (循環コールのため) */
-static struct node_t *expression(struct vector_t *tokens);
-static struct node_t *statement(struct vector_t *tokens);
-static struct vector_t *statement_list(struct vector_t *tokens);
-static struct node_t *declarator(struct vector_t *tokens);
-static struct node_t *declaration_specifiers(struct vector_t *tokens);
-static struct node_t *assignment_expression(struct vector_t *tokens);
-static struct node_t *unary_expression(struct vector_t *tokens);
+static node_id_t expression(struct token_stream_t *tokens);
+static node_id_t statement(struct token_stream_t *tokens);
+static void statement_list(struct token_stream_t *tokens);
+static node_id_t declarator(struct token_stream_t *tokens);
+static node_id_t declaration_specifiers(struct token_stream_t *tokens);
+static node_id_t assignment_expression(struct token_stream_t *tokens);
 
-static int g_position = 0;
+/**
+ * @brief 構文エラーからの復帰先
+ */
+jmp_buf *syntax_error_jmp = NULL;
 
 /**
  * @brief 期待値(トークン)
  * @param[in] tokens  パースするトークンへのポインタ
  * @param[in] type    期待値
  */
-static void expect_token(struct vector_t *tokens, token_type_t type)
+static void expect_token(struct token_stream_t *tokens, token_type_t type)
 {
-	struct token_t *t = tokens->data[g_position];
+	token_type_t t = peek_token(tokens);
+	const char *path;
+	int line, column;
 
-	if (t->type == type) {
-		g_position++; /* 期待値通りならインデックスを進めて戻る. */
+	if (t == type) {
+		advance_token(tokens); /* 期待値通りならインデックスを進めて戻る. */
 	} else {
+		if (syntax_error_jmp != NULL)
+			longjmp(*syntax_error_jmp, 1);
+
 		/* 期待値と異なった場合, 止まる. */
-		error_printf("unexpect token: %s at line %d position %d\n", t->input, t->line, t->position);
+		token_location(tokens, &line, &column);
+		if ((path = token_path(tokens)) != NULL)
+			error_printf("%s: ", path);
+		error_printf("unexpect token: %s at line %d position %d\n", token_input(tokens), line, column);
 		error_printf("expect token: %s (%d)\n", get_token_str(type), type);
 		exit(1);
 	}
@@ -38,720 +50,502 @@ static void expect_token(struct vector_t *tokens, token_type_t type)
  * @param[in] tokens  パースするトークンへのポインタ
  * @param[in] type    期待値
  */
-static void consume_token(struct vector_t *tokens, token_type_t type)
+static void consume_token(struct token_stream_t *tokens, token_type_t type)
 {
-	struct token_t *t = tokens->data[g_position];
+	token_type_t t = peek_token(tokens);
 
-	if (t->type == type)
-		g_position++; /* 期待値通りならインデックスを進めて戻る. */
+	if (t == type)
+		advance_token(tokens); /* 期待値通りならインデックスを進めて戻る. */
 }
 
 /**
  * @brief パースエラー
+ * @param[in] tokens  パースするトークンへのポインタ
  */
-static void parse_error(void)
+static void parse_error(struct token_stream_t *tokens)
 {
-	error_printf("parse error at index %d\n", g_position);
+	if (syntax_error_jmp != NULL)
+		longjmp(*syntax_error_jmp, 1);
+
+	error_printf("parse error at index %zu\n", tokens->pos);
 	exit(1);
 }
 
-/**
- * @brief 新規ノードにメモリを割り当てる
- * @return 割り当てたメモリへのポインタ
- */
-static struct node_t *allocate_node(void)
+static node_id_t identifier(struct token_stream_t *tokens)
 {
-	const size_t ALLOCATE_SIZE = 256;
-	static struct node_t *node_array = NULL;
-	static size_t index = 0;
-	static size_t size = ALLOCATE_SIZE;
-
-	/* 新規のメモリプールを作成 */
-	if (node_array == NULL || index >= ALLOCATE_SIZE) {
-		if ((node_array = (struct node_t *)malloc(sizeof(struct node_t) * size)) == NULL) {
-			color_printf(stderr, COL_RED, "memory allocation failed\n");
-			exit(1);
-		}
-		index = 0;
+	node_id_t n = NODE_NULL;
+	token_type_t t = peek_token(tokens);
+
+	if (t == TK_IDENT) {
+		n = new_node(ND_IDENT, NODE_NULL, NODE_NULL);
+		get_node(n)->name = token_value(tokens);
+		advance_token(tokens);
+		return n;
 	}
 
-	return &node_array[index++];
+	return NODE_NULL;
 }
 
 /**
- * @brief 新規ノードをつくる
- * @param[in] op      ノードの種類
- * @param[in] lhs     左辺
- * @param[in] rhs     右辺
- * @param[in] list    リスト
+ * @brief 結合性
  */
-static struct node_t *new_node(node_type_t op, struct node_t *lhs, struct node_t *rhs)
-{
-	node_t *node = allocate_node();
-
-	node->type = op;
-	node->lhs = lhs;
-	node->rhs = rhs;
-
-	node->list = NULL;
-	node->name = NULL;
-	node->value = -1;
-	node->condition = NULL;
-	node->consequence = NULL;
-	node->alternative = NULL;
-	node->parameter_list = NULL;
-
-	return node;
-}
+typedef enum {
+	ASSOC_LEFT,  /**< 左結合 */
+	ASSOC_RIGHT, /**< 右結合 */
+} assoc_t;
 
 /**
- * @brief 演算子のトークンタイプからノードタイプに変換できるものを変換する.
- * @param[in] tt  トークンタイプ
- * @return 変換できればそのノードタイプを, 失敗したらND_ILLEGALを返す.
+ * @brief 二項演算子の優先順位表
+ *
+ * トークンタイプで引く. precは大きいほど強く結合し, 0は二項演算子でないことを表す.
  */
-static node_type_t convert_token_to_node(token_type_t tt)
-{
-	switch (tt) {
-	case TK_PLUS:
-		return ND_PLUS;
-	case TK_MINUS:
-		return ND_MINUS;
-	case TK_MUL:
-		return ND_MUL;
-	case TK_DIV:
-		return ND_DIV;
-	case TK_MOD:
-		return ND_MOD;
-	case TK_NUM:
-		return ND_CONST;
-	case TK_RETURN:
-		return ND_RETURN;
-	default:
-		return ND_ILLEGAL;
-	}
-}
+static const struct {
+	unsigned char prec; /**< 優先順位 */
+	assoc_t assoc;      /**< 結合性 */
+	node_type_t node;   /**< 生成するノードのタイプ */
+} BINARY_OPERATORS[TK_INVALID + 1] = {
+	[TK_OR_OP] = {1, ASSOC_LEFT, ND_OR_OP},
+	[TK_AND_OP] = {2, ASSOC_LEFT, ND_AND_OP},
+	[TK_OR] = {3, ASSOC_LEFT, ND_OR},
+	[TK_XOR] = {4, ASSOC_LEFT, ND_XOR},
+	[TK_AND] = {5, ASSOC_LEFT, ND_AND},
+	[TK_EQ_OP] = {6, ASSOC_LEFT, ND_EQ_OP},
+	[TK_NE_OP] = {6, ASSOC_LEFT, ND_NE_OP},
+	[TK_LESS_OP] = {7, ASSOC_LEFT, ND_LESS_OP},
+	[TK_GREATER_OP] = {7, ASSOC_LEFT, ND_GREATER_OP},
+	[TK_LE_OP] = {7, ASSOC_LEFT, ND_LE_OP},
+	[TK_GE_OP] = {7, ASSOC_LEFT, ND_GE_OP},
+	[TK_LEFT_OP] = {8, ASSOC_LEFT, ND_LEFT_OP},
+	[TK_RIGHT_OP] = {8, ASSOC_LEFT, ND_RIGHT_OP},
+	[TK_PLUS] = {9, ASSOC_LEFT, ND_PLUS},
+	[TK_MINUS] = {9, ASSOC_LEFT, ND_MINUS},
+	[TK_MUL] = {10, ASSOC_LEFT, ND_MUL},
+	[TK_DIV] = {10, ASSOC_LEFT, ND_DIV},
+	[TK_MOD] = {10, ASSOC_LEFT, ND_MOD},
+};
 
 /**
- * @brief primary expressionのパーサ
- *
- * @param tokens  トークンベクタ
- * @return パース結果のノード
- *
- * primary_expression := IDENTIFIER
- *                     | CONSTANT
- *                     | STRING_LITERAL
- *                     | '(' expression ')'
- *                     ;
- *
- * @todo STRING_LITERAL
+ * @brief assignment_operatorかどうか判断する
+ * @param[in]  type  トークンタイプ
+ * @return   true or false
  */
-static struct node_t *primary_expression(struct vector_t *tokens)
+static inline bool is_assignment_operator(token_type_t type)
 {
-	struct token_t *t = tokens->data[g_position];
-	struct node_t *n;
-
-	/* '(' expression ')' */
-	if (t->type == TK_LEFT_PAREN) {
-		g_position++;
-		n = expression(tokens);
-		consume_token(tokens, TK_RIGHT_PAREN);
-		return n;
-	}
-
-	/* CONSTANT */
-	if (t->type == TK_NUM) {
-		g_position++;
-		n = new_node(ND_CONST, NULL, NULL);
-		n->value = t->value;
-		return n;
-	}
-
-	/* IDENTIFIER */
-	if (t->type == TK_IDENT) {
-		g_position++;
-		n = new_node(ND_IDENT, NULL, NULL);
-		n->name = t->name;
-		return n;
-	}
-
-	return NULL;
+	return ((type == TK_EQUAL || type == TK_MUL_ASSIGN || type == TK_DIV_ASSIGN || type == TK_MOD_ASSIGN ||
+		 type == TK_ADD_ASSIGN || type == TK_SUB_ASSIGN || type == TK_LEFT_ASSIGN || type == TK_RIGHT_ASSIGN))
+		       ? true
+		       : false;
 }
 
 /**
- * @brief argument_expression_list
- *
- * @param tokens  トークンベクタ
- * @return パース結果のベクタ
- *
- * argument_expression_list := assignment_expression
- *                           | argument_expression_list ',' assignment_expression
- *                           ;
+ * @brief 二項演算子のノードかどうか判断する
+ * @param[in] n  ノード
+ * @return  true or false
+ * @note 単項の '+' '-' は lhs が NODE_NULL のノードになる
  */
-static struct vector_t *argument_expression_list(struct vector_t *tokens)
+static inline bool is_binary_operator_node(const struct node_t *n)
 {
-	struct vector_t *al;
-	struct node_t *n;
-	struct token_t *t;
-
-	int num = 0;
-
-	if ((n = assignment_expression(tokens)) == NULL)
-		return NULL;
-
-	al = new_vector();
-
-	for (;;) {
-		n = new_node(ND_FUNC_ARG, n, NULL);
-		n->value = num;
-		vector_push(al, n);
-
-		t = tokens->data[g_position];
-		if (t->type != TK_COMMA)
-			break;
-
-		num++;
-		if ((n = assignment_expression(tokens)) == NULL)
-			break;
+	switch (n->type) {
+	case ND_PLUS:
+	case ND_MINUS:
+		return n->lhs != NODE_NULL;
+	case ND_MUL:
+	case ND_DIV:
+	case ND_MOD:
+	case ND_OR:
+	case ND_AND:
+	case ND_XOR:
+	case ND_OR_OP:
+	case ND_AND_OP:
+	case ND_EQ_OP:
+	case ND_NE_OP:
+	case ND_GREATER_OP:
+	case ND_LESS_OP:
+	case ND_GE_OP:
+	case ND_LE_OP:
+	case ND_RIGHT_OP:
+	case ND_LEFT_OP:
+		return true;
+	default:
+		return false;
 	}
-
-	return al;
 }
 
 /**
- * @brief postfix_expressionのパーサ
- *
- * @param tokens  トークンベクタ
- * @return パース結果のノード
- *
- * postfix_expression := primary_expression
- *                     | postfix_expression '[' expression ']'
- *                     | postfix_expression '(' ')'
- *                     | postfix_expression '(' argument_expression_list ')'
- *                     | postfix_expression '.' IDENTIFIER
- *                     | postfix_expression PTR_OP IDENTIFIER
- *                     | postfix_expression INC_OP
- *                     | postfix_expression DEC_OP
- *                     ;
+ * @brief 式のパーサーが積むフレームの種類
  *
- * @todo '[' expression ']', '.' IDENTIFIER, PTR_OP IDENTIFIER, INC_OP, DEC_OP
+ * 各フレームは, 再帰下降のパーサーなら関数の途中で子の結果を待っている位置に当たる.
  */
-static struct node_t *postfix_expression(struct vector_t *tokens)
-{
-	struct node_t *n1, *n2;
-	struct token_t *t;
-
-	n1 = primary_expression(tokens);
-
-	for (;;) {
-		t = tokens->data[g_position];
-
-		/* '(' ')' */
-		/* '(' argument_expression_list ')' */
-		if (t->type == TK_LEFT_PAREN) {
-			consume_token(tokens, TK_LEFT_PAREN);
-
-			if (t->type == TK_RIGHT_PAREN) { /* '(' ')' */
-				expect_token(tokens, TK_RIGHT_PAREN);
-				n2 = new_node(ND_FUNC_CALL, n1, NULL);
-				n2->name = n1->name;
-				n1 = n2;
-			} else { /* '(' argument_expression_list ')' */
-				n2 = new_node(ND_FUNC_CALL, n1, NULL);
-				n2->list = argument_expression_list(tokens);
-				n2->name = n1->name;
-				n1 = n2;
-				expect_token(tokens, TK_RIGHT_PAREN);
-			}
-			continue;
-		}
-
-		break;
-	}
-
-	return n1;
-}
+typedef enum {
+	EXPR_EXPRESSION,	/**< assignment_expressionをND_EXPRESSIONで包む */
+	EXPR_ASSIGNMENT,	/**< 左辺の後に代入演算子が続くか調べる */
+	EXPR_ASSIGNMENT_RHS,	/**< 代入の右辺を受け取る */
+	EXPR_BINARY,		/**< 二項演算子の左辺か右辺を受け取る */
+	EXPR_UNARY,		/**< 単項演算子の被演算子を受け取る */
+	EXPR_POSTFIX,		/**< 関数呼び出しが続くか調べる */
+	EXPR_CALL,		/**< 関数呼び出しの引数を受け取る */
+	EXPR_PAREN,		/**< 括弧の中の式を受け取る */
+} expr_frame_type_t;
 
 /**
- * @brief unary_operatorのパーサ
- *
- * @param tokens  トークンベクタ
- * @return パース結果のノード
- *
- * unary_operator := '&'
- *                 | '*'
- *                 | '+'
- *                 | '-'
- *                 | '~'
- *                 | '!'
- *                 ;
- *
- * @todo: &, *, ~, ! の実装
+ * @brief 式のパーサーのフレーム
  */
-static struct node_t *unary_operator(struct vector_t *tokens)
-{
-	struct token_t *t = tokens->data[g_position];
-
-	if (t->type == TK_MINUS) { /* - */
-		g_position++;
-		return new_node(ND_MINUS, NULL, NULL);
-	}
-
-	if (t->type == TK_PLUS) { /* + */
-		g_position++;
-		return new_node(ND_PLUS, NULL, NULL);
-	}
-
-	return NULL;
-}
+struct expr_frame_t {
+	expr_frame_type_t type; /**< フレームの種類 */
+	token_type_t op;	/**< 読んだ演算子 (EXPR_BINARYで左辺を待っている間はTK_INVALID) */
+	int min_prec;		/**< EXPR_BINARYで読む二項演算子の最低の優先順位 */
+	node_id_t lhs;		/**< 左辺, もしくは呼び出す式 */
+};
 
 /**
- * @brief cast_expressionのパーサ
- *
- * cast_expression := unary_expression
- *                  | '(' type_name ')' cast_expression
- *                  ;
- *
- * @todo type_nameの実装
+ * @brief 式のパーサーのスタック
  */
-static struct node_t *cast_expression(struct vector_t *tokens)
-{
-	return unary_expression(tokens);
-}
+static struct {
+	struct expr_frame_t *frames; /**< フレームの配列 */
+	size_t len;		     /**< 積んでいるフレームの数 */
+	size_t capacity;	     /**< framesの容量 */
+} expr_stack;
 
 /**
- * @brief unary_expression
- *
- * unary_expression := postfix_expression
- *                   | INC_OP unary_expression
- *                   | DEC_OP unary_expression
- *                   | unary_operator cast_expression
- *                   | SIZEOF unary_expression
- *                   | SIZEOF '(' type_name ')'
- *                   ;
+ * @brief 式のパーサーのスタックにフレームを積む
+ * @param[in] type      フレームの種類
+ * @param[in] op        演算子
+ * @param[in] min_prec  二項演算子の最低の優先順位
+ * @param[in] lhs       左辺
  */
-static struct node_t *unary_expression(struct vector_t *tokens)
+static void push_expr_frame(expr_frame_type_t type, token_type_t op, int min_prec, node_id_t lhs)
 {
-	struct node_t *lhs;
+	struct expr_frame_t *f;
 
-	if ((lhs = unary_operator(tokens)) != NULL) {
+	if (expr_stack.len >= expr_stack.capacity)
+		grow_array(&expr_stack.frames, &expr_stack.capacity, sizeof(struct expr_frame_t), expr_stack.len + 1);
 
-		if ((lhs->rhs = cast_expression(tokens)) == NULL)
-			parse_error();
-
-		return lhs;
-	}
-
-	return postfix_expression(tokens);
+	f = &expr_stack.frames[expr_stack.len++];
+	f->type = type;
+	f->op = op;
+	f->min_prec = min_prec;
+	f->lhs = lhs;
 }
 
 /**
- * @brief 乗除算
- * @param[in] tokens
- * @return
- *
- * multiplicative_expression := unary_expression
- *                           | multiplicative_expression '*' unary_expression
- *                           | multiplicative_expression '/' unary_expression
- *                           | multiplicative_expression '%' unary_expression
- *                           ;
+ * @brief assignment_expressionを読み始めるフレームを積む
  */
-static struct node_t *multiplicative_expression(struct vector_t *tokens)
+static void push_assignment_expression(void)
 {
-	struct node_t *lhs;
-
-	if ((lhs = unary_expression(tokens)) == NULL)
-		return NULL;
-
-	for (;;) {
-		struct token_t *t = tokens->data[g_position];
-		token_type_t op = t->type;
-
-		if (op != TK_MUL && op != TK_DIV && op != TK_MOD)
-			break;
-
-		g_position++;
-		lhs = new_node(convert_token_to_node(op), lhs, unary_expression(tokens));
-	}
-
-	return lhs;
+	push_expr_frame(EXPR_ASSIGNMENT, TK_INVALID, 0, NODE_NULL);
+	push_expr_frame(EXPR_BINARY, TK_INVALID, 1, NODE_NULL);
 }
 
 /**
- * @brief additive_expression
+ * @brief cast_expressionを先頭から読み, 最初のprimary_expressionまで進める
+ * @param[in] tokens  トークンストリーム
+ * @return primary_expressionのノード. 該当しなければNODE_NULL.
  *
- * additive_expression := multiplicative_expression
- *                      | additive_expression '+' multiplicative_expression
- *                      | additive_expression '-' multiplicative_expression
- *                      ;
+ * 途中の単項演算子と括弧は, 続きを読むフレームとしてスタックに積む.
  */
-static struct node_t *additive_expression(struct vector_t *tokens)
+static node_id_t begin_cast_expression(struct token_stream_t *tokens)
 {
-	struct node_t *lhs;
-	struct token_t *t;
-
-	if ((lhs = multiplicative_expression(tokens)) == NULL)
-		return NULL;
+	token_type_t t;
+	node_id_t n;
 
 	for (;;) {
-		t = tokens->data[g_position];
-		token_type_t op = t->type;
-
-		if (op != TK_PLUS && op != TK_MINUS)
-			break;
-
-		g_position++;
-		lhs = new_node(convert_token_to_node(op), lhs, multiplicative_expression(tokens));
-	}
-
-	return lhs;
-}
-
-static struct node_t *identifier(struct vector_t *tokens)
-{
-	struct node_t *n = NULL;
-	struct token_t *t = tokens->data[g_position];
-
-	if (t->type == TK_IDENT) {
-		g_position++;
-		n = new_node(ND_IDENT, NULL, NULL);
-		n->name = t->name;
-		return n;
-	}
+		t = peek_token(tokens);
 
-	return NULL;
-}
+		/* unary_operator cast_expression */
+		if (t == TK_MINUS || t == TK_PLUS) {
+			advance_token(tokens);
+			push_expr_frame(EXPR_UNARY, t, 0, NODE_NULL);
+			continue;
+		}
 
-/**
- * @brief shift_expression
- *
- * shift_expression := additive_expression
- *                   | shift_expression LEFT_OP additive_expression
- *                   | shift_expression RIGHT_OP additive_expression
- *                   ;
- */
-static struct node_t *shift_expression(struct vector_t *tokens)
-{
-	struct node_t *lhs;
-	struct token_t *t;
-	int nd_type;
+		push_expr_frame(EXPR_POSTFIX, TK_INVALID, 0, NODE_NULL);
 
-	lhs = additive_expression(tokens);
+		/* '(' expression ')' */
+		if (t == TK_LEFT_PAREN) {
+			advance_token(tokens);
+			push_expr_frame(EXPR_PAREN, TK_INVALID, 0, NODE_NULL);
+			push_expr_frame(EXPR_EXPRESSION, TK_INVALID, 0, NODE_NULL);
+			push_assignment_expression();
+			continue;
+		}
 
-	for (;;) {
-		t = tokens->data[g_position];
+		/* CONSTANT */
+		if (t == TK_NUM) {
+			n = new_node(ND_CONST, NODE_NULL, NODE_NULL);
+			get_node(n)->value = token_value(tokens);
+			advance_token(tokens);
+			return n;
+		}
 
-		if (t->type != TK_RIGHT_OP && t->type != TK_LEFT_OP)
-			break;
+		/* IDENTIFIER */
+		if (t == TK_IDENT) {
+			n = new_node(ND_IDENT, NODE_NULL, NODE_NULL);
+			get_node(n)->name = token_value(tokens);
+			advance_token(tokens);
+			return n;
+		}
 
-		nd_type = (t->type == TK_RIGHT_OP) ? ND_RIGHT_OP : ND_LEFT_OP;
-		consume_token(tokens, t->type);
-		lhs = new_node(nd_type, lhs, additive_expression(tokens));
+		return NODE_NULL;
 	}
-
-	return lhs;
 }
 
 /**
- * @brief relational_expression
+ * @brief 式をパースする
+ * @param[in] tokens  トークンストリーム
+ * @param[in] start   EXPR_EXPRESSION (expression) か EXPR_ASSIGNMENT (assignment_expression)
+ * @return パース結果のノード
  *
+ * 再帰下降の代わりに, 子の結果を待つ位置をフレームとしてexpr_stackに積んで読む.
+ * 括弧や単項演算子の入れ子が深くても, 二項演算子や代入が長く続いてもCのスタックは使わない.
+ * 生成するノードは各規則を再帰下降で読んだ場合と同じ.
+ *
+ * expression := assignment_expression
+ *             | expression ',' assignment_expression
+ *             ;
+ * assignment_expression := conditional_expression
+ *                        | unary_expression assignment_operator assignment_expression
+ *                        ;
+ * conditional_expression := logical_or_expression
+ *                         | logical_or_expression '?' expression ':' conditional_expression
+ *                         ;
+ * logical_or_expression := logical_and_expression
+ *                        | logical_or_expression OR_OP logical_and_expression
+ *                        ;
+ * logical_and_expression := inclusive_or_expression
+ *                         | logical_and_expression AND_OP inclusive_or_expression
+ *                         ;
+ * inclusive_or_expression := exclusive_or_expression
+ *                          | inclusive_or_expression '|' exclusive_or_expression
+ *                          ;
+ * exclusive_or_expression := and_expression
+ *                          | exclusive_or_expression '^' and_expression
+ *                          ;
+ * and_expression := equality_expression
+ *                 | and_expression '&' equality_expression
+ *                 ;
+ * equality_expression := relational_expression
+ *                      | equality_expression EQ_OP relational_expression
+ *                      | equality_expression NE_OP relational_expression
+ *                      ;
  * relational_expression := shift_expression
  *                        | relational_expression '<' shift_expression
  *                        | relational_expression '>' shift_expression
  *                        | relational_expression LE_OP shift_expression
  *                        | relational_expression GE_OP shift_expression
  *                        ;
- */
-static struct node_t *relational_expression(struct vector_t *tokens)
-{
-	struct node_t *lhs;
-	struct token_t *t;
-	int nd_type;
-
-	lhs = shift_expression(tokens);
-
-	for (;;) {
-		t = tokens->data[g_position];
-
-		if (t->type != TK_LESS_OP && t->type != TK_GREATER_OP && t->type != TK_LE_OP && t->type != TK_GE_OP)
-			break;
-
-		if (t->type == TK_LESS_OP)
-			nd_type = ND_LESS_OP;
-		else if (t->type == TK_GREATER_OP)
-			nd_type = ND_GREATER_OP;
-		else if (t->type == TK_LE_OP)
-			nd_type = ND_LE_OP;
-		else
-			nd_type = ND_GE_OP;
-
-		consume_token(tokens, t->type);
-		lhs = new_node(nd_type, lhs, shift_expression(tokens));
-	}
-
-	return lhs;
-}
-
-/**
- * @brief equality_expression
- *
- * equality_expression := relational_expression
- *                      | equality_expression EQ_OP relational_expression
- *                      | equality_expression NE_OP relational_expression
+ * shift_expression := additive_expression
+ *                   | shift_expression LEFT_OP additive_expression
+ *                   | shift_expression RIGHT_OP additive_expression
+ *                   ;
+ * additive_expression := multiplicative_expression
+ *                      | additive_expression '+' multiplicative_expression
+ *                      | additive_expression '-' multiplicative_expression
  *                      ;
- */
-static struct node_t *equality_expression(struct vector_t *tokens)
-{
-	struct node_t *lhs;
-	struct token_t *t;
-	int nd_type;
-
-	lhs = relational_expression(tokens);
-
-	for (;;) {
-		t = tokens->data[g_position];
-
-		if (t->type != TK_EQ_OP && t->type != TK_NE_OP)
-			break;
-
-		consume_token(tokens, t->type);
-
-		nd_type = (t->type == TK_EQ_OP) ? ND_EQ_OP : ND_NE_OP;
-		lhs = new_node(nd_type, lhs, relational_expression(tokens));
-	}
-
-	return lhs;
-}
-
-/**
- * @brief and_expression
- *
- * and_expression := equality_expression
- *                 | and_expression '&' equality_expression
+ * multiplicative_expression := cast_expression
+ *                           | multiplicative_expression '*' cast_expression
+ *                           | multiplicative_expression '/' cast_expression
+ *                           | multiplicative_expression '%' cast_expression
+ *                           ;
+ * cast_expression := unary_expression
+ *                  | '(' type_name ')' cast_expression
+ *                  ;
+ * unary_expression := postfix_expression
+ *                   | INC_OP unary_expression
+ *                   | DEC_OP unary_expression
+ *                   | unary_operator cast_expression
+ *                   | SIZEOF unary_expression
+ *                   | SIZEOF '(' type_name ')'
+ *                   ;
+ * unary_operator := '&' | '*' | '+' | '-' | '~' | '!'
  *                 ;
- */
-static struct node_t *and_expression(struct vector_t *tokens)
-{
-	struct node_t *lhs;
-	struct token_t *t;
-
-	lhs = equality_expression(tokens);
-
-	for (;;) {
-		t = tokens->data[g_position];
-
-		if (t->type != TK_AND)
-			break;
-
-		consume_token(tokens, TK_AND);
-		lhs = new_node(ND_AND, lhs, equality_expression(tokens));
-	}
-
-	return lhs;
-}
-
-/**
- * @brief exclusive_or_expression
+ * postfix_expression := primary_expression
+ *                     | postfix_expression '[' expression ']'
+ *                     | postfix_expression '(' ')'
+ *                     | postfix_expression '(' argument_expression_list ')'
+ *                     | postfix_expression '.' IDENTIFIER
+ *                     | postfix_expression PTR_OP IDENTIFIER
+ *                     | postfix_expression INC_OP
+ *                     | postfix_expression DEC_OP
+ *                     ;
+ * argument_expression_list := assignment_expression
+ *                           | argument_expression_list ',' assignment_expression
+ *                           ;
+ * primary_expression := IDENTIFIER
+ *                     | CONSTANT
+ *                     | STRING_LITERAL
+ *                     | '(' expression ')'
+ *                     ;
  *
- * exclusive_or_expression := and_expression
- *                          | exclusive_or_expression '^' and_expression
- *                          ;
- */
-static struct node_t *exclusive_or_expression(struct vector_t *tokens)
-{
-	struct node_t *lhs;
-	struct token_t *t;
-
-	lhs = and_expression(tokens);
-
-	for (;;) {
-		t = tokens->data[g_position];
-
-		if (t->type != TK_XOR)
-			break;
-
-		consume_token(tokens, TK_XOR);
-		lhs = new_node(ND_XOR, lhs, and_expression(tokens));
-	}
-
-	return lhs;
-}
-
-/**
- * @brief inclusive_or_expression
+ * 二項演算子は BINARY_OPERATORS の優先順位と結合性にしたがって読む (優先順位法).
  *
- * inclusive_or_expression := exclusive_or_expression
- *                          | inclusive_or_expression '|' exclusive_or_expression
- *                          ;
+ * @todo '?' ':', type_name, '&' '*' '~' '!', INC_OP, DEC_OP, SIZEOF, '[' ']', '.', PTR_OP,
+ *       STRING_LITERAL, 2つ目以降の引数
  */
-static struct node_t *inclusive_or_expression(struct vector_t *tokens)
+static node_id_t parse_expression(struct token_stream_t *tokens, expr_frame_type_t start)
 {
-	struct node_t *lhs;
-	struct token_t *t;
+	size_t base = expr_stack.len;
+	struct expr_frame_t f;
+	node_id_t n, arg;
+	size_t al;
+	token_type_t t;
+	int prec;
+
+	if (start == EXPR_EXPRESSION)
+		push_expr_frame(EXPR_EXPRESSION, TK_INVALID, 0, NODE_NULL);
+	push_assignment_expression();
+
+	n = begin_cast_expression(tokens);
+
+	/* nは一番上のフレームが待っている子の結果 */
+	while (expr_stack.len > base) {
+		f = expr_stack.frames[--expr_stack.len];
+
+		switch (f.type) {
+		case EXPR_EXPRESSION:
+			if (n != NODE_NULL) {
+				node_id_t e = new_node(ND_EXPRESSION, NODE_NULL, NODE_NULL);
+				get_node(e)->expression = n;
+				n = e;
+			}
+			break;
 
-	lhs = exclusive_or_expression(tokens);
+		case EXPR_ASSIGNMENT:
+			/* 二項演算子を含まずに代入演算子が続いた場合だけ代入の左辺として扱う */
+			t = peek_token(tokens);
+			if (n == NODE_NULL || !is_assignment_operator(t) || is_binary_operator_node(get_node(n)))
+				break;
+
+			consume_token(tokens, t);
+			push_expr_frame(EXPR_ASSIGNMENT_RHS, t, 0, n);
+			push_expr_frame(EXPR_EXPRESSION, TK_INVALID, 0, NODE_NULL);
+			push_assignment_expression();
+			n = begin_cast_expression(tokens);
+			break;
 
-	for (;;) {
-		t = tokens->data[g_position];
+		case EXPR_ASSIGNMENT_RHS:
+			if (n == NODE_NULL)
+				parse_error(tokens);
+
+			if (f.op == TK_MUL_ASSIGN) {
+				n = new_node(ND_MUL, f.lhs, n);
+			} else if (f.op == TK_DIV_ASSIGN) {
+				n = new_node(ND_DIV, f.lhs, n);
+			} else if (f.op == TK_MOD_ASSIGN) {
+				n = new_node(ND_MOD, f.lhs, n);
+			} else if (f.op == TK_ADD_ASSIGN) {
+				n = new_node(ND_PLUS, f.lhs, n);
+			} else if (f.op == TK_SUB_ASSIGN) {
+				n = new_node(ND_MINUS, f.lhs, n);
+			} else if (f.op == TK_LEFT_ASSIGN) {
+				n = new_node(ND_LEFT_OP, f.lhs, n);
+			} else if (f.op == TK_RIGHT_ASSIGN) {
+				n = new_node(ND_RIGHT_OP, f.lhs, n);
+			}
 
-		if (t->type != TK_OR)
+			n = new_node(ND_ASSIGN, f.lhs, n);
 			break;
 
-		consume_token(tokens, TK_OR);
-		lhs = new_node(ND_OR, lhs, exclusive_or_expression(tokens));
-	}
+		case EXPR_BINARY:
+			if (f.op == TK_INVALID) {
+				/* 左辺 */
+				if (n == NODE_NULL)
+					break;
+				f.lhs = n;
+			} else {
+				/* 右辺. 左結合なので左辺に畳み込んで続きを読む */
+				if (n == NODE_NULL)
+					parse_error(tokens);
+				f.lhs = new_node(BINARY_OPERATORS[f.op].node, f.lhs, n);
+			}
 
-	return lhs;
-}
+			t = peek_token(tokens);
+			prec = BINARY_OPERATORS[t].prec;
 
-/**
- * @brief logical_and_expression
- *
- * logical_and_expression := inclusive_or_expression
- *                         | logical_and_expression AND_OP inclusive_or_expression
- *                         ;
- */
-static struct node_t *logical_and_expression(struct vector_t *tokens)
-{
-	struct node_t *lhs;
-	struct token_t *t;
+			if (prec == 0 || prec < f.min_prec) {
+				n = f.lhs;
+				break;
+			}
 
-	lhs = inclusive_or_expression(tokens);
+			advance_token(tokens);
+			push_expr_frame(EXPR_BINARY, t, f.min_prec, f.lhs);
+			push_expr_frame(EXPR_BINARY, TK_INVALID, (BINARY_OPERATORS[t].assoc == ASSOC_LEFT) ? prec + 1 : prec,
+					NODE_NULL);
+			n = begin_cast_expression(tokens);
+			break;
 
-	for (;;) {
-		t = tokens->data[g_position];
+		case EXPR_UNARY:
+			if (n == NODE_NULL)
+				parse_error(tokens);
 
-		if (t->type != TK_AND_OP)
+			n = new_node((f.op == TK_MINUS) ? ND_MINUS : ND_PLUS, NODE_NULL, n);
 			break;
 
-		consume_token(tokens, TK_AND_OP);
-		lhs = new_node(ND_AND_OP, lhs, inclusive_or_expression(tokens));
-	}
+		case EXPR_POSTFIX:
+			if (peek_token(tokens) != TK_LEFT_PAREN)
+				break;
 
-	return lhs;
-}
+			consume_token(tokens, TK_LEFT_PAREN);
 
-/**
- * @brief logical_or_expression
- *
- * logical_or_expression := logical_and_expression
- *                        | logical_or_expression OR_OP logical_and_expression
- *                        ;
- */
-static struct node_t *logical_or_expression(struct vector_t *tokens)
-{
-	struct node_t *lhs;
-	struct token_t *t;
+			if (peek_token(tokens) == TK_RIGHT_PAREN) { /* '(' ')' */
+				expect_token(tokens, TK_RIGHT_PAREN);
+				n = new_node(ND_FUNC_CALL, n, NODE_NULL);
+				get_node(n)->list = 0;
+				push_expr_frame(EXPR_POSTFIX, TK_INVALID, 0, NODE_NULL);
+				break;
+			}
 
-	lhs = logical_and_expression(tokens);
+			/* '(' argument_expression_list ')' */
+			push_expr_frame(EXPR_POSTFIX, TK_INVALID, 0, NODE_NULL);
+			push_expr_frame(EXPR_CALL, TK_INVALID, 0, n);
+			push_assignment_expression();
+			n = begin_cast_expression(tokens);
+			break;
 
-	for (;;) {
-		t = tokens->data[g_position];
+		case EXPR_CALL:
+			arg = n;
+			n = new_node(ND_FUNC_CALL, f.lhs, NODE_NULL);
+			get_node(n)->list = 0;
+
+			if (arg != NODE_NULL) {
+				al = list_begin();
+				arg = new_node(ND_FUNC_ARG, arg, NODE_NULL);
+				get_node(arg)->value = 0;
+				list_push(arg);
+				get_node(n)->list = list_end(al);
+			}
 
-		if (t->type != TK_OR_OP)
+			expect_token(tokens, TK_RIGHT_PAREN);
 			break;
 
-		consume_token(tokens, TK_OR_OP);
-		lhs = new_node(ND_OR_OP, lhs, logical_and_expression(tokens));
+		case EXPR_PAREN:
+			if (n == NODE_NULL)
+				parse_error(tokens);
+			expect_token(tokens, TK_RIGHT_PAREN);
+			break;
+		}
 	}
 
-	return lhs;
-}
-
-/**
- * @brief conditional_expression
- *
- * conditional_expression := logical_or_expression
- *                         | logical_or_expression '?' expression ':' conditional_expression
- *                         ;
- */
-static struct node_t *conditional_expression(struct vector_t *tokens)
-{
-	return logical_or_expression(tokens);
-}
-
-/**
- * @brief assignment_operatorかどうか判断する
- * @param[in]  type  トークンタイプ
- * @return   true or false
- */
-static inline bool is_assignment_operator(token_type_t type)
-{
-	return ((type == TK_EQUAL || type == TK_MUL_ASSIGN || type == TK_DIV_ASSIGN || type == TK_MOD_ASSIGN ||
-		 type == TK_ADD_ASSIGN || type == TK_SUB_ASSIGN || type == TK_LEFT_ASSIGN || type == TK_RIGHT_ASSIGN))
-		       ? true
-		       : false;
+	return n;
 }
 
 /**
  * @brief assignment expression
- * assignment_expression := conditional_expression
- *                        | unary_expression assignment_operator assignment_expression
- *                        ;
+ * @param[in]  tokens  vector for tokens
+ * @return パース結果のノード
  */
-static struct node_t *assignment_expression(struct vector_t *tokens)
+static node_id_t assignment_expression(struct token_stream_t *tokens)
 {
-	struct node_t *lhs, *rhs;
-	struct token_t *t;
-	int pos = g_position;
-
-	if ((lhs = unary_expression(tokens)) != NULL) {
-
-		t = tokens->data[g_position];
-
-		/* assgienment operator */
-		if (!is_assignment_operator(t->type)) {
-			g_position = pos;
-			lhs = NULL;
-		} else {
-			consume_token(tokens, t->type);
-
-			if (t->type == TK_MUL_ASSIGN) {
-				rhs = new_node(ND_MUL, lhs, expression(tokens));
-			} else if (t->type == TK_DIV_ASSIGN) {
-				rhs = new_node(ND_DIV, lhs, expression(tokens));
-			} else if (t->type == TK_MOD_ASSIGN) {
-				rhs = new_node(ND_MOD, lhs, expression(tokens));
-			} else if (t->type == TK_ADD_ASSIGN) {
-				rhs = new_node(ND_PLUS, lhs, expression(tokens));
-			} else if (t->type == TK_SUB_ASSIGN) {
-				rhs = new_node(ND_MINUS, lhs, expression(tokens));
-			} else if (t->type == TK_LEFT_ASSIGN) {
-				rhs = new_node(ND_LEFT_OP, lhs, expression(tokens));
-			} else if (t->type == TK_RIGHT_ASSIGN) {
-				rhs = new_node(ND_RIGHT_OP, lhs, expression(tokens));
-			} else {
-				rhs = expression(tokens);
-			}
-
-			lhs = new_node(ND_ASSIGN, lhs, rhs);
-		}
-	}
-
-	if (lhs == NULL)
-		lhs = conditional_expression(tokens);
-
-	return lhs;
+	return parse_expression(tokens, EXPR_ASSIGNMENT);
 }
 
 /**
  * @brief expression
  * @param[in]  tokens  vector for tokens
- *
- * expression := assignment_expression
- *             | expression ',' assignment_expression
- *             ;
+ * @return パース結果のノード
  */
-static struct node_t *expression(struct vector_t *tokens)
+static node_id_t expression(struct token_stream_t *tokens)
 {
-	struct node_t *exp, *node;
-
-	if ((exp = assignment_expression(tokens)) == NULL)
-		return NULL;
-
-	node = new_node(ND_EXPRESSION, NULL, NULL);
-	node->expression = exp;
-
-	return node;
+	return parse_expression(tokens, EXPR_EXPRESSION);
 }
 
 /**
@@ -759,17 +553,19 @@ static struct node_t *expression(struct vector_t *tokens)
  * @param[in] tokens  vector for tokens
  * @return
  */
-static struct node_t *keyword_return(struct vector_t *tokens)
+static node_id_t keyword_return(struct token_stream_t *tokens)
 {
-	struct token_t *t = tokens->data[g_position];
-	struct node_t *e = NULL;
-
-	if (t->type == TK_RETURN) {
-		g_position++;
-		e = new_node(ND_RETURN, NULL, NULL);
-		e->expression = expression(tokens);
+	token_type_t t = peek_token(tokens);
+	node_id_t e = NODE_NULL;
+	node_id_t exp;
+
+	if (t == TK_RETURN) {
+		advance_token(tokens);
+		exp = expression(tokens);
+		e = new_node(ND_RETURN, NODE_NULL, NODE_NULL);
+		get_node(e)->expression = exp;
 	} else {
-		return NULL;
+		return NODE_NULL;
 	}
 
 	return e;
@@ -784,11 +580,11 @@ static struct node_t *keyword_return(struct vector_t *tokens)
  *                 | RETURN ';'
  *                 | RETURN expression ';'
  */
-static struct node_t *jump_statement(struct vector_t *tokens)
+static node_id_t jump_statement(struct token_stream_t *tokens)
 {
-	struct node_t *n = NULL;
+	node_id_t n = NODE_NULL;
 
-	if ((n = keyword_return(tokens)) != NULL) {
+	if ((n = keyword_return(tokens)) != NODE_NULL) {
 		expect_token(tokens, TK_SEMICOLON);
 	} else {
 		;
@@ -805,34 +601,50 @@ static struct node_t *jump_statement(struct vector_t *tokens)
  *                      | SWITCH '(' expression ')' statement
  *                      ;
  */
-static struct node_t *selection_statement(struct vector_t *tokens)
+static node_id_t selection_statement(struct token_stream_t *tokens)
 {
-	struct token_t *t = tokens->data[g_position];
-	struct node_t *node = NULL;
+	node_id_t first = NODE_NULL, last = NODE_NULL, node;
+	node_id_t condition, consequence, alternative;
 
-	if (t->type == TK_IF) {
-		g_position++;
+	/* "else if" が続く間は再帰せずに, 前のifのalternativeにつないでいく */
+	while (peek_token(tokens) == TK_IF) {
+		advance_token(tokens);
 		expect_token(tokens, TK_LEFT_PAREN);
-		node = new_node(ND_IF, NULL, NULL);
-		node->condition = expression(tokens);
+		condition = expression(tokens);
 		expect_token(tokens, TK_RIGHT_PAREN);
 
-		if ((node->consequence = statement(tokens)) == NULL) {
-			parse_error();
+		if ((consequence = statement(tokens)) == NODE_NULL) {
+			parse_error(tokens);
 			/* NOTREACHED */
 		}
 
-		t = tokens->data[g_position];
-		if (t->type == TK_ELSE) {
-			g_position++;
-			if ((node->alternative = statement(tokens)) == NULL) {
-				parse_error();
-				/* NOTREACHED */
-			}
+		node = new_node(ND_IF, NODE_NULL, NODE_NULL);
+		get_node(node)->condition = condition;
+		get_node(node)->consequence = consequence;
+		get_node(node)->alternative = NODE_NULL;
+
+		if (last != NODE_NULL)
+			get_node(last)->alternative = node;
+		else
+			first = node;
+		last = node;
+
+		if (peek_token(tokens) != TK_ELSE)
+			break;
+
+		advance_token(tokens);
+		if (peek_token(tokens) == TK_IF)
+			continue;
+
+		if ((alternative = statement(tokens)) == NODE_NULL) {
+			parse_error(tokens);
+			/* NOTREACHED */
 		}
+		get_node(last)->alternative = alternative;
+		break;
 	}
 
-	return node;
+	return first;
 }
 
 /**
@@ -840,16 +652,22 @@ static struct node_t *selection_statement(struct vector_t *tokens)
  * expression_statement := ';'
  *                       | expression ';'
  *                       ;
+ *
+ * 空の文は, 空の複合文として扱う.
  */
-static struct node_t *expression_statement(struct vector_t *tokens)
+static node_id_t expression_statement(struct token_stream_t *tokens)
 {
-	struct node_t *node = NULL;
-	struct token_t *t = tokens->data[g_position];
+	node_id_t node = NODE_NULL;
 
-	if ((node = expression(tokens)) != NULL)
+	if (peek_token(tokens) == TK_SEMICOLON) {
+		advance_token(tokens);
+		node = new_node(ND_COMPOUND_STATEMENTS, NODE_NULL, NODE_NULL);
+		get_node(node)->list = 0;
+		return node;
+	}
+
+	if ((node = expression(tokens)) != NODE_NULL)
 		expect_token(tokens, TK_SEMICOLON);
-	else if (t->type == TK_SEMICOLON)
-		consume_token(tokens, TK_SEMICOLON);
 
 	return node;
 }
@@ -867,71 +685,88 @@ static struct node_t *expression_statement(struct vector_t *tokens)
  *
  * @todo assignment_expression以外の実装
  */
-static struct node_t *initializer(struct vector_t *tokens)
+static node_id_t initializer(struct token_stream_t *tokens)
 {
 	return assignment_expression(tokens);
 }
 
 /**
- * @brief init_declaratorをパースする
+ * @brief init_declaratorのdeclaratorより後をパースする
  *
  * @param tokens  トークンベクタ
+ * @param n       パース済みのdeclarator
  * @return パース結果のノード
  *
  * init_declarator := declarator
  *                  | declarator '=' initializer
  *                  ;
  */
-static struct node_t *init_declarator(struct vector_t *tokens)
+static node_id_t init_declarator_rest(struct token_stream_t *tokens, node_id_t n)
 {
-	struct node_t *n;
-	struct token_t *t;
-
-	n = declarator(tokens);
-	t = tokens->data[g_position];
+	token_type_t t = peek_token(tokens);
+	node_id_t rhs;
 
-	if (t->type == TK_EQUAL) {
+	if (t == TK_EQUAL) {
 		consume_token(tokens, TK_EQUAL);
-		n->rhs = initializer(tokens);
+		rhs = initializer(tokens);
+		get_node(n)->rhs = rhs;
 	}
 
 	return n;
 }
 
+/**
+ * @brief init_declaratorをパースする
+ *
+ * @param tokens  トークンベクタ
+ * @return パース結果のノード
+ */
+static node_id_t init_declarator(struct token_stream_t *tokens)
+{
+	node_id_t n = declarator(tokens);
+
+	if (n == NODE_NULL)
+		return NODE_NULL;
+
+	return init_declarator_rest(tokens, n);
+}
+
 /**
  * @brief init_declarator_listをパースする
  *
  * @param tokens  トークンベクタ
+ * @param id      パース済みの最初のinit_declarator
  * @return パース結果のノード
  *
  * init_declarator_list := init_declarator
  *                       | init_declarator_list ',' init_declarator
  *                       ;
  */
-static struct node_t *init_declarator_list(struct vector_t *tokens)
+static node_id_t init_declarator_list(struct token_stream_t *tokens, node_id_t id)
 {
-	struct node_t *idl = NULL, *id;
-	struct token_t *t;
-	int num = 0;
-
-	if ((id = init_declarator(tokens)) == NULL)
-		return NULL;
+	node_id_t idl = NODE_NULL;
+	size_t list;
+	token_type_t t;
 
-	idl = new_node(ND_VAR_INIT_DLIST, NULL, NULL);
-	idl->list = new_vector();
-	idl->value = num;
+	if (id == NODE_NULL)
+		return NODE_NULL;
 
-	num++;
+	list = list_begin();
 
-	do {
-		vector_push(idl->list, id);
-		t = tokens->data[g_position];
+	for (;;) {
+		list_push(id);
+		t = peek_token(tokens);
 
-		if (t->type != TK_COMMA)
+		if (t != TK_COMMA)
 			break;
 
-		id = init_declarator(tokens);
-	} while (idl != NULL);
+		consume_token(tokens, TK_COMMA);
+		if ((id = init_declarator(tokens)) == NODE_NULL)
+			parse_error(tokens);
+	}
+
+	idl = new_node(ND_VAR_INIT_DLIST, NODE_NULL, NODE_NULL);
+	get_node(idl)->list = list_end(list);
 
 	return idl;
 }
@@ -946,12 +781,13 @@ static struct node_t *init_declarator_list(struct vector_t *tokens)
  *              | declaration_specifiers init_declarator_list ';'
  *              ;
  */
-static struct node_t *declaration(struct vector_t *tokens)
+static node_id_t declaration(struct token_stream_t *tokens)
 {
-	struct node_t *d = NULL, *ds;
+	node_id_t d = NODE_NULL, ds, idl;
 
-	if ((ds = declaration_specifiers(tokens)) != NULL) {
-		d = new_node(ND_VAR_DEC, ds, init_declarator_list(tokens));
+	if ((ds = declaration_specifiers(tokens)) != NODE_NULL) {
+		idl = init_declarator_list(tokens, init_declarator(tokens));
+		d = new_node(ND_VAR_DEC, ds, idl);
 		expect_token(tokens, TK_SEMICOLON);
 	}
 
@@ -962,28 +798,19 @@ static struct node_t *declaration(struct vector_t *tokens)
  * @brief declaration_listをパースする
  *
  * @param tokens  トークンベクタ
- * @return パース結果のノード
  *
  * declaration_list := declaration
  *                   | declaration_list declaration
  *                   ;
+ *
+ * パースした宣言は作成中の子リストに積む.
  */
-static struct vector_t *declaration_list(struct vector_t *tokens)
+static void declaration_list(struct token_stream_t *tokens)
 {
-	struct vector_t *dl = NULL;
-	struct node_t *dn = NULL;
-
-	if ((dn = declaration(tokens)) == NULL)
-		return NULL;
-
-	dl = new_vector();
-
-	do {
-		vector_push(dl, dn);
-		dn = declaration(tokens);
-	} while (dn != NULL);
+	node_id_t dn;
 
-	return dl;
+	while ((dn = declaration(tokens)) != NODE_NULL)
+		list_push(dn);
 }
 
 /**
@@ -995,27 +822,23 @@ static struct vector_t *declaration_list(struct vector_t *tokens)
  *                     | '{' declaration_list statement_list '}'
  *                     ;
  */
-static struct node_t *compound_statement(struct vector_t *tokens)
+static node_id_t compound_statement(struct token_stream_t *tokens)
 {
-	struct token_t *t = tokens->data[g_position];
-	struct vector_t *sl = NULL, *dl = NULL;
-	struct node_t *n;
-
-	if (t->type == TK_LEFT_BRACE) {
-		g_position++;
-		dl = declaration_list(tokens);
-		sl = statement_list(tokens);
-		expect_token(tokens, TK_RIGHT_BRACE);
-	}
+	token_type_t t = peek_token(tokens);
+	size_t list;
+	node_id_t n;
 
-	if (dl == NULL && sl == NULL)
-		return NULL;
+	if (t != TK_LEFT_BRACE)
+		return NODE_NULL;
 
-	n = new_node(ND_COMPOUND_STATEMENTS, NULL, NULL);
-	n->list = new_vector();
+	advance_token(tokens);
+	list = list_begin();
+	declaration_list(tokens);
+	statement_list(tokens);
+	expect_token(tokens, TK_RIGHT_BRACE);
 
-	vector_merge(n->list, dl);
-	vector_merge(n->list, sl);
+	n = new_node(ND_COMPOUND_STATEMENTS, NODE_NULL, NODE_NULL);
+	get_node(n)->list = list_end(list);
 
 	return n;
 }
@@ -1031,23 +854,19 @@ static struct node_t *compound_statement(struct vector_t *tokens)
  *            | jump_statement
  *            ;
  */
-static struct node_t *statement(struct vector_t *tokens)
+static node_id_t statement(struct token_stream_t *tokens)
 {
-	struct node_t *node = NULL;
-
-	if ((node = compound_statement(tokens)) != NULL)
-		return node;
-
-	if ((node = expression_statement(tokens)) != NULL)
-		return node;
-
-	if ((node = selection_statement(tokens)) != NULL)
-		return node;
-
-	if ((node = jump_statement(tokens)) != NULL)
-		return node;
-
-	return NULL;
+	/* 先頭のトークンだけで決める (LL(1)) */
+	switch (peek_token(tokens)) {
+	case TK_LEFT_BRACE:
+		return compound_statement(tokens);
+	case TK_IF:
+		return selection_statement(tokens);
+	case TK_RETURN:
+		return jump_statement(tokens);
+	default:
+		return expression_statement(tokens);
+	}
 }
 
 /**
@@ -1056,24 +875,15 @@ static struct node_t *statement(struct vector_t *tokens)
  * statement_list := statement
  *                 | statement_list statement
  *                 ;
+ *
+ * パースした文は作成中の子リストに積む.
  */
-static struct vector_t *statement_list(struct vector_t *tokens)
+static void statement_list(struct token_stream_t *tokens)
 {
-	struct vector_t *sl = NULL;
-	struct node_t *s;
-
-	if ((s = statement(tokens)) == NULL)
-		return NULL;
+	node_id_t s;
 
-	/* 新規にSTATEMENTSノードを作成する  */
-	sl = new_vector();
-
-	do {
-		vector_push(sl, s);
-		s = statement(tokens);
-	} while (s != NULL);
-
-	return sl;
+	while ((s = statement(tokens)) != NODE_NULL)
+		list_push(s);
 }
 
 /**
@@ -1084,62 +894,63 @@ static struct vector_t *statement_list(struct vector_t *tokens)
  *                        | declaration_specifiers
  *                        ;
  */
-static node_t *parameter_declaration(struct vector_t *tokens)
+static node_id_t parameter_declaration(struct token_stream_t *tokens)
 {
-	struct node_t *lhs;
+	node_id_t lhs, rhs;
+
+	if ((lhs = declaration_specifiers(tokens)) == NODE_NULL)
+		return NODE_NULL;
 
-	if ((lhs = declaration_specifiers(tokens)) == NULL)
-		return NULL;
+	rhs = declarator(tokens);
 
-	return new_node(ND_FUNC_PARAM, lhs, declarator(tokens));
+	return new_node(ND_FUNC_PARAM, lhs, rhs);
 }
 
 /**
  * @brief parameter_listのパーサ
- * @return パース済みのパラメータベクタ
+ * @return パース済みのパラメータリスト
  *
  * parameter_list := parameter_declaration
  *                 | parameter_list ',' parameter_declaration
  *                 ;
  */
-static struct vector_t *parameter_list(struct vector_t *tokens)
+static list_id_t parameter_list(struct token_stream_t *tokens)
 {
-	struct vector_t *pl = NULL;
-	struct node_t *n;
-	struct token_t *t;
+	size_t pl;
+	node_id_t n;
+	token_type_t t;
 
-	if ((n = parameter_declaration(tokens)) == NULL)
-		return NULL;
+	if ((n = parameter_declaration(tokens)) == NODE_NULL)
+		return 0;
 
-	/* 新規にFUNC_PLISTノードを作成する */
-	pl = new_vector();
+	pl = list_begin();
 
 	for (;;) {
-		t = tokens->data[g_position];
+		t = peek_token(tokens);
 
-		if (n == NULL)
+		if (n == NODE_NULL)
 			break;
 
-		vector_push(pl, n);
+		list_push(n);
 
-		if (t->type != TK_COMMA)
+		if (t != TK_COMMA)
 			break;
 
 		consume_token(tokens, TK_COMMA);
 		n = parameter_declaration(tokens);
 	}
 
-	return pl;
+	return list_end(pl);
 }
 
 /**
  * @brief parameter_type_listのパーサ
- * @return パース済みのパラメータベクタ
+ * @return パース済みのパラメータリスト
  *
  * parameter_type_list := parameter_list
  *                      | parameter_list ',' ELLIPSIS
  */
-static struct vector_t *parameter_type_list(struct vector_t *tokens)
+static list_id_t parameter_type_list(struct token_stream_t *tokens)
 {
 	return parameter_list(tokens);
 }
@@ -1159,25 +970,27 @@ static struct vector_t *parameter_type_list(struct vector_t *tokens)
  *                    | direct_declarator '(' ')'
  *                    ;
  */
-static struct node_t *direct_declarator(struct vector_t *tokens)
+static node_id_t direct_declarator(struct token_stream_t *tokens)
 {
-	struct token_t *t;
-	struct node_t *n;
+	token_type_t t;
+	node_id_t n;
+	list_id_t pl;
 
-	if ((n = identifier(tokens)) != NULL) {
-		t = tokens->data[g_position];
+	if ((n = identifier(tokens)) != NODE_NULL) {
+		t = peek_token(tokens);
 
 		/* parameter_type_list */
-		if (t->type == TK_LEFT_PAREN) {
+		if (t == TK_LEFT_PAREN) {
 			consume_token(tokens, TK_LEFT_PAREN);
-			n->parameter_list = parameter_type_list(tokens);
+			pl = parameter_type_list(tokens);
+			get_node(n)->parameter_list = pl;
 			expect_token(tokens, TK_RIGHT_PAREN);
 		}
 
 		return n;
 	}
 
-	return NULL;
+	return NODE_NULL;
 }
 
 /**
@@ -1192,7 +1005,7 @@ static struct node_t *direct_declarator(struct vector_t *tokens)
  *
  * @todo direct_declarator以外への対応
  */
-static struct node_t *declarator(struct vector_t *tokens)
+static node_id_t declarator(struct token_stream_t *tokens)
 {
 	return direct_declarator(tokens);
 }
@@ -1219,19 +1032,21 @@ static struct node_t *declarator(struct vector_t *tokens)
  *
  * @todo INT以外への対応
  */
-static struct node_t *type_specifier(struct vector_t *tokens)
+static node_id_t type_specifier(struct token_stream_t *tokens)
 {
-	struct token_t *t = tokens->data[g_position];
-	struct node_t *n = NULL;
-
-	if (t->type == TK_INT) {
-		g_position++;
-		n = new_node(ND_TYPE, NULL, NULL);
-		n->name = t->name;
+	token_type_t t = peek_token(tokens);
+	node_id_t n = NODE_NULL;
+	const char *name;
+
+	if (t == TK_INT) {
+		name = token_name(tokens);
+		n = new_node(ND_TYPE, NODE_NULL, NODE_NULL);
+		get_node(n)->name = intern_id(intern(name, strlen(name)));
+		advance_token(tokens);
 		return n;
 	}
 
-	return NULL;
+	return NODE_NULL;
 }
 
 /**
@@ -1248,15 +1063,16 @@ static struct node_t *type_specifier(struct vector_t *tokens)
  *                         | type_qualifier declaration_specifiers
  *                         ;
  */
-static struct node_t *declaration_specifiers(struct vector_t *tokens)
+static node_id_t declaration_specifiers(struct token_stream_t *tokens)
 {
 	return type_specifier(tokens);
 }
 
 /**
- * @brief function_definitionのパーサ
+ * @brief function_definitionのdeclaratorより後をパースする
  *
  * @param tokens  トークンベクタ
+ * @param dn      パース済みのdeclaration_specifiers (lhsにdeclaratorを持つ)
  * @return パース結果のノード
  *
  * function_definition := declaration_specifiers declarator declaration_list compound_statement
@@ -1267,27 +1083,14 @@ static struct node_t *declaration_specifiers(struct vector_t *tokens)
  *
  * @todo declarator compound_statement 以外への対応
  */
-static struct node_t *function_definition(struct vector_t *tokens)
+static node_id_t function_definition_rest(struct token_stream_t *tokens, node_id_t dn)
 {
-	struct node_t *dn, *sn, *n;
-	int stored_pos = g_position;
-
-	if ((dn = declaration_specifiers(tokens)) == NULL)
-		goto ERR;
-
-	if ((dn->lhs = declarator(tokens)) == NULL)
-		goto ERR;
+	node_id_t sn;
 
-	if ((sn = compound_statement(tokens)) == NULL)
-		goto ERR;
+	if ((sn = compound_statement(tokens)) == NODE_NULL)
+		parse_error(tokens);
 
-	n = new_node(ND_FUNC_DEF, dn, sn);
-
-	return n;
-
-ERR:
-	g_position = stored_pos;
-	return NULL;
+	return new_node(ND_FUNC_DEF, dn, sn);
 }
 
 /**
@@ -1300,20 +1103,30 @@ ERR:
  *                       | declaration
  *                       ;
  *
- * @todo declarationの処理
+ * declaration_specifiersとdeclaratorを1回だけパースし, 次のトークンが '{' なら関数定義,
+ * そうでなければ (グローバル変数の) 宣言の続きとしてパースする.
  */
-static struct node_t *external_declaration(struct vector_t *tokens)
+static node_id_t external_declaration(struct token_stream_t *tokens)
 {
-	struct node_t *n;
+	node_id_t ds, dn, idl, n;
 
-	if ((n = function_definition(tokens)) != NULL)
-		return n;
+	if ((ds = declaration_specifiers(tokens)) == NODE_NULL)
+		return NODE_NULL;
 
-	if ((n = declaration(tokens)) == NULL)
-		return NULL;
+	dn = declarator(tokens);
 
-	/* グルーバル変数なので, ノードを書き換える. */
-	n->type = ND_VAR_DEC_STATIC;
+	if (dn != NODE_NULL && peek_token(tokens) == TK_LEFT_BRACE) {
+		get_node(ds)->lhs = dn;
+		return function_definition_rest(tokens, ds);
+	}
+
+	if (dn != NODE_NULL)
+		dn = init_declarator_rest(tokens, dn);
+
+	/* グルーバル変数 */
+	idl = init_declarator_list(tokens, dn);
+	n = new_node(ND_VAR_DEC_STATIC, ds, idl);
+	expect_token(tokens, TK_SEMICOLON);
 
 	return n;
 }
@@ -1328,22 +1141,25 @@ static struct node_t *external_declaration(struct vector_t *tokens)
  *                   | translation_unit external_declaration
  *                   ;
  */
-static struct node_t *translation_unit(struct vector_t *tokens)
+static node_id_t translation_unit(struct token_stream_t *tokens)
 {
-	struct node_t *tu = NULL;
-	struct node_t *n;
+	node_id_t tu = NODE_NULL;
+	node_id_t n;
+	size_t list;
 
-	if ((n = external_declaration(tokens)) == NULL)
-		return NULL;
+	if ((n = external_declaration(tokens)) == NODE_NULL)
+		return NODE_NULL;
 
-	/* 新規にPROGRAMノードを作成する */
-	tu = new_node(ND_PROGRAM, NULL, NULL);
-	tu->list = new_vector();
+	list = list_begin();
 
 	do {
-		vector_push(tu->list, n);
+		list_push(n);
 		n = external_declaration(tokens);
-	} while (n != NULL);
+	} while (n != NODE_NULL);
+
+	/* 新規にPROGRAMノードを作成する */
+	tu = new_node(ND_PROGRAM, NODE_NULL, NODE_NULL);
+	get_node(tu)->list = list_end(list);
 
 	return tu;
 }
@@ -1351,12 +1167,60 @@ static struct node_t *translation_unit(struct vector_t *tokens)
 /**
  * @brief パーサーのメイン関数
  */
-struct node_t *parse(struct vector_t *tokens)
+node_id_t parse(struct token_stream_t *tokens)
 {
-	struct node_t *p = translation_unit(tokens);    // start point
+	node_id_t p = translation_unit(tokens);    // start point
 
-	if (p == NULL)
-		parse_error();
+	if (p == NODE_NULL)
+		parse_error(tokens);
+
+	/* external_declarationでないものが残っていればエラー */
+	expect_token(tokens, TK_EOF);
 
 	return p;
 }
+
+/**
+ * @brief translation_unitのexternal_declarationを1つずつパースする
+ */
+node_id_t parse_next_declaration(struct token_stream_t *tokens)
+{
+	node_id_t n = external_declaration(tokens);
+
+	/* parse()と同じく, 1つもないか, external_declarationでないものが残っていればエラー */
+	if (n == NODE_NULL && tokens->pos == 0)
+		parse_error(tokens);
+	if (n == NODE_NULL)
+		expect_token(tokens, TK_EOF);
+
+	return n;
+}
+
+/**
+ * @brief external_declarationを1つパースする
+ */
+int parse_external_declaration(struct token_stream_t *tokens, node_id_t *node)
+{
+	jmp_buf env;
+	size_t scratch = list_begin();
+	size_t depth = expr_stack.len;
+
+	syntax_error_jmp = &env;
+
+	if (setjmp(env) != 0) {
+		/* 途中まで積んだものを捨てる. 作ったノードはアリーナに残る. */
+		syntax_error_jmp = NULL;
+		node_arena.scratch_len = scratch;
+		expr_stack.len = depth;
+		return -1;
+	}
+
+	*node = external_declaration(tokens);
+
+	/* 次の区間の先頭がわかるように, 字句解析のエラーもここで拾う */
+	peek_token(tokens);
+
+	syntax_error_jmp = NULL;
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * @brief プリコンパイル済みヘッダー
+ *
+ * ヘッダーをパースした後の状態 (識別子プール, ノードアリーナ, マクロ表) をそのまま1つのファイルに
+ * 書き出す. 読み込むときはファイルをmmapし, 識別子はマップした領域を直接指し, ノードとマクロは
+ * まとめて写すだけで済ませる. 識別子のIDとノードの添字は書き出したときのままなので,
+ * 読み込んだ後にパースする入力はヘッダーの続きとして扱える.
+ *
+ * 大域変数や関数の情報はASTから名前解決で作り直す.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rw2rvc2.h"
+
+#define PCH_MAGIC "RW2RVPCH" /**< ファイルの先頭の8バイト */
+#define PCH_VERSION 1	     /**< 形式のバージョン */
+#define PCH_ALIGN 8	     /**< 各部分の先頭の境界 */
+
+/**
+ * @brief プリコンパイル済みヘッダーの先頭
+ *
+ * 各部分はファイルの先頭からのオフセットで指す.
+ */
+struct pch_header_t {
+	char magic[8];		/**< PCH_MAGIC */
+	uint32_t version;	/**< PCH_VERSION */
+	uint32_t node_size;	/**< sizeof(struct node_t) (書き出したコンパイラとの整合性) */
+	uint32_t program;	/**< ND_PROGRAM */
+	uint32_t num_names;	/**< 識別子の数 */
+	uint64_t names_offset;	/**< 識別子プール */
+	uint64_t names_size;	/**< 識別子プールのバイト数 */
+	uint64_t nodes_offset;	/**< ノードの配列 */
+	uint64_t num_nodes;	/**< ノードの数 */
+	uint64_t lists_offset;	/**< 子リストの配列 */
+	uint64_t num_lists;	/**< 子リストの配列の要素数 */
+	uint64_t macros_offset; /**< マクロ表 */
+	uint64_t macros_size;	/**< マクロ表のバイト数 */
+};
+
+/**
+ * @brief 読み込んだプリコンパイル済みヘッダー (識別子が指すので閉じない)
+ */
+static struct source_t pch_source;
+
+/**
+ * @brief 次の部分の先頭まで0で埋める
+ * @return 次の部分のオフセット
+ */
+static uint64_t align_section(FILE *fp, uint64_t pos)
+{
+	static const char PADDING[PCH_ALIGN];
+	uint64_t aligned = (pos + PCH_ALIGN - 1) & ~(uint64_t)(PCH_ALIGN - 1);
+
+	fwrite(PADDING, aligned - pos, 1, fp);
+
+	return aligned;
+}
+
+/**
+ * @brief プリコンパイル済みヘッダーを書き出す
+ */
+int write_pch(const char *path, node_id_t program)
+{
+	struct pch_header_t header;
+	size_t num_names;
+	uint64_t pos;
+	FILE *fp;
+
+	if ((fp = fopen(path, "wb")) == NULL)
+		return -1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PCH_MAGIC, sizeof(header.magic));
+	header.version = PCH_VERSION;
+	header.node_size = sizeof(struct node_t);
+	header.program = program;
+
+	/* 先頭は最後に書き直す */
+	fwrite(&header, sizeof(header), 1, fp);
+	pos = align_section(fp, sizeof(header));
+
+	header.names_offset = pos;
+	header.names_size = write_intern_pool(fp, &num_names);
+	header.num_names = num_names;
+	pos = align_section(fp, pos + header.names_size);
+
+	header.nodes_offset = pos;
+	header.num_nodes = node_arena.len;
+	fwrite(node_arena.nodes, sizeof(struct node_t), node_arena.len, fp);
+	pos = align_section(fp, pos + sizeof(struct node_t) * node_arena.len);
+
+	header.lists_offset = pos;
+	header.num_lists = node_arena.lists_len;
+	fwrite(node_arena.lists, sizeof(node_id_t), node_arena.lists_len, fp);
+	pos = align_section(fp, pos + sizeof(node_id_t) * node_arena.lists_len);
+
+	header.macros_offset = pos;
+	header.macros_size = write_macros(fp);
+
+	rewind(fp);
+	fwrite(&header, sizeof(header), 1, fp);
+
+	if (ferror(fp)) {
+		fclose(fp);
+		errno = EIO;
+		return -1;
+	}
+
+	return fclose(fp);
+}
+
+/**
+ * @brief 部分がファイルに収まっているか判断する
+ */
+static bool section_in_file(uint64_t offset, uint64_t size)
+{
+	return offset % PCH_ALIGN == 0 && offset <= pch_source.len && size <= pch_source.len - offset;
+}
+
+/**
+ * @brief プリコンパイル済みヘッダーを読み込む
+ */
+node_id_t load_pch(const char *path)
+{
+	struct pch_header_t header;
+	const char *image;
+
+	if (open_source(&pch_source, path) != 0) {
+		error_printf("%s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	image = pch_source.buf;
+
+	if (pch_source.len < sizeof(header) || memcmp(image, PCH_MAGIC, sizeof(header.magic)) != 0) {
+		error_printf("%s: not a precompiled header\n", path);
+		exit(1);
+	}
+	memcpy(&header, image, sizeof(header));
+
+	if (header.version != PCH_VERSION || header.node_size != sizeof(struct node_t)) {
+		error_printf("%s: precompiled header was written by another version\n", path);
+		exit(1);
+	}
+
+	if (header.num_nodes > UINT32_MAX || header.num_lists > UINT32_MAX || header.program >= header.num_nodes ||
+	    !section_in_file(header.names_offset, header.names_size) ||
+	    !section_in_file(header.nodes_offset, header.num_nodes * sizeof(struct node_t)) ||
+	    !section_in_file(header.lists_offset, header.num_lists * sizeof(node_id_t)) ||
+	    !section_in_file(header.macros_offset, header.macros_size) ||
+	    load_intern_pool(image + header.names_offset, header.names_size, header.num_names) != 0 ||
+	    load_macros(image + header.macros_offset, header.macros_size) != 0) {
+		error_printf("%s: precompiled header is broken\n", path);
+		exit(1);
+	}
+
+	load_node_arena((const struct node_t *)(image + header.nodes_offset), header.num_nodes,
+			(const node_id_t *)(image + header.lists_offset), header.num_lists);
+
+	return header.program;
+}
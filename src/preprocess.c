@@ -0,0 +1,1527 @@
+/**
+ * @brief プリプロセッサ
+ *
+ * #include, #define, #undef, #if/#ifdef/#ifndef/#elif/#else/#endif, #pragma once を処理し,
+ * 展開したトークンをtokenize()と同じ形のトークンストリームに全て積む.
+ *
+ * ヘッダーはパスごとにキャッシュし, プロセスの中で1度だけmmapする. 見つからなかったパスも
+ * 覚えておく. ファイル全体が #ifndef X ... #endif で囲まれていればインクルードガードとして
+ * 記録し, 次からはXが定義されていればファイルを読まずに済ませる.
+ *
+ * 複数のファイルのトークンを1つのストリームに積むので, オフセットはファイルごとにbaseだけ
+ * ずらした通し番号にする. token_location()とtoken_input()はbaseからファイルを引く.
+ */
+#define _GNU_SOURCE /* memmem() */
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rw2rvc2.h"
+
+#define PP_PARAM (TK_INVALID + 1) /**< マクロ本体中の仮引数 (値は仮引数の番号) */
+#define MAX_INCLUDE_DEPTH 200	  /**< #include の入れ子の上限 */
+
+/**
+ * @brief 前処理中のトークン
+ */
+struct pp_token_t {
+	unsigned char type; /**< トークンタイプ (token_type_t, PP_PARAM) */
+	bool noexpand;	    /**< 展開中のマクロの名前だったので, 以後展開しない */
+	uint32_t offset;    /**< 入力中のオフセット */
+	int value;	    /**< 数値の値, 識別子のintern_id(), 予約語の表の位置, 仮引数の番号 */
+};
+
+/**
+ * @brief トークンの列
+ */
+struct pp_tokens_t {
+	struct pp_token_t *tokens; /**< トークン */
+	size_t len;		   /**< トークンの数 */
+	size_t capacity;	   /**< tokensの容量 */
+};
+
+/**
+ * @brief マクロ
+ */
+struct macro_t {
+	bool defined;	    /**< 定義されているか */
+	bool function_like; /**< 関数形式マクロか */
+	bool disabled;	    /**< 展開中なので展開しない */
+	int num_params;	    /**< 仮引数の数 */
+	size_t begin;	    /**< 本体のmacro_bodies中の位置 */
+	size_t len;	    /**< 本体のトークンの数 */
+};
+
+/**
+ * @brief マクロ表 (intern_id()を添字にする)
+ */
+static struct {
+	struct macro_t *macros; /**< 名前ごとのマクロ */
+	size_t len;		/**< 初期化済みの要素数 */
+	size_t capacity;	/**< macrosの容量 */
+} macro_table;
+
+/**
+ * @brief 全てのマクロの本体 (再定義しても古い本体は残す)
+ */
+static struct pp_tokens_t macro_bodies;
+
+/**
+ * @brief キャッシュしたファイル
+ */
+struct pp_file_t {
+	const char *path;   /**< パス (intern()された文字列) */
+	const char *dir;    /**< パスのディレクトリ部分 ("/" で終わるか空) */
+	bool found;	    /**< 開けたか. 開けなかったパスも覚えておく. */
+	bool once;	    /**< #pragma once があったか */
+	unsigned int guard; /**< インクルードガードのマクロのintern_id() + 1 (なければ0) */
+	struct source_t src; /**< 入力 */
+	uint32_t base;	    /**< オフセットのbase */
+};
+
+/**
+ * @brief ファイルのキャッシュ (パスからpp_file_tを引く)
+ */
+static struct dict_t *file_cache;
+
+/**
+ * @brief 読み込んだファイルの表 (トークンストリームのsourcesになる)
+ */
+static struct {
+	struct token_source_t *files; /**< ファイル */
+	size_t len;		      /**< ファイルの数 */
+	size_t capacity;	      /**< filesの容量 */
+	uint32_t next_base;	      /**< 次のファイルのbase */
+} sources;
+
+/**
+ * @brief インクルードガードの検出状態
+ */
+typedef enum {
+	GUARD_START,  /**< まだ何もない */
+	GUARD_INSIDE, /**< 最初の #ifndef の中 */
+	GUARD_CLOSED, /**< 最初の #ifndef が閉じた後 */
+	GUARD_NONE,   /**< ガードではない */
+} guard_state_t;
+
+/**
+ * @brief 読んでいるファイル
+ */
+struct pp_include_t {
+	struct pp_file_t *file;	  /**< ファイル */
+	const char *p;		  /**< 次に読む位置 */
+	bool bol;		  /**< 行頭か */
+	size_t cond_base;	  /**< このファイルに入ったときの条件の深さ */
+	guard_state_t guard_state; /**< インクルードガードの検出状態 */
+	unsigned int guard;	  /**< ガードの候補のマクロ */
+};
+
+/**
+ * @brief #include のスタック
+ */
+static struct {
+	struct pp_include_t *files; /**< 読んでいるファイル */
+	size_t len;		    /**< 入れ子の深さ */
+	size_t capacity;	    /**< filesの容量 */
+} include_stack;
+
+/**
+ * @brief 条件付き取り込みの状態
+ */
+struct pp_cond_t {
+	bool taken;	/**< どれかのグループを取り込んだか */
+	bool else_seen; /**< #else があったか */
+};
+
+/**
+ * @brief 条件付き取り込みのスタック
+ */
+static struct {
+	struct pp_cond_t *conds; /**< 入れ子の条件 */
+	size_t len;		 /**< 入れ子の深さ */
+	size_t capacity;	 /**< condsの容量 */
+} cond_stack;
+
+/**
+ * @brief 展開中のトークン列
+ */
+struct pp_context_t {
+	struct pp_token_t *tokens; /**< 所有するトークン列. NULLならmacro_bodiesを指す. */
+	size_t pos;		   /**< 次に読む位置 */
+	size_t end;		   /**< 終端 */
+	unsigned int macro;	   /**< 展開中のマクロのintern_id() + 1 (なければ0) */
+	bool relocate;		   /**< トークンの位置をoffsetに置き換える */
+	uint32_t offset;	   /**< マクロを呼び出した位置 */
+};
+
+/**
+ * @brief 展開中のトークン列のスタック
+ *
+ * 読み終えたトークン列は次に読もうとしたときに降ろす. マクロは自分のトークン列が
+ * 降ろされるまで展開しないので, 本体の最後のトークンがそのマクロ自身でも展開されない.
+ */
+static struct {
+	struct pp_context_t *contexts; /**< トークン列 */
+	size_t len;		       /**< 積んでいる数 */
+	size_t capacity;	       /**< contextsの容量 */
+} context_stack;
+
+/**
+ * @brief #if の式の評価
+ */
+static struct {
+	const struct pp_token_t *tokens; /**< 式のトークン */
+	size_t len;			 /**< トークンの数 */
+	size_t pos;			 /**< 次に読む位置 */
+	int skip;			 /**< 短絡評価で値を使わない部分の深さ */
+} eval;
+
+/**
+ * @brief インクルードパス
+ */
+static const char **search_dirs;
+static size_t num_search_dirs;
+
+/**
+ * @brief "defined" のintern_id()
+ */
+static unsigned int defined_id;
+
+/**
+ * @brief 読んでいるファイル
+ */
+static struct pp_include_t *current_file(void)
+{
+	return &include_stack.files[include_stack.len - 1];
+}
+
+/**
+ * @brief 前処理のエラーを表示して終了する
+ * @param[in] p       エラーの位置 (読んでいるファイルの中)
+ * @param[in] format  書式
+ */
+static void pp_error(const char *p, const char *format, ...)
+{
+	const struct pp_include_t *f = current_file();
+	const char *q = f->file->src.buf;
+	char message[256];
+	va_list ap;
+	int line = 1;
+
+	while ((q = memchr(q, '\n', p - q)) != NULL) {
+		line++;
+		q++;
+	}
+
+	va_start(ap, format);
+	vsnprintf(message, sizeof(message), format, ap);
+	va_end(ap);
+
+	error_printf("%s:%d: %s\n", f->file->path, line, message);
+	exit(1);
+}
+
+/**
+ * @brief トークン列の末尾に足す
+ */
+static void append_pp_token(struct pp_tokens_t *list, const struct pp_token_t *tok)
+{
+	if (list->len >= list->capacity)
+		grow_array(&list->tokens, &list->capacity, sizeof(struct pp_token_t), list->len + 1);
+
+	list->tokens[list->len++] = *tok;
+}
+
+/**
+ * @brief 定義されているマクロを引く
+ * @return マクロ. 定義されていなければNULL.
+ */
+static struct macro_t *find_macro(unsigned int id)
+{
+	if (id >= macro_table.len || !macro_table.macros[id].defined)
+		return NULL;
+
+	return &macro_table.macros[id];
+}
+
+/**
+ * @brief マクロ表の要素を用意する
+ */
+static struct macro_t *macro_entry(unsigned int id)
+{
+	if (id >= macro_table.len) {
+		if (id >= macro_table.capacity)
+			grow_array(&macro_table.macros, &macro_table.capacity, sizeof(struct macro_t), (size_t)id + 1);
+
+		memset(&macro_table.macros[macro_table.len], 0, sizeof(struct macro_t) * (id + 1 - macro_table.len));
+		macro_table.len = (size_t)id + 1;
+	}
+
+	return &macro_table.macros[id];
+}
+
+/**
+ * @brief トークン列を積む
+ * @param[in] tokens  所有させるトークン列 (NULLならmacro_bodiesを指す)
+ * @param[in] pos     先頭
+ * @param[in] end     終端
+ * @param[in] macro   展開するマクロのintern_id() + 1 (なければ0)
+ */
+static struct pp_context_t *push_context(struct pp_token_t *tokens, size_t pos, size_t end, unsigned int macro)
+{
+	struct pp_context_t *c;
+
+	if (context_stack.len >= context_stack.capacity)
+		grow_array(&context_stack.contexts, &context_stack.capacity, sizeof(struct pp_context_t),
+			   context_stack.len + 1);
+
+	c = &context_stack.contexts[context_stack.len++];
+	c->tokens = tokens;
+	c->pos = pos;
+	c->end = end;
+	c->macro = macro;
+	c->relocate = false;
+	c->offset = 0;
+
+	if (macro != 0)
+		macro_table.macros[macro - 1].disabled = true;
+
+	return c;
+}
+
+/**
+ * @brief 読み終えたトークン列を降ろす
+ */
+static void pop_context(void)
+{
+	struct pp_context_t *c = &context_stack.contexts[--context_stack.len];
+
+	if (c->macro != 0)
+		macro_table.macros[c->macro - 1].disabled = false;
+
+	free(c->tokens);
+}
+
+/**
+ * @brief トークン列の写しを積む
+ */
+static void push_copy(const struct pp_token_t *tokens, size_t len)
+{
+	struct pp_token_t *copy = NULL;
+
+	if (len > 0) {
+		if ((copy = malloc(sizeof(struct pp_token_t) * len)) == NULL) {
+			color_printf(stderr, COL_RED, "memory allocation failed\n");
+			exit(1);
+		}
+		memcpy(copy, tokens, sizeof(struct pp_token_t) * len);
+	}
+
+	push_context(copy, 0, len, 0);
+}
+
+/**
+ * @brief ファイル中の位置をオフセットにする
+ */
+static uint32_t file_offset(const struct pp_include_t *f, const char *p)
+{
+	return f->file->base + (uint32_t)(p - f->file->src.buf);
+}
+
+/**
+ * @brief 単語が一致するか判断する
+ */
+static bool is_word(const char *p, size_t len, const char *word)
+{
+	return len == strlen(word) && memcmp(p, word, len) == 0;
+}
+
+/**
+ * @brief 指令の行のトークンを1つ読む
+ * @param[out] tok    トークン
+ * @param[out] start  トークンの先頭
+ * @param[out] len    トークンの長さ
+ * @return 行末かファイルの終端ならfalse (改行は読まずに残す)
+ */
+static bool line_token(struct pp_token_t *tok, const char **start, size_t *len)
+{
+	struct pp_include_t *f = current_file();
+	token_type_t type;
+	bool newline;
+	int value;
+
+	type = scan_pp_token(f->p, start, len, &value, &newline);
+	if (newline || type == TK_EOF)
+		return false;
+
+	f->p = *start + *len;
+
+	tok->type = type;
+	tok->noexpand = false;
+	tok->offset = file_offset(f, *start);
+	tok->value = value;
+
+	return true;
+}
+
+/**
+ * @brief 指令の行の残りを読み飛ばす
+ * @return 行末の位置
+ */
+static const char *skip_directive_line(void)
+{
+	struct pp_token_t tok;
+	const char *start;
+	size_t len;
+
+	while (line_token(&tok, &start, &len))
+		;
+
+	return current_file()->p;
+}
+
+/**
+ * @brief 指令の行の識別子を読む
+ * @param[in] directive  指令の名前 (エラー表示用)
+ * @return intern_id()
+ */
+static unsigned int expect_macro_name(const char *directive)
+{
+	struct pp_token_t tok;
+	const char *start;
+	size_t len;
+
+	if (!line_token(&tok, &start, &len) || tok.type != TK_IDENT)
+		pp_error(current_file()->p, "macro names must be identifiers in #%s", directive);
+
+	return tok.value;
+}
+
+/**
+ * @brief 次のトークンを読む
+ * @param[out] tok    トークン
+ * @param[in]  floor  読む一番下のトークン列の番号 + 1. 0なら全てのトークン列とファイルを読む.
+ * @return トークン列を読み終えたらfalse
+ */
+static bool next_token(struct pp_token_t *tok, size_t floor);
+
+/**
+ * @brief マクロを展開して次のトークンを読む
+ * @param[out] tok    展開し終えたトークン
+ * @param[in]  floor  next_token()と同じ
+ * @return トークン列を読み終えたらfalse
+ */
+static bool expand_token(struct pp_token_t *tok, size_t floor);
+
+/**
+ * @brief トークン列のマクロを全て展開する
+ * @param[in]  in   トークン列
+ * @param[in]  len  inの長さ
+ * @param[out] out  展開したトークン列 (末尾に足す)
+ *
+ * トークン列だけで展開するので, 末尾の関数形式マクロの名前は後ろの '(' と組にならない.
+ */
+static void expand_list(const struct pp_token_t *in, size_t len, struct pp_tokens_t *out)
+{
+	struct pp_token_t tok;
+	size_t floor;
+
+	push_copy(in, len);
+	floor = context_stack.len;
+
+	while (expand_token(&tok, floor))
+		append_pp_token(out, &tok);
+}
+
+/**
+ * @brief 関数形式マクロの実引数を読み, 置き換えた本体を積む
+ * @param[in] name   マクロの名前のトークン ('(' は読んだ後)
+ * @param[in] floor  next_token()と同じ
+ */
+static void expand_function_like(const struct pp_token_t *name, size_t floor)
+{
+	const struct macro_t *m;
+	struct pp_tokens_t raw = {NULL, 0, 0}, body = {NULL, 0, 0};
+	struct pp_tokens_t *args = NULL;
+	size_t num_args = 1, capacity = 0;
+	size_t *bounds = NULL;
+	size_t i, j, depth = 0;
+	struct pp_token_t tok;
+
+	/* 実引数ごとの区切りをrawの中の位置で持つ */
+	grow_array(&bounds, &capacity, sizeof(size_t), 2);
+	bounds[0] = 0;
+
+	for (;;) {
+		if (!next_token(&tok, floor) || tok.type == TK_EOF)
+			pp_error(current_file()->p, "unterminated argument list invoking macro \"%s\"",
+				 intern_name(name->value));
+
+		if (tok.type == TK_RIGHT_PAREN && depth == 0)
+			break;
+
+		if (tok.type == TK_COMMA && depth == 0) {
+			if (num_args + 1 >= capacity)
+				grow_array(&bounds, &capacity, sizeof(size_t), num_args + 2);
+			bounds[num_args++] = raw.len;
+			continue;
+		}
+
+		if (tok.type == TK_LEFT_PAREN)
+			depth++;
+		else if (tok.type == TK_RIGHT_PAREN)
+			depth--;
+
+		append_pp_token(&raw, &tok);
+	}
+	bounds[num_args] = raw.len;
+
+	/* 実引数の途中の #define でマクロ表が動いているかもしれない */
+	m = &macro_table.macros[name->value];
+
+	/* f() は仮引数がなければ実引数0個 */
+	if (m->num_params == 0 && num_args == 1 && raw.len == 0)
+		num_args = 0;
+
+	if ((int)num_args != m->num_params)
+		pp_error(current_file()->p, "macro \"%s\" requires %d arguments, but %zu given",
+			 intern_name(name->value), m->num_params, num_args);
+
+	/* 実引数は置き換える前に展開しておく */
+	if (num_args > 0 && (args = calloc(num_args, sizeof(struct pp_tokens_t))) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_args; i++)
+		expand_list(&raw.tokens[bounds[i]], bounds[i + 1] - bounds[i], &args[i]);
+
+	for (i = m->begin; i < m->begin + m->len; i++) {
+		tok = macro_bodies.tokens[i];
+
+		if (tok.type != PP_PARAM) {
+			tok.offset = name->offset;
+			append_pp_token(&body, &tok);
+			continue;
+		}
+
+		for (j = 0; j < args[tok.value].len; j++)
+			append_pp_token(&body, &args[tok.value].tokens[j]);
+	}
+
+	for (i = 0; i < num_args; i++)
+		free(args[i].tokens);
+	free(args);
+	free(bounds);
+	free(raw.tokens);
+
+	push_context(body.tokens, 0, body.len, name->value + 1);
+}
+
+static bool expand_token(struct pp_token_t *tok, size_t floor)
+{
+	struct pp_context_t *c;
+	struct pp_token_t next;
+	struct macro_t *m;
+
+	for (;;) {
+		if (!next_token(tok, floor))
+			return false;
+
+		if (tok->type != TK_IDENT || tok->noexpand || (m = find_macro(tok->value)) == NULL)
+			return true;
+
+		if (m->disabled) {
+			tok->noexpand = true;
+			return true;
+		}
+
+		if (!m->function_like) {
+			c = push_context(NULL, m->begin, m->begin + m->len, tok->value + 1);
+			c->relocate = true;
+			c->offset = tok->offset;
+			continue;
+		}
+
+		/* '(' が続かなければ呼び出しではない */
+		if (!next_token(&next, floor))
+			return true;
+
+		if (next.type != TK_LEFT_PAREN) {
+			push_copy(&next, 1);
+			return true;
+		}
+
+		expand_function_like(tok, floor);
+	}
+}
+
+/**
+ * @brief パスのディレクトリ部分を返す
+ * @return "/" で終わるディレクトリか空文字列 (intern()された文字列)
+ */
+static const char *dir_name(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+
+	return intern(path, (slash == NULL) ? 0 : (size_t)(slash - path + 1));
+}
+
+/**
+ * @brief ファイルを表に載せ, オフセットのbaseを割り当てる
+ */
+static void register_source(struct pp_file_t *file)
+{
+	struct token_source_t *s;
+
+	if ((uint64_t)sources.next_base + file->src.len + 1 > UINT32_MAX) {
+		color_printf(stderr, COL_RED, "input too large (4GiB or more)\n");
+		exit(1);
+	}
+
+	if (sources.len >= sources.capacity)
+		grow_array(&sources.files, &sources.capacity, sizeof(struct token_source_t), sources.len + 1);
+
+	file->base = sources.next_base;
+	sources.next_base += file->src.len + 1;
+
+	s = &sources.files[sources.len++];
+	s->path = file->path;
+	s->buf = file->src.buf;
+	s->base = file->base;
+}
+
+/**
+ * @brief キャッシュからファイルを引く. なければ開いてキャッシュする.
+ * @param[in] dir   ディレクトリ (空ならカレントディレクトリ)
+ * @param[in] name  ファイル名
+ * @param[in] len   nameの長さ
+ * @return ファイル. 開けなければNULL.
+ */
+static struct pp_file_t *lookup_file(const char *dir, const char *name, size_t len)
+{
+	size_t dir_len = strlen(dir);
+	bool slash = (dir_len > 0 && dir[dir_len - 1] != '/');
+	struct dict_element_t *e;
+	struct pp_file_t *file;
+	const char *path;
+	char *buf;
+
+	if ((buf = malloc(dir_len + 1 + len + 1)) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+	memcpy(buf, dir, dir_len);
+	if (slash)
+		buf[dir_len++] = '/';
+	memcpy(buf + dir_len, name, len);
+	buf[dir_len + len] = '\0';
+
+	path = intern(buf, dir_len + len);
+	free(buf);
+
+	if ((e = dict_lookup(file_cache, path)) != NULL) {
+		file = e->value;
+		return file->found ? file : NULL;
+	}
+
+	if ((file = calloc(1, sizeof(struct pp_file_t))) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+
+	file->path = path;
+	file->dir = dir_name(path);
+	file->found = (open_source(&file->src, path) == 0);
+
+	if (file->found)
+		register_source(file);
+
+	dict_append(file_cache, path, file);
+
+	return file->found ? file : NULL;
+}
+
+/**
+ * @brief #include するファイルを探す
+ * @param[in] name   ファイル名
+ * @param[in] len    nameの長さ
+ * @param[in] quote  "..." ならtrue. 読んでいるファイルのディレクトリから探す.
+ */
+static struct pp_file_t *find_include(const char *name, size_t len, bool quote)
+{
+	struct pp_file_t *file;
+	size_t i;
+
+	if (name[0] == '/')
+		return lookup_file("", name, len);
+
+	if (quote && (file = lookup_file(current_file()->file->dir, name, len)) != NULL)
+		return file;
+
+	for (i = 0; i < num_search_dirs; i++) {
+		if ((file = lookup_file(search_dirs[i], name, len)) != NULL)
+			return file;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief ファイルを読み始める
+ */
+static void push_file(struct pp_file_t *file)
+{
+	struct pp_include_t *f;
+
+	if (include_stack.len >= include_stack.capacity)
+		grow_array(&include_stack.files, &include_stack.capacity, sizeof(struct pp_include_t),
+			   include_stack.len + 1);
+
+	f = &include_stack.files[include_stack.len++];
+	f->file = file;
+	f->p = file->src.buf;
+	f->bol = true;
+	f->cond_base = cond_stack.len;
+	f->guard_state = GUARD_START;
+	f->guard = 0;
+}
+
+/**
+ * @brief #include
+ */
+static void do_include(void)
+{
+	struct pp_include_t *f = current_file();
+	const char *p = f->p, *name, *end;
+	struct pp_file_t *file;
+	bool quote;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	if (*p != '"' && *p != '<')
+		pp_error(p, "#include expects \"FILENAME\" or <FILENAME>");
+
+	quote = (*p == '"');
+	name = p + 1;
+	for (end = name; *end != (quote ? '"' : '>'); end++) {
+		if (*end == '\n' || *end == '\0')
+			pp_error(p, "missing terminating %c character", quote ? '"' : '>');
+	}
+
+	if (end == name)
+		pp_error(p, "empty filename in #include");
+
+	f->p = end + 1;
+	skip_directive_line();
+
+	if ((file = find_include(name, end - name, quote)) == NULL)
+		pp_error(p, "%.*s: No such file or directory", (int)(end - name), name);
+
+	/* #pragma once とインクルードガードのあるファイルは開き直さない */
+	if (file->once || (file->guard != 0 && find_macro(file->guard - 1) != NULL))
+		return;
+
+	if (include_stack.len >= MAX_INCLUDE_DEPTH)
+		pp_error(p, "#include nested depth %d exceeds maximum", MAX_INCLUDE_DEPTH);
+
+	push_file(file);
+}
+
+/**
+ * @brief #define
+ */
+static void do_define(void)
+{
+	struct pp_include_t *f = current_file();
+	struct pp_tokens_t params = {NULL, 0, 0};
+	struct pp_token_t tok;
+	struct macro_t *m;
+	const char *start;
+	unsigned int id;
+	size_t len, i, begin = macro_bodies.len;
+	bool function_like;
+
+	id = expect_macro_name("define");
+
+	/* 名前の直後に空白なしで '(' が来れば関数形式マクロ */
+	function_like = (*f->p == '(');
+	if (function_like) {
+		f->p++;
+
+		if (!line_token(&tok, &start, &len))
+			pp_error(f->p, "missing ')' in macro parameter list");
+
+		while (tok.type != TK_RIGHT_PAREN) {
+			if (tok.type != TK_IDENT)
+				pp_error(start, "expected parameter name");
+
+			append_pp_token(&params, &tok);
+
+			if (!line_token(&tok, &start, &len) || (tok.type != TK_COMMA && tok.type != TK_RIGHT_PAREN))
+				pp_error(f->p, "expected ',' or ')' in macro parameter list");
+
+			if (tok.type == TK_COMMA && (!line_token(&tok, &start, &len) || tok.type == TK_RIGHT_PAREN))
+				pp_error(f->p, "expected parameter name");
+		}
+	}
+
+	while (line_token(&tok, &start, &len)) {
+		if (tok.type == TK_INVALID && *start == '#')
+			pp_error(start, "'#' and '##' operators are not supported");
+
+		if (tok.type == TK_INVALID)
+			pp_error(start, "invalid character '%c' in macro body", *start);
+
+		/* 仮引数は番号に置き換えておく */
+		for (i = 0; tok.type == TK_IDENT && i < params.len; i++) {
+			if (params.tokens[i].value == tok.value) {
+				tok.type = PP_PARAM;
+				tok.value = i;
+				break;
+			}
+		}
+
+		append_pp_token(&macro_bodies, &tok);
+	}
+
+	m = macro_entry(id);
+	m->defined = true;
+	m->function_like = function_like;
+	m->num_params = params.len;
+	m->begin = begin;
+	m->len = macro_bodies.len - begin;
+
+	free(params.tokens);
+}
+
+/**
+ * @brief #if の式を評価する
+ * @param[in] min_prec  読む二項演算子の最低の優先順位
+ */
+static long eval_expr(int min_prec);
+
+/**
+ * @brief #if の式の二項演算子の優先順位
+ * @return 優先順位. 二項演算子でなければ0.
+ */
+static int eval_prec(token_type_t type)
+{
+	switch (type) {
+	case TK_OR_OP:
+		return 1;
+	case TK_AND_OP:
+		return 2;
+	case TK_OR:
+		return 3;
+	case TK_XOR:
+		return 4;
+	case TK_AND:
+		return 5;
+	case TK_EQ_OP:
+	case TK_NE_OP:
+		return 6;
+	case TK_LESS_OP:
+	case TK_GREATER_OP:
+	case TK_LE_OP:
+	case TK_GE_OP:
+		return 7;
+	case TK_LEFT_OP:
+	case TK_RIGHT_OP:
+		return 8;
+	case TK_PLUS:
+	case TK_MINUS:
+		return 9;
+	case TK_MUL:
+	case TK_DIV:
+	case TK_MOD:
+		return 10;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief #if の式の単項式を評価する
+ */
+static long eval_unary(void)
+{
+	const struct pp_token_t *tok;
+	long v;
+
+	if (eval.pos >= eval.len)
+		pp_error(current_file()->p, "invalid expression in #if");
+
+	tok = &eval.tokens[eval.pos++];
+
+	switch (tok->type) {
+	case TK_NUM:
+		return tok->value;
+	case TK_PLUS:
+		return eval_unary();
+	case TK_MINUS:
+		return -eval_unary();
+	case TK_NOT:
+		return !eval_unary();
+	case TK_INV:
+		return ~eval_unary();
+	case TK_LEFT_PAREN:
+		v = eval_expr(1);
+		if (eval.pos >= eval.len || eval.tokens[eval.pos].type != TK_RIGHT_PAREN)
+			pp_error(current_file()->p, "missing ')' in #if expression");
+		eval.pos++;
+		return v;
+	case TK_IDENT:
+	case TK_RETURN:
+	case TK_IF:
+	case TK_ELSE:
+	case TK_GOTO:
+	case TK_INT:
+		/* 展開した後に残った識別子は0 */
+		return 0;
+	default:
+		pp_error(current_file()->p, "invalid token in #if expression");
+		return 0;
+	}
+}
+
+static long eval_expr(int min_prec)
+{
+	long lhs = eval_unary(), rhs;
+	token_type_t op;
+	int prec;
+
+	while (eval.pos < eval.len && (prec = eval_prec(op = eval.tokens[eval.pos].type)) >= min_prec && prec > 0) {
+		eval.pos++;
+
+		/* && と || の右辺は値を使わなければ0除算を報告しない */
+		if ((op == TK_AND_OP && !lhs) || (op == TK_OR_OP && lhs)) {
+			eval.skip++;
+			eval_expr(prec + 1);
+			eval.skip--;
+			lhs = (op == TK_OR_OP);
+			continue;
+		}
+
+		rhs = eval_expr(prec + 1);
+
+		switch (op) {
+		case TK_OR_OP:
+		case TK_AND_OP:
+			lhs = (rhs != 0);
+			break;
+		case TK_OR:
+			lhs |= rhs;
+			break;
+		case TK_XOR:
+			lhs ^= rhs;
+			break;
+		case TK_AND:
+			lhs &= rhs;
+			break;
+		case TK_EQ_OP:
+			lhs = (lhs == rhs);
+			break;
+		case TK_NE_OP:
+			lhs = (lhs != rhs);
+			break;
+		case TK_LESS_OP:
+			lhs = (lhs < rhs);
+			break;
+		case TK_GREATER_OP:
+			lhs = (lhs > rhs);
+			break;
+		case TK_LE_OP:
+			lhs = (lhs <= rhs);
+			break;
+		case TK_GE_OP:
+			lhs = (lhs >= rhs);
+			break;
+		case TK_LEFT_OP:
+			lhs = (long)((unsigned long)lhs << (rhs & 63));
+			break;
+		case TK_RIGHT_OP:
+			lhs >>= (rhs & 63);
+			break;
+		case TK_PLUS:
+			lhs += rhs;
+			break;
+		case TK_MINUS:
+			lhs -= rhs;
+			break;
+		case TK_MUL:
+			lhs *= rhs;
+			break;
+		case TK_DIV:
+		case TK_MOD:
+			if (rhs == 0) {
+				if (eval.skip == 0)
+					pp_error(current_file()->p, "division by zero in #if");
+				lhs = 0;
+				break;
+			}
+			lhs = (op == TK_DIV) ? lhs / rhs : lhs % rhs;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return lhs;
+}
+
+/**
+ * @brief #if, #elif の条件を読んで評価する
+ */
+static bool eval_condition(void)
+{
+	struct pp_tokens_t raw = {NULL, 0, 0}, expanded = {NULL, 0, 0};
+	struct pp_token_t tok;
+	const char *start;
+	size_t len;
+	bool paren, result;
+
+	while (line_token(&tok, &start, &len)) {
+		if (tok.type == TK_INVALID)
+			pp_error(start, "invalid character '%c' in #if expression", *start);
+
+		/* defined は展開する前に置き換える */
+		if (tok.type == TK_IDENT && (unsigned int)tok.value == defined_id) {
+			if (!line_token(&tok, &start, &len))
+				pp_error(current_file()->p, "operator \"defined\" requires an identifier");
+
+			if ((paren = (tok.type == TK_LEFT_PAREN)) && !line_token(&tok, &start, &len))
+				pp_error(current_file()->p, "operator \"defined\" requires an identifier");
+
+			if (tok.type != TK_IDENT)
+				pp_error(start, "operator \"defined\" requires an identifier");
+
+			tok.value = (find_macro(tok.value) != NULL);
+			tok.type = TK_NUM;
+
+			if (paren) {
+				struct pp_token_t close;
+
+				if (!line_token(&close, &start, &len) || close.type != TK_RIGHT_PAREN)
+					pp_error(current_file()->p, "missing ')' after \"defined\"");
+			}
+		}
+
+		append_pp_token(&raw, &tok);
+	}
+
+	if (raw.len == 0)
+		pp_error(current_file()->p, "#if with no expression");
+
+	expand_list(raw.tokens, raw.len, &expanded);
+
+	eval.tokens = expanded.tokens;
+	eval.len = expanded.len;
+	eval.pos = 0;
+	eval.skip = 0;
+
+	result = (eval_expr(1) != 0);
+
+	if (eval.pos < eval.len)
+		pp_error(current_file()->p, "missing binary operator in #if expression");
+
+	free(raw.tokens);
+	free(expanded.tokens);
+
+	return result;
+}
+
+/**
+ * @brief 条件を積む
+ */
+static void push_cond(bool taken)
+{
+	if (cond_stack.len >= cond_stack.capacity)
+		grow_array(&cond_stack.conds, &cond_stack.capacity, sizeof(struct pp_cond_t), cond_stack.len + 1);
+
+	cond_stack.conds[cond_stack.len].taken = taken;
+	cond_stack.conds[cond_stack.len].else_seen = false;
+	cond_stack.len++;
+}
+
+/**
+ * @brief このファイルで開いた条件を返す
+ * @param[in] directive  指令の名前 (エラー表示用)
+ */
+static struct pp_cond_t *current_cond(const char *directive, const char *p)
+{
+	if (cond_stack.len <= current_file()->cond_base)
+		pp_error(p, "#%s without #if", directive);
+
+	return &cond_stack.conds[cond_stack.len - 1];
+}
+
+/**
+ * @brief 条件を閉じる
+ */
+static void pop_cond(void)
+{
+	struct pp_include_t *f = current_file();
+
+	cond_stack.len--;
+
+	/* 最初の #ifndef が閉じた */
+	if (f->guard_state == GUARD_INSIDE && cond_stack.len == f->cond_base)
+		f->guard_state = GUARD_CLOSED;
+}
+
+/**
+ * @brief #elif か #else で最初の #ifndef が分かれればガードではない
+ */
+static void branch_cond(void)
+{
+	struct pp_include_t *f = current_file();
+
+	if (f->guard_state == GUARD_INSIDE && cond_stack.len == f->cond_base + 1)
+		f->guard_state = GUARD_NONE;
+}
+
+/**
+ * @brief 行の残りを読み飛ばす
+ * @return 次の行の先頭
+ *
+ * 行の中で始まったコメントが改行をまたげば, コメントの後ろまで読み飛ばす.
+ */
+static const char *skip_line(const char *p)
+{
+	const char *nl, *c;
+
+	for (;;) {
+		nl = scan_newline(p);
+
+		if ((c = memmem(p, nl - p, "/*", 2)) == NULL)
+			return (*nl == '\0') ? nl : nl + 1;
+
+		if (*(p = scan_comment_end(c + 2)) == '\0')
+			return p;
+		p += 2;
+	}
+}
+
+/**
+ * @brief 空白とコメントを読み飛ばす
+ */
+static const char *skip_blank(const char *p)
+{
+	for (;;) {
+		p = scan_spaces(p);
+
+		if (p[0] == '/' && p[1] == '*') {
+			p = scan_comment_end(p + 2);
+
+			if (*p != '\0')
+				p += 2;
+			continue;
+		}
+
+		if (p[0] == '\\' && p[1] == '\n') {
+			p += 2;
+			continue;
+		}
+
+		return p;
+	}
+}
+
+/**
+ * @brief 取り込まないグループを読み飛ばす
+ *
+ * 行ごとに行頭が '#' かだけを見て, 入れ子の条件を数えながら対応する #elif, #else, #endif を探す.
+ * 読み飛ばす行は字句解析しない.
+ */
+static void skip_group(void)
+{
+	struct pp_include_t *f = current_file();
+	struct pp_cond_t *cond;
+	const char *p, *name;
+	size_t depth = 0, len;
+	bool newline;
+	int value;
+
+	/* 指令の行の残り */
+	p = skip_line(f->p);
+
+	for (;;) {
+		/* 行頭の空白とコメントの後ろは次の行の先頭か, 行の最初のトークン */
+		if (*(p = skip_blank(p)) == '\0') {
+			f->p = p;
+			pp_error(p, "unterminated conditional directive");
+		}
+
+		if (*p != '#') {
+			p = skip_line(p);
+			continue;
+		}
+
+		f->p = p + 1;
+		if (scan_pp_token(f->p, &name, &len, &value, &newline) == TK_EOF || newline) {
+			p = f->p;
+			continue;
+		}
+		f->p = name + len;
+
+		if (is_word(name, len, "if") || is_word(name, len, "ifdef") || is_word(name, len, "ifndef")) {
+			depth++;
+		} else if (is_word(name, len, "endif")) {
+			if (depth == 0) {
+				pop_cond();
+				skip_directive_line();
+				return;
+			}
+			depth--;
+		} else if (depth == 0 && is_word(name, len, "elif")) {
+			cond = current_cond("elif", name);
+			if (cond->else_seen)
+				pp_error(name, "#elif after #else");
+			branch_cond();
+
+			if (!cond->taken && eval_condition()) {
+				cond->taken = true;
+				return;
+			}
+		} else if (depth == 0 && is_word(name, len, "else")) {
+			cond = current_cond("else", name);
+			if (cond->else_seen)
+				pp_error(name, "#else after #else");
+			cond->else_seen = true;
+			branch_cond();
+
+			if (!cond->taken) {
+				cond->taken = true;
+				skip_directive_line();
+				return;
+			}
+		}
+
+		p = skip_line(f->p);
+	}
+}
+
+/**
+ * @brief 前処理指令を処理する
+ *
+ * 行頭の '#' は読んだ後である.
+ */
+static void do_directive(void)
+{
+	struct pp_include_t *f = current_file();
+	struct pp_token_t tok;
+	struct pp_cond_t *cond;
+	const char *name, *end;
+	guard_state_t guard_state = f->guard_state;
+	unsigned int id;
+	size_t len;
+	bool taken;
+
+	/* 空の指令 */
+	if (!line_token(&tok, &name, &len))
+		return;
+
+	/* ファイルの最初の #ifndef の中以外に指令があればガードではない */
+	f->guard_state = GUARD_NONE;
+	if (guard_state == GUARD_INSIDE)
+		f->guard_state = GUARD_INSIDE;
+
+	if (is_word(name, len, "include")) {
+		do_include();
+	} else if (is_word(name, len, "define")) {
+		do_define();
+	} else if (is_word(name, len, "undef")) {
+		id = expect_macro_name("undef");
+		if (find_macro(id) != NULL)
+			macro_table.macros[id].defined = false;
+		skip_directive_line();
+	} else if (is_word(name, len, "if")) {
+		taken = eval_condition();
+		push_cond(taken);
+		if (!taken)
+			skip_group();
+	} else if (is_word(name, len, "ifdef") || is_word(name, len, "ifndef")) {
+		id = expect_macro_name(is_word(name, len, "ifdef") ? "ifdef" : "ifndef");
+		taken = ((find_macro(id) != NULL) == is_word(name, len, "ifdef"));
+		skip_directive_line();
+
+		if (guard_state == GUARD_START && is_word(name, len, "ifndef")) {
+			f->guard_state = GUARD_INSIDE;
+			f->guard = id;
+		}
+
+		push_cond(taken);
+		if (!taken)
+			skip_group();
+	} else if (is_word(name, len, "elif") || is_word(name, len, "else")) {
+		/* 取り込んだグループの後の #elif, #else から #endif までは読み飛ばす */
+		cond = current_cond(is_word(name, len, "elif") ? "elif" : "else", name);
+		if (cond->else_seen)
+			pp_error(name, "#%.*s after #else", (int)len, name);
+		cond->else_seen = is_word(name, len, "else");
+		branch_cond();
+		skip_group();
+	} else if (is_word(name, len, "endif")) {
+		current_cond("endif", name);
+		pop_cond();
+		skip_directive_line();
+	} else if (is_word(name, len, "pragma")) {
+		if (line_token(&tok, &name, &len) && is_word(name, len, "once"))
+			f->file->once = true;
+		skip_directive_line();
+	} else if (is_word(name, len, "error")) {
+		end = skip_directive_line();
+		pp_error(name, "#error%.*s", (int)(end - name - len), name + len);
+	} else {
+		pp_error(name, "invalid preprocessing directive #%.*s", (int)len, name);
+	}
+
+}
+
+/**
+ * @brief ファイルから次のトークンを読み, 前処理指令を処理する
+ * @param[out] tok  トークン. ファイルを全て読み終えたらTK_EOF.
+ */
+static void read_file_token(struct pp_token_t *tok)
+{
+	struct pp_include_t *f;
+	token_type_t type;
+	const char *start;
+	size_t len;
+	bool newline;
+	int value;
+
+	for (;;) {
+		f = current_file();
+		type = scan_pp_token(f->p, &start, &len, &value, &newline);
+
+		if (newline)
+			f->bol = true;
+
+		if (type == TK_EOF) {
+			f->p = start;
+
+			if (cond_stack.len > f->cond_base)
+				pp_error(start, "unterminated conditional directive");
+
+			if (f->guard_state == GUARD_CLOSED)
+				f->file->guard = f->guard + 1;
+
+			if (include_stack.len > 1) {
+				include_stack.len--;
+				continue;
+			}
+			break;
+		}
+
+		if (type == TK_INVALID && *start == '#' && f->bol) {
+			f->p = start + 1;
+			do_directive();
+			continue;
+		}
+
+		if (type == TK_INVALID)
+			pp_error(start, "invalid character '%c'", *start);
+
+		/* ガードの外にトークンがあればガードではない */
+		if (f->guard_state != GUARD_INSIDE)
+			f->guard_state = GUARD_NONE;
+
+		f->p = start + len;
+		f->bol = false;
+		break;
+	}
+
+	tok->type = type;
+	tok->noexpand = false;
+	tok->offset = file_offset(f, start);
+	tok->value = value;
+}
+
+static bool next_token(struct pp_token_t *tok, size_t floor)
+{
+	struct pp_context_t *c;
+
+	while (context_stack.len > 0 && context_stack.len >= floor) {
+		c = &context_stack.contexts[context_stack.len - 1];
+
+		if (c->pos < c->end) {
+			*tok = (c->tokens != NULL) ? c->tokens[c->pos] : macro_bodies.tokens[c->pos];
+			c->pos++;
+
+			if (c->relocate)
+				tok->offset = c->offset;
+			return true;
+		}
+
+		pop_context();
+	}
+
+	if (floor > 0)
+		return false;
+
+	read_file_token(tok);
+
+	return true;
+}
+
+/**
+ * @brief 前処理してトークンストリームに全てのトークンを積む
+ */
+void preprocess(struct token_stream_t *ts, const struct source_t *src, const char **include_dirs,
+		size_t num_include_dirs)
+{
+	struct pp_file_t *main_file;
+	struct pp_token_t tok;
+
+	if (file_cache == NULL)
+		file_cache = new_dict();
+
+	search_dirs = include_dirs;
+	num_search_dirs = num_include_dirs;
+	defined_id = intern_id(intern("defined", strlen("defined")));
+
+	/* 入力はもう開いてあるのでキャッシュには写しを置く */
+	if ((main_file = calloc(1, sizeof(struct pp_file_t))) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+
+	main_file->path = intern(src->path, strlen(src->path));
+	main_file->dir = (src->path[0] == '<') ? "" : dir_name(main_file->path);
+	main_file->found = true;
+	main_file->src = *src;
+	register_source(main_file);
+	dict_append(file_cache, main_file->path, main_file);
+
+	init_token_stream(ts, src->buf);
+	ts->keep_all = true;
+
+	include_stack.len = 0;
+	cond_stack.len = 0;
+	push_file(main_file);
+
+	do {
+		expand_token(&tok, 0);
+		push_token(ts, tok.type, tok.offset, tok.value);
+	} while (tok.type != TK_EOF);
+
+	/* 積み終えたので字句解析はしない */
+	ts->p = src->buf + src->len;
+	ts->sources = sources.files;
+	ts->num_sources = sources.len;
+}
+
+/**
+ * @brief 依存するファイルを1つ書き出す
+ */
+static void write_dependency(FILE *fp, const char *path)
+{
+	const char *p;
+
+	fputc(' ', fp);
+
+	/* 空白はエスケープする */
+	for (p = path; *p != '\0'; p++) {
+		if (*p == ' ')
+			fputc('\\', fp);
+		fputc(*p, fp);
+	}
+}
+
+/**
+ * @brief 前処理で読み込んだファイルの依存関係をmakeの形式で書き出す
+ */
+void write_dependencies(FILE *fp, const char *target, const char *pch)
+{
+	size_t i;
+
+	fprintf(fp, "%s:", target);
+
+	for (i = 0; i < sources.len; i++)
+		write_dependency(fp, sources.files[i].path);
+
+	if (pch != NULL)
+		write_dependency(fp, pch);
+
+	fputc('\n', fp);
+}
+
+/**
+ * @brief 書き出すマクロ
+ */
+struct saved_macro_t {
+	uint32_t id;	      /**< 名前のintern_id() */
+	struct macro_t macro; /**< マクロ */
+};
+
+/**
+ * @brief マクロ表を書き出す
+ *
+ * 定義されているマクロと本体のトークンをそのまま書き出す. 本体のトークンの位置は展開するときに
+ * 呼び出した位置に置き換えるので, 書き出したファイルを読まなくても使える.
+ */
+size_t write_macros(FILE *fp)
+{
+	struct saved_macro_t saved;
+	uint64_t counts[2] = {0, macro_bodies.len};
+	size_t i;
+
+	for (i = 0; i < macro_table.len; i++)
+		if (macro_table.macros[i].defined)
+			counts[0]++;
+
+	fwrite(counts, sizeof(counts), 1, fp);
+
+	for (i = 0; i < macro_table.len; i++) {
+		if (!macro_table.macros[i].defined)
+			continue;
+
+		memset(&saved, 0, sizeof(saved));
+		saved.id = i;
+		saved.macro = macro_table.macros[i];
+		fwrite(&saved, sizeof(saved), 1, fp);
+	}
+
+	fwrite(macro_bodies.tokens, sizeof(struct pp_token_t), macro_bodies.len, fp);
+
+	return sizeof(counts) + sizeof(struct saved_macro_t) * counts[0] + sizeof(struct pp_token_t) * macro_bodies.len;
+}
+
+/**
+ * @brief write_macros()で書き出したマクロ表を読み込む
+ */
+int load_macros(const char *image, size_t size)
+{
+	const struct saved_macro_t *saved = (const struct saved_macro_t *)(image + sizeof(uint64_t) * 2);
+	struct macro_t *m;
+	uint64_t counts[2];
+	size_t i;
+
+	if (size < sizeof(counts))
+		return -1;
+	memcpy(counts, image, sizeof(counts));
+
+	if (counts[0] > (size - sizeof(counts)) / sizeof(struct saved_macro_t) ||
+	    counts[1] > (size - sizeof(counts) - sizeof(struct saved_macro_t) * counts[0]) / sizeof(struct pp_token_t))
+		return -1;
+
+	if (counts[1] > 0) {
+		grow_array(&macro_bodies.tokens, &macro_bodies.capacity, sizeof(struct pp_token_t), counts[1]);
+		memcpy(macro_bodies.tokens, &saved[counts[0]], sizeof(struct pp_token_t) * counts[1]);
+	}
+	macro_bodies.len = counts[1];
+
+	for (i = 0; i < counts[0]; i++) {
+		if (saved[i].macro.begin + saved[i].macro.len > macro_bodies.len)
+			return -1;
+
+		m = macro_entry(saved[i].id);
+		*m = saved[i].macro;
+		m->disabled = false;
+	}
+
+	return 0;
+}
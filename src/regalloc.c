@@ -14,46 +14,30 @@ static bool used_temp_regs[NUM_OF_TEMP_REGS];
 
 /**
  * @brief 割り当て可能なスクラッチレジスタを探す
- * @param[in] ir_reg   register
- * @param[in] reg_map  register map
+ * @return レジスタ
  */
-static int find_allocatable_reg(int ir_reg, int *reg_map)
+static int find_allocatable_reg(void)
 {
 	int i;
 
-	if (reg_map[ir_reg] != -2)
-		return reg_map[ir_reg];    // ?
-
 	for (i = 0; i < NUM_OF_TEMP_REGS; i++) {
 		if (!used_temp_regs[i]) {
 			used_temp_regs[i] = true;
-			reg_map[ir_reg] = i;
 			return i;
 		}
 	}
 
-	return -10; /* 割り当て不可 */
+	error_printf("too many values are live at once\n");
+	exit(1);
 }
 
 /**
- * @brief アーギュメントレジスタを指定して割り当てる
- *
- * @param[in] ir_reg   IR中のレジスタ番号
- * @param[in] reg_map  レジスタマップ
- * @param[in] arg      引数番号 (0オリジン)
- *
- * @return レジスタ
+ * @brief アーギュメントレジスタの番号を返す
+ * @param[in] arg  引数番号 (0オリジン)
  */
-static int allocate_argument_reg(int ir_reg, int *reg_map, int arg)
+static int argument_reg(int arg)
 {
-	int index = NUM_OF_TEMP_REGS - 1 - arg;
-	if (used_temp_regs[index])
-		return -10; /* 割り当て不可 */
-
-	used_temp_regs[index] = true;
-	reg_map[ir_reg] = index;
-
-	return index;
+	return NUM_OF_TEMP_REGS - 1 - arg;
 }
 
 /**
@@ -67,6 +51,11 @@ static void release_reg(int r)
 
 static bool (*using_regs)[NUM_OF_TEMP_REGS] = NULL;
 
+/**
+ * @brief 記録した使用中レジスタの数 (allocate_regs()ごとに0に戻す)
+ */
+static int num_using_regs = 0;
+
 /**
  * @brief 現在使用中のレジスタを記録する
  * @return 記録した配列のインデックス
@@ -74,22 +63,24 @@ static bool (*using_regs)[NUM_OF_TEMP_REGS] = NULL;
 static int record_using_regs(void)
 {
 	const size_t ALLOCATE_SIZE = 64;
-	static int index = 0;
 	static int size = 0;
 
 	if (using_regs == NULL) {
 		size = ALLOCATE_SIZE;
 		using_regs = (bool(*)[NUM_OF_TEMP_REGS])malloc(sizeof(bool) * NUM_OF_TEMP_REGS * size);
+		mem_stats.reg_snapshots_reserved = sizeof(bool) * NUM_OF_TEMP_REGS * size;
 	}
 
-	if (index >= size) {
+	if (num_using_regs >= size) {
 		size *= 2;
 		using_regs = (bool(*)[NUM_OF_TEMP_REGS])realloc(using_regs, sizeof(bool) * NUM_OF_TEMP_REGS * size);
+		mem_stats.reg_snapshots_reserved = sizeof(bool) * NUM_OF_TEMP_REGS * size;
 	}
 
-	memcpy(&using_regs[index++], used_temp_regs, sizeof(used_temp_regs));
+	memcpy(&using_regs[num_using_regs++], used_temp_regs, sizeof(used_temp_regs));
+	mem_stats.reg_snapshots++;
 
-	return (index - 1);
+	return (num_using_regs - 1);
 }
 
 /**
@@ -116,66 +107,114 @@ using_regs_list_t *get_using_regs(int index)
 
 /**
  * @brief allocate register
+ *
+ * IRは3番地形式で仮想レジスタには1度しか代入しないので, 最後に読まれた所でレジスタを解放する.
+ * 解放してから結果を割り当てるので, 結果はsrcと同じレジスタになることがある.
  */
-void allocate_regs(struct vector_t *irv)
+void allocate_regs(struct ir_list_t *irv)
 {
 	struct ir_t *ir;
-	int *reg_map = malloc(sizeof(int) * irv->len);
+	int *last_use = malloc(sizeof(int) * irv->regs * 2);
+	int *reg_map = last_use + irv->regs;
+	bool arg_regs[NUM_OF_TEMP_REGS] = {false}; /* IR_FUNC_ARGで値を入れたアーギュメントレジスタ */
+	bool dying[2];
 	unsigned int i;
+	int k, r;
+
+	if (last_use == NULL && irv->regs > 0) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
 
-	/* initialize */
-	for (i = 0; i < irv->len; i++)
-		reg_map[i] = -2;
+	/* 各仮想レジスタを最後に読むIR */
+	for (r = 0; r < irv->regs; r++)
+		last_use[r] = -1;
 
 	for (i = 0; i < irv->len; i++) {
-		ir = irv->data[i];
+		ir = &irv->data[i];
+		for (k = 0; k < 2; k++) {
+			if (ir->kind[k] == IR_OPERAND_REG)
+				last_use[ir->src[k]] = i;
+		}
+	}
 
-		if (ir->op == IR_IMM || ir->op == IR_LOADADDR)
-			ir->lhs = find_allocatable_reg(ir->lhs, reg_map);
+	/* 前のIRの列のレジスタと記録は, そのコード生成で使い終わっている */
+	memset(used_temp_regs, 0, sizeof(used_temp_regs));
+	num_using_regs = 0;
 
-		if (ir->op == IR_FUNC_ARG) {
-			ir->rhs = find_allocatable_reg(ir->rhs, reg_map);
-			ir->lhs = allocate_argument_reg(ir->rhs, reg_map, ir->lhs);
+	for (i = 0; i < irv->len; i++) {
+		ir = &irv->data[i];
+
+		for (k = 0; k < 2; k++) {
+			dying[k] = false;
+			if (ir->kind[k] == IR_OPERAND_REG) {
+				dying[k] = ((unsigned int)last_use[ir->src[k]] == i);
+				ir->src[k] = reg_map[ir->src[k]];
+			}
 		}
 
-		if (ir->op == IR_FUNC_PARAM) {
-			ir->rhs = allocate_argument_reg(ir->lhs + 1 /* 特殊 */, reg_map, ir->rhs);
-			ir->lhs = find_allocatable_reg(ir->lhs, reg_map);
+		/* 値を使うIRに値がなければ, IR生成の誤りなので止める */
+		if ((ir->op == IR_BEQZ && ir->kind[0] == IR_OPERAND_NONE) ||
+		    ((ir->op == IR_STORE || ir->op == IR_FUNC_ARG) && ir->kind[1] == IR_OPERAND_NONE)) {
+			error_printf("internal error: IR %u uses an expression without a value\n", i);
+			exit(1);
 		}
 
-		if (ir->op == IR_FUNC_CALL) {
-			ir->rhs = record_using_regs();
-			ir->lhs = find_allocatable_reg(ir->lhs, reg_map);
-		}
+		/* アドレス用のレジスタは格納する値と重ならないよう, 値を解放する前に選ぶ */
+		if (ir->op == IR_STORE || ir->op == IR_FUNC_PARAM) {
+			if (ir->op == IR_FUNC_PARAM)
+				used_temp_regs[argument_reg(ir->src[0])] = true;
+
+			ir->dst = find_allocatable_reg();
+			release_reg(ir->dst);
 
-		if (ir->op == IR_MOV || ir->op == IR_PLUS || ir->op == IR_MINUS || ir->op == IR_MUL ||
-		    ir->op == IR_DIV || ir->op == IR_MOD || ir->op == IR_EQ_OP || ir->op == IR_NE_OP ||
-		    ir->op == IR_SLT || ir->op == IR_SLET || ir->op == IR_LEFT_OP || ir->op == IR_RIGHT_OP ||
-		    ir->op == IR_AND || ir->op == IR_OR || ir->op == IR_XOR || ir->op == IR_LOAD) {
-			ir->lhs = find_allocatable_reg(ir->lhs, reg_map);
-			ir->rhs = find_allocatable_reg(ir->rhs, reg_map);
+			if (ir->op == IR_FUNC_PARAM)
+				release_reg(argument_reg(ir->src[0]));
 		}
 
-		if (ir->op == IR_STORE) {
-			ir->lhs = reg_map[ir->lhs];
-			ir->rhs = find_allocatable_reg(ir->rhs, reg_map);
+		for (k = 0; k < 2; k++) {
+			if (dying[k])
+				release_reg(ir->src[k]);
 		}
 
-		if (ir->op == IR_RETURN || ir->op == IR_BEQZ || ir->op == IR_NOT)
-			ir->lhs = reg_map[ir->lhs];
+		if (ir->op == IR_FUNC_ARG) {
+			r = argument_reg(ir->src[0]);
+			if (used_temp_regs[r]) {
+				error_printf("argument register %s is in use\n", get_temp_reg_str(r));
+				exit(1);
+			}
+
+			/* 呼び出しまで他の値を置かない */
+			used_temp_regs[r] = true;
+			arg_regs[r] = true;
+		}
 
-		if (ir->op == IR_KILL) {
-			release_reg(reg_map[ir->lhs]);
-			ir->op = IR_NOP;
+		if (ir->op == IR_FUNC_CALL) {
+			for (r = 0; r < NUM_OF_TEMP_REGS; r++) {
+				if (arg_regs[r])
+					release_reg(r);
+				arg_regs[r] = false;
+			}
+
+			/* ここで使用中のレジスタは呼び出しの後も生きている */
+			ir->kind[1] = IR_OPERAND_IMM;
+			ir->src[1] = record_using_regs();
 		}
 
-		if (ir->op == IR_KILL_ARG) {
-			release_reg(NUM_OF_TEMP_REGS - 1 - ir->lhs);
-			ir->op = IR_NOP;
+		if (ir->dst >= 0 && ir->op != IR_STORE && ir->op != IR_FUNC_PARAM) {
+			if (ir->op == IR_FUNC_CALL && last_use[ir->dst] < 0) {
+				ir->dst = -1; /* 戻り値を使わない */
+				continue;
+			}
+
+			r = ir->dst;
+			reg_map[r] = ir->dst = find_allocatable_reg();
+			if (last_use[r] < 0)
+				release_reg(ir->dst);
 		}
 	}
 
-	free(reg_map);
+	free(last_use);
 }
 
 /**
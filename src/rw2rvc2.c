@@ -1,6 +1,8 @@
+#include <errno.h>
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "rw2rvc2.h"
@@ -11,9 +13,137 @@
  */
 static void usage(char *prog)
 {
-	fprintf(stderr, "usage: %s [source file]  or  %s [code]\n\n", prog, prog);
+	fprintf(stderr, "usage: %s [source file]  or  %s -  or  %s [code]\n\n", prog, prog, prog);
 	fprintf(stderr, "  Options:\n"
-			"    -z  output debug info as comment\n");
+			"    -z  output debug info as comment\n"
+			"    -fparallel-lex  tokenize the whole input on multiple threads\n"
+			"    -fsyntax-only  check syntax and names only, and generate no code\n"
+			"    -fstream  compile one function at a time and emit global data at the end\n"
+			"    -fmem-report  print memory usage of each part of the compiler to stderr at exit\n"
+			"    -fpch-emit=file  write the parsed input to a precompiled header, and generate no code\n"
+			"    -fpch-use=file  load a precompiled header as if it were included before the input\n"
+			"    -I dir  add dir to the include search path\n"
+			"    -MD  write dependencies of the source file to <source basename>.d\n");
+}
+
+/**
+ * @brief 依存関係を <ソースのベース名>.d に書き出す
+ * @param[in] path  ソースファイルのパス
+ * @param[in] pch   読み込んだプリコンパイル済みヘッダーのパス (NULLならなし)
+ *
+ * ターゲットは出力するアセンブリの <ソースのベース名>.s とする.
+ */
+static void write_dependency_file(const char *path, const char *pch)
+{
+	const char *base = strrchr(path, '/');
+	const char *dot;
+	char *dep_path, *target;
+	size_t len;
+	FILE *fp;
+
+	base = (base == NULL) ? path : base + 1;
+	len = ((dot = strrchr(base, '.')) == NULL) ? strlen(base) : (size_t)(dot - base);
+
+	if ((dep_path = malloc(len + 3)) == NULL || (target = malloc(len + 3)) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+	sprintf(dep_path, "%.*s.d", (int)len, base);
+	sprintf(target, "%.*s.s", (int)len, base);
+
+	if ((fp = fopen(dep_path, "w")) == NULL) {
+		error_printf("%s: %s\n", dep_path, strerror(errno));
+		exit(1);
+	}
+
+	write_dependencies(fp, target, pch);
+	fclose(fp);
+
+	free(dep_path);
+	free(target);
+}
+
+/**
+ * @brief external_declarationを1つコンパイルする
+ * @param[in] node    external_declarationのノード
+ * @param[in] d       辞書
+ * @param[in] arena   IRを割り当てるアリーナ (コード生成の後で解放する)
+ * @param[in] dbgout  デバッグ情報の出力先 (NULLなら出力しない)
+ * @return 関数定義ならtrue (ノードはもう使わない), 変数の宣言ならfalse
+ */
+static bool compile_declaration(node_id_t node, struct dict_t *d, struct arena_t *arena, FILE *dbgout)
+{
+	struct ir_list_t *irv;
+
+	if (dbgout != NULL) {
+		fprintf(dbgout, ASM_COMMENTOUT_STR);
+		color_printf(dbgout, COL_YELLOW, "=====[node]=====\n");
+		show_node(dbgout, node, 0);
+	}
+
+	resolve_declaration(node, d);
+
+	/* 変数のデータは最後にまとめて生成する */
+	if (get_node(node)->type != ND_FUNC_DEF)
+		return false;
+
+	irv = gen_ir(node, arena);
+
+	if (dbgout != NULL) {
+		fprintf(dbgout, ASM_COMMENTOUT_STR);
+		color_printf(dbgout, COL_YELLOW, "=====[IR]=====\n");
+		show_ir(dbgout, irv);
+	}
+
+	allocate_regs(irv);
+
+	if (dbgout != NULL) {
+		fprintf(dbgout, ASM_COMMENTOUT_STR);
+		color_printf(dbgout, COL_YELLOW, "=====[IR]=====\n");
+		show_ir(dbgout, irv);
+	}
+
+	gen_riscv_text(irv);
+	arena_release(arena);
+
+	return true;
+}
+
+/**
+ * @brief external_declarationごとにコンパイルする
+ * @param[in] tokens  トークンストリーム
+ * @param[in] prefix  プリコンパイル済みヘッダーのND_PROGRAM (NODE_NULLならなし)
+ * @param[in] dbgout  デバッグ情報の出力先 (NULLなら出力しない)
+ *
+ * 関数定義は1つパースするたびにコードまで生成し, そのノードとIRを捨ててから次をパースする.
+ * 大域変数の宣言のノードは残しておき, データは最後にまとめて生成する.
+ * メモリの使用量はファイル全体ではなく, 最も大きい関数で決まる.
+ */
+static void compile_streaming(struct token_stream_t *tokens, node_id_t prefix, FILE *dbgout)
+{
+	static struct arena_t function_arena;
+	struct dict_t *d = new_dict();
+	struct node_mark_t mark;
+	node_id_t n;
+	size_t i;
+
+	resolve_names(NODE_NULL, d);
+
+	/* ヘッダーのノードは読み込んだ領域の一部なので捨てない */
+	for (i = 0; prefix != NODE_NULL && i < list_length(get_node(prefix)->list); i++)
+		compile_declaration(list_at(get_node(prefix)->list, i), d, &function_arena, dbgout);
+
+	for (;;) {
+		mark = node_mark();
+
+		if ((n = parse_next_declaration(tokens)) == NODE_NULL)
+			break;
+
+		if (compile_declaration(n, d, &function_arena, dbgout))
+			release_nodes(mark);
+	}
+
+	gen_riscv_data(d);
 }
 
 /**
@@ -21,26 +151,78 @@ static void usage(char *prog)
  */
 int main(int argc, char **argv)
 {
-	struct vector_t *tokens;
-	struct node_t *node = NULL;
+	struct token_stream_t tokens;
+	node_id_t node = NODE_NULL;
+	node_id_t prefix = NODE_NULL;
 	struct dict_t *d = NULL;
 
-	FILE *fp;
+	struct source_t src;
 	FILE *dbgout = stdout;
-	char *buf;
-	size_t s;
+	const char **include_dirs = NULL;
+	size_t num_include_dirs = 0, include_dirs_capacity = 0;
+	const char *pch_emit = NULL;
+	const char *pch_use = NULL;
 
 	int opt;
 	bool flag_debug = false;
+	bool flag_parallel_lex = false;
+	bool flag_syntax_only = false;
+	bool flag_stream = false;
+	bool flag_deps = false;
+	bool from_file = true;
+	bool preprocessed = false;
 
 	setvbuf(dbgout, NULL, _IONBF, 0);
 
 	/* オプションをパース */
-	while ((opt = getopt(argc, argv, "z")) != -1) {
+	while ((opt = getopt(argc, argv, "zf:I:M:")) != -1) {
 		switch (opt) {
 		case 'z':
 			flag_debug = true;
 			break;
+		case 'f':
+			if (strcmp(optarg, "parallel-lex") == 0) {
+				flag_parallel_lex = true;
+				break;
+			}
+			if (strcmp(optarg, "syntax-only") == 0) {
+				flag_syntax_only = true;
+				break;
+			}
+			if (strcmp(optarg, "stream") == 0) {
+				flag_stream = true;
+				break;
+			}
+			if (strcmp(optarg, "mem-report") == 0) {
+				atexit(print_mem_report);
+				break;
+			}
+			if (strncmp(optarg, "pch-emit=", strlen("pch-emit=")) == 0) {
+				pch_emit = optarg + strlen("pch-emit=");
+				break;
+			}
+			if (strncmp(optarg, "pch-use=", strlen("pch-use=")) == 0) {
+				pch_use = optarg + strlen("pch-use=");
+				break;
+			}
+			usage(argv[0]);
+			exit(1);
+			/* NOTREACHED */
+			break;
+		case 'I':
+			if (num_include_dirs >= include_dirs_capacity)
+				grow_array(&include_dirs, &include_dirs_capacity, sizeof(char *), num_include_dirs + 1);
+			include_dirs[num_include_dirs++] = optarg;
+			break;
+		case 'M':
+			if (strcmp(optarg, "D") == 0) {
+				flag_deps = true;
+				break;
+			}
+			usage(argv[0]);
+			exit(1);
+			/* NOTREACHED */
+			break;
 		case 'h':
 		default:
 			usage(argv[0]);
@@ -56,36 +238,75 @@ int main(int argc, char **argv)
 		/* NOTREACHED */
 	}
 
-	if ((fp = fopen(argv[optind], "rt")) == NULL) {
-		buf = argv[optind];
-	} else {
-		/* read file to buffer */
-		fseek(fp, 0, SEEK_END);
-		s = ftell(fp); /* ファイルサイズを取得 */
-		fseek(fp, 0, SEEK_SET);
-
-		if ((buf = malloc(s + 1)) == NULL) {
-			fprintf(dbgout, "memory allocation error\n");
-			return 3;
-		}
+	/* ヘッダーの識別子とノードの番号をそのまま使うので, 何よりも先に読み込む */
+	if (pch_use != NULL)
+		prefix = load_pch(pch_use);
 
-		if (fread(buf, 1, s, fp) != s) {
-			fprintf(dbgout, "file read error\n");
+	/*
+	 * ファイル ("-" は標準入力) を開く. パスとして存在しえないもの (見つからない, 長すぎる,
+	 * 途中がディレクトリでない) はソースコードそのものとして扱う.
+	 */
+	if (open_source(&src, argv[optind]) != 0) {
+		if (errno != ENOENT && errno != ENAMETOOLONG && errno != ENOTDIR) {
+			error_printf("%s: %s\n", argv[optind], strerror(errno));
 			return 4;
 		}
-		buf[s] = 0;
+		string_source(&src, argv[optind]);
+		from_file = false;
+	}
+
+	if (flag_deps && (!from_file || strcmp(argv[optind], "-") == 0)) {
+		error_printf("-MD needs a source file\n");
+		return 1;
 	}
 
-	/* tokenize */
-	tokens = tokenize(buf);
+	/*
+	 * '#' があるときと, ヘッダーのマクロを使うときだけ前処理して全てのトークンを積む.
+	 * それ以外のトークンはパーサーが必要とした時点で字句解析する. 並列時は先に全て字句解析する.
+	 */
+	if (flag_deps || pch_use != NULL || memchr(src.buf, '#', src.len) != NULL) {
+		preprocess(&tokens, &src, include_dirs, num_include_dirs);
+		preprocessed = true;
+
+		/* 依存関係は前処理で読み込んだファイルとプリコンパイル済みヘッダーから作る */
+		if (flag_deps)
+			write_dependency_file(src.path, pch_use);
+	} else if (flag_parallel_lex)
+		tokenize_parallel(&tokens, src.buf, 0);
+	else
+		init_token_stream(&tokens, src.buf);
 
 	if (flag_debug) {
+		struct token_stream_t all;
+
 		fprintf(dbgout, ASM_COMMENTOUT_STR);
 		color_printf(dbgout, COL_YELLOW, "=====[token]=====\n");
-		show_token(dbgout, tokens);
+		if (preprocessed) {
+			show_token(dbgout, &tokens);
+		} else {
+			tokenize(&all, src.buf);
+			show_token(dbgout, &all);
+			release_token_stream(&all);
+		}
+	}
+
+	/* コードを生成するときだけ, 関数ごとにパースしながらコンパイルする */
+	if (flag_stream && !flag_syntax_only && pch_emit == NULL) {
+		compile_streaming(&tokens, prefix, flag_debug ? dbgout : NULL);
+		release_token_stream(&tokens);
+
+		fflush(stdout);
+		arena_release(&session_arena);
+		close_source(&src);
+
+		return 0;
 	}
 
-	node = parse(tokens);
+	node = parse(&tokens);
+	release_token_stream(&tokens);
+
+	/* プリコンパイル済みヘッダーの宣言は入力の前に置く */
+	node = concat_programs(prefix, node);
 
 	if (flag_debug) {
 		fprintf(dbgout, ASM_COMMENTOUT_STR);
@@ -93,8 +314,27 @@ int main(int argc, char **argv)
 		show_node(dbgout, node, 0);
 	}
 
+	if (pch_emit != NULL) {
+		resolve_names(node, NULL);
+		if (write_pch(pch_emit, node) != 0) {
+			error_printf("%s: %s\n", pch_emit, strerror(errno));
+			return 4;
+		}
+		close_source(&src);
+		return 0;
+	}
+
+	/* 構文の確認だけなら辞書もつくらない */
+	if (flag_syntax_only) {
+		resolve_names(node, NULL);
+		close_source(&src);
+		return 0;
+	}
+
 	d = new_dict();
-	struct vector_t *irv = gen_ir(node, d);
+	resolve_names(node, d);
+
+	struct ir_list_t *irv = gen_ir(node, &session_arena);
 
 	if (flag_debug) {
 		fprintf(dbgout, ASM_COMMENTOUT_STR);
@@ -113,6 +353,8 @@ int main(int argc, char **argv)
 	gen_riscv(irv, d);
 
 	fflush(stdout);
+	arena_release(&session_arena);
+	close_source(&src);
 
 	return 0;
 }
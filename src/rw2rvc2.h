@@ -3,6 +3,9 @@
  */
 #if !defined(RW2RVC2_H_INCLUDED)
 #define RW2RVC2_H_INCLUDED
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -10,30 +13,57 @@
 
 #define ASM_COMMENTOUT_STR	"# "
 
-/**
- * @brief ベクター タイプ
- */
-struct vector_t {
-	void **data;		/**< データポインタ(void*)へのポインタ */
-	size_t capacity;	/**< ベクターの容量  */
-	size_t len;		/**< ベクターの現在の長さ */
-};
-
 /**
  * @brief 辞書要素用 構造体
  */
 struct dict_element_t {
-	char *key;	/**< キー */
+	const char *key;	/**< キー (intern()された文字列) */
 	void *value;	/**< 値 */
 };
 
 /**
  * @brief 辞書用 構造体
+ *
+ * 要素は追加した順にdictに並べ, キーからはオープンアドレス法のハッシュ表indexで引く.
  */
 struct dict_t {
 	struct dict_element_t *dict;	/**< 辞書要素へのポインタ */
 	size_t len;			/**< 辞書の現在の長さ */
 	size_t capacity;		/**< ベクターの容量 */
+	uint32_t *index;		/**< キーごとに最後に追加した要素の添字+1 (容量はcapacityの2倍) */
+};
+
+/**
+ * @brief バンプポインタ方式のアリーナ
+ */
+struct arena_t {
+	struct arena_chunk_t *chunk;	/**< 使用中のチャンク (前に確保したチャンクへつながる) */
+	char *ptr;			/**< 次に割り当てる位置 */
+	char *end;			/**< 使用中のチャンクの終わり */
+	struct arena_block_t *blocks;	/**< arena_resize()したブロック */
+};
+
+/**
+ * @brief ソース入力
+ */
+struct source_t {
+	const char *path;	/**< 入力元の名前 */
+	const char *buf;	/**< 入力文字列 (NUL終端) */
+	size_t len;		/**< 入力文字列の長さ */
+	size_t map_size;	/**< mmapした領域のサイズ (mmapしていなければ0) */
+	bool allocated;		/**< bufをmalloc()したかどうか */
+};
+
+/**
+ * @brief トークンストリーム中のファイル
+ *
+ * 前処理したストリームは複数のファイルのトークンを持つので, オフセットはファイルごとに
+ * baseだけずらした通し番号にする.
+ */
+struct token_source_t {
+	const char *path;	/**< ファイルパス */
+	const char *buf;	/**< 入力文字列 (NUL終端) */
+	uint32_t base;		/**< このファイルの先頭のオフセット */
 };
 
 /**
@@ -91,24 +121,54 @@ typedef enum {
 } token_type_t;
 
 /**
- * @brief トークン
+ * @brief トークンストリーム
+ *
+ * パーサーが要求した時点で字句解析し, 先読みと巻き戻しに必要な分だけをリングバッファに保持する.
+ * トークンの位置は先頭からの通し番号で表す.
+ *
+ * トークンは構造体の配列ではなく, 種別・入力中のオフセット・値を別々の配列に持つ.
+ * パーサーが最もよく見る種別は1トークン1バイトで並ぶ.
  */
-struct token_t {
-	token_type_t type;	/**< タイプ */
-	int value;		/**< 値  */
-	char *input;		/**< 入力文字列 */
-	char *name;		/**< 識別子等の名前 */
-	int line;		/**< 行番号 */
-	int position;		/**< その行での位置 */
+struct token_stream_t {
+	const char *src;	/**< 入力文字列の先頭 (オフセットの基準) */
+	const char *p;		/**< 次に字句解析する位置 */
+	unsigned char *types;	/**< トークンタイプ (token_type_t) */
+	uint32_t *offsets;	/**< 入力文字列の先頭からのオフセット */
+	int *values;		/**< 数値の値, 識別子のintern_id(), 予約語の表の位置 */
+	size_t mask;		/**< リングバッファの容量 - 1 (容量は2の冪) */
+	size_t head;		/**< 保持している最も古いトークンの番号 */
+	size_t tail;		/**< 次に字句解析するトークンの番号 */
+	size_t pos;		/**< パーサーの現在位置 */
+	size_t marks;		/**< 有効なマークの数 */
+	size_t mark_base;	/**< 最も古いマークの位置 */
+	bool keep_all;		/**< トークンを捨てずに全て保持する */
+	uint32_t *line_starts;	/**< 各行の先頭のオフセット (診断を表示するときに作る) */
+	size_t num_lines;	/**< line_startsの要素数 */
+	const struct token_source_t *sources;	/**< ファイルの表 (baseの昇順. 前処理しなければNULL) */
+	size_t num_sources;	/**< sourcesの要素数 */
 };
 
+/**
+ * @brief ノードアリーナ中のノードの添字 (0はノードなし)
+ */
+typedef uint32_t node_id_t;
+
+/**
+ * @brief ノードアリーナ中の子リストの位置 (0は空のリスト)
+ */
+typedef uint32_t list_id_t;
+
+#define NODE_NULL	0
+
 /**
  * @brief 変数
  */
 struct variable_t {
-	struct node_t *node;		/**< ノード */
+	node_id_t      node;		/**< 宣言子のノード */
 	int            scope_level;	/**< スコープレベル (0: グローバル) */
 	size_t         offset;		/**< フレームポインタからのオフセット */
+	struct variable_t *shadowed;	/**< 外側のスコープにある同じ名前の変数 */
+	unsigned int   label;		/**< 置き場所のラベル (intern_id()). 大域変数は名前そのもの */
 };
 
 /**
@@ -154,70 +214,185 @@ typedef enum {
 
 /**
  * @brief ノード構造体
+ *
+ * タイプと3語分の中身だけを持つ16バイトの構造体. 子はポインタではなくノードアリーナの添字で指し,
+ * 中身の意味はタイプごとに決まっている.
+ *
+ *   - 二項演算子, ND_ASSIGN, ND_VAR_DEC(_STATIC), ND_FUNC_DEF, ND_FUNC_PARAM: lhs, rhs
+ *   - 単項の '+' '-': rhs (lhsはNODE_NULL)
+ *   - ND_CONST: value
+ *   - ND_IDENT: name, parameter_list (関数の宣言子), rhs (初期化子)
+ *   - ND_TYPE: name, lhs (関数定義の宣言子)
+ *   - ND_IF: condition, consequence, alternative
+ *   - ND_RETURN, ND_EXPRESSION: expression
+ *   - ND_PROGRAM, ND_COMPOUND_STATEMENTS, ND_VAR_INIT_DLIST: list
+ *   - ND_FUNC_CALL: lhs (呼び出す式), list (ND_FUNC_ARGのリスト)
+ *   - ND_FUNC_ARG: lhs, value (引数の番号)
  */
 typedef struct node_t {
-	node_type_t type;			/**< タイプ (ND_XXXX) */
-	struct node_t *lhs;			/**< 左辺値 */
-	struct node_t *rhs;			/**< 右辺値 */
-	struct node_t *condition;		/**< 条件 */
-	struct node_t *consequence;		/**< consequence */
-	struct node_t *alternative;		/**< alternative */
-	struct node_t *expression;		/**< 式 (return, ...)*/
-	struct vector_t *list;			/**< リスト */
-	struct vector_t *parameter_list;	/**< パラメーターリスト */
-	struct vector_t *argument_list;		/**< 引数リスト */
-	char *name;				/**< 識別子等の名前 */
-	int value;				/**< 値 */
+	int8_t type;					/**< タイプ (node_type_t) */
+	union {
+		struct {
+			node_id_t lhs;			/**< 左辺値 */
+			node_id_t rhs;			/**< 右辺値 */
+			union {
+				int value;		/**< 値 */
+				unsigned int name;	/**< 識別子等の名前 (intern_id()) */
+				list_id_t list;		/**< リスト */
+			};
+		};
+		struct {
+			node_id_t condition;		/**< 条件 */
+			node_id_t consequence;		/**< consequence */
+			node_id_t alternative;		/**< alternative */
+		};
+		node_id_t expression;			/**< 式 (return, ...)*/
+		list_id_t parameter_list;		/**< パラメーターリスト */
+	};
 } node_t;
 
+/**
+ * @brief ノードアリーナ
+ *
+ * ノードは1つの配列に連続して置く. 可変長の子リストはlistsに "要素数, 子の添字..." の順で
+ * 連続して置き, その先頭の位置 (list_id_t) で指す. どちらも添字0は空けておく.
+ */
+struct node_arena_t {
+	struct node_t *nodes;	/**< ノードの配列 */
+	size_t len;		/**< nodesの使用数 */
+	size_t capacity;	/**< nodesの容量 */
+	node_id_t *lists;	/**< 子リストの配列 */
+	size_t lists_len;	/**< listsの使用数 */
+	size_t lists_capacity;	/**< listsの容量 */
+	node_id_t *scratch;	/**< 作成中の子リストを積むスタック */
+	size_t scratch_len;	/**< scratchの使用数 */
+	size_t scratch_capacity; /**< scratchの容量 */
+};
+
+extern struct node_arena_t node_arena;
+
+/**
+ * @brief ノードアリーナの使用位置
+ */
+struct node_mark_t {
+	size_t len;		/**< nodesの使用数 */
+	size_t lists_len;	/**< listsの使用数 */
+};
+
+/**
+ * @brief インクリメンタルパースの区間
+ *
+ * 入力を external_declaration ごとに区切ったもの. 区間の先頭のトークンから次の区間の
+ * 先頭のトークンの直前までを持ち, 区間をつなげると入力全体になる.
+ */
+struct parse_segment_t {
+	char *text;		/**< 区間の入力文字列 (NUL終端) */
+	size_t len;		/**< textの長さ */
+	node_id_t node;		/**< パース結果のノード (空白だけ, もしくはエラーならNODE_NULL) */
+	bool error;		/**< パースできなかったか */
+};
+
+/**
+ * @brief インクリメンタルパーサー
+ *
+ * 最後にパースし直した区間のノードはアリーナの末尾にあるので, 次の編集でそれらを全て置き換えるなら
+ * アリーナを巻き戻して使い回す. 別の区間を編集すると置き換えられたノードはアリーナに残る.
+ */
+struct incremental_parser_t {
+	struct parse_segment_t *segments;	/**< 区間の配列 */
+	size_t num_segments;			/**< 区間の数 */
+	size_t capacity;			/**< segmentsの容量 */
+	size_t len;				/**< 入力全体の長さ */
+	size_t num_errors;			/**< パースできなかった区間の数 */
+	node_id_t program;			/**< ND_PROGRAM. パースできた区間のノードを順に持つ. */
+	size_t cursor;				/**< 最後に編集した区間 */
+	size_t cursor_offset;			/**< cursorの区間の入力中のオフセット */
+	size_t cursor_nodes;			/**< cursorより前の区間が持つノードの数 */
+	struct node_mark_t base;		/**< 初期化した時点のノードアリーナの使用位置 */
+	struct node_mark_t tail;		/**< 最後にパースし直す前の使用位置 */
+	struct node_mark_t tail_end;		/**< 最後にパースし直した後の使用位置 */
+	size_t tail_first;			/**< tailからtail_endのノードを持つ最初の区間 */
+	size_t tail_count;			/**< その区間の数 (0なら巻き戻せない) */
+};
+
 /**
  * @brief 中間表現(IR)タイプ
+ *
+ * 3番地形式で, 演算は結果をdstに置きsrcは書き換えない.
  */
 typedef enum {
-	IR_PLUS,		/**< 加算: lhs + rhs */
-	IR_MINUS,		/**< 減算: lhs - rhs */
-	IR_MUL,			/**< 乗算: lhs * rhs*/
-	IR_DIV,			/**< 除算: lhs / rhs */
-	IR_MOD,			/**< 剰余: lhs % rhs */
-	IR_AND,			/**< 論理積: lhs & rhs */
-	IR_OR,			/**< 論理和: lhs | rhs  */
-	IR_NOT,			/**< 論理否定: ~lhs  */
-	IR_XOR,			/**< 排他的論理和: lhs ^ rhs  */
-	IR_EQ_OP,		/**< 等号: lhs == rhs  */
-	IR_NE_OP,		/**< 否定等号: lhs != rhs */
-	IR_SLT,			/**< 不等号: lhs < rhs */
-	IR_SLET,		/**< 不等号: lhs <= rhs */
-	IR_LEFT_OP,		/**< 不等号: lhs << rhs */
-	IR_RIGHT_OP,		/**< 不等号: lhs >> rhs */
-	IR_RETURN,		/**< return */
-	IR_IMM,
-	IR_MOV,
-	IR_KILL,
-	IR_KILL_ARG,		/**< アーギュメントレジスタを解放する */
-	IR_LOAD,
-	IR_STORE,
-	IR_LOADADDR,
-	IR_BEQZ,		/**< lhs がゼロならブランチする */
-	IR_JUMP,		/**< ジャンプする */
-	IR_LABEL,		/**< ラベルを生成 */
-	IR_FUNC_DEF,		/**< 関数定義 */
-	IR_FUNC_CALL,		/**< 関数呼び出し */
-	IR_FUNC_END,		/**< 関数定義終端 */
-	IR_FUNC_ARG,		/**< 関数引数 */
-	IR_FUNC_PARAM,		/**< 関数パラメータ */
-	IR_NOP,
+	IR_PLUS,		/**< 加算: dst = src1 + src2 */
+	IR_MINUS,		/**< 減算: dst = src1 - src2 */
+	IR_MUL,			/**< 乗算: dst = src1 * src2 */
+	IR_DIV,			/**< 除算: dst = src1 / src2 */
+	IR_MOD,			/**< 剰余: dst = src1 % src2 */
+	IR_AND,			/**< 論理積: dst = src1 & src2 */
+	IR_OR,			/**< 論理和: dst = src1 | src2 */
+	IR_NOT,			/**< 論理否定: dst = ~src1 */
+	IR_XOR,			/**< 排他的論理和: dst = src1 ^ src2 */
+	IR_SLT,			/**< 不等号: dst = src1 < src2 */
+	IR_SLET,		/**< 不等号: dst = src1 >= src2 */
+	IR_LEFT_OP,		/**< 左シフト: dst = src1 << src2 */
+	IR_RIGHT_OP,		/**< 右シフト: dst = src1 >> src2 */
+	IR_RETURN,		/**< src1 (なければなし) を返す */
+	IR_MOV,			/**< dst = src1 */
+	IR_LOAD,		/**< dst = 名前src1の変数 */
+	IR_STORE,		/**< 名前src1の変数 = src2 (dstはアドレス用にregallocが割り当てる) */
+	IR_BEQZ,		/**< src1 がゼロならラベルsrc2へブランチする */
+	IR_JUMP,		/**< ラベルsrc1へジャンプする */
+	IR_LABEL,		/**< ラベルsrc1を生成 */
+	IR_FUNC_DEF,		/**< 関数src1の定義 */
+	IR_FUNC_CALL,		/**< dst = 関数src1の呼び出し (src2はregallocが記録した使用中レジスタ) */
+	IR_FUNC_END,		/**< 関数src1の定義終端 */
+	IR_FUNC_ARG,		/**< src1番目の引数 = src2 */
+	IR_FUNC_PARAM,		/**< 名前src2の仮引数 = src1番目の引数 (dstはIR_STOREと同じ) */
 } ir_type_t;
 
+/**
+ * @brief IRのオペランドの種類
+ */
+typedef enum {
+	IR_OPERAND_NONE,	/**< なし */
+	IR_OPERAND_REG,		/**< レジスタ (割り当て前は仮想レジスタ, 後はTEMP_REGSの番号) */
+	IR_OPERAND_IMM,		/**< 即値 */
+	IR_OPERAND_SYM,		/**< 名前のintern_id() */
+	IR_OPERAND_LABEL,	/**< ラベルの番号 */
+} ir_operand_kind_t;
+
+/**
+ * @brief IRのオペランド
+ */
+struct ir_operand_t {
+	ir_operand_kind_t kind;	/**< 種類 */
+	int value;		/**< レジスタ, 即値, intern_id() またはラベルの番号 */
+};
+
 /**
  * @brief Intermediate Representation
+ *
+ * dst = op src1, src2 の形で, 1命令を16バイトに収める. dstは常にレジスタ (なければ-1) で,
+ * srcの種類はkindに持つ.
  */
 typedef struct ir_t {
-	ir_type_t op;
-	int lhs;
-	int rhs;
-	char *name;
+	uint8_t op;		/**< ir_type_t */
+	uint8_t kind[2];	/**< src[]の種類 (ir_operand_kind_t) */
+	int dst;		/**< 結果のレジスタ */
+	int src[2];		/**< src1, src2 */
 } ir_t;
 
+/**
+ * @brief IRの列
+ *
+ * gen_ir()1回分のIRを1つの配列に連続して置き, パスは添字で先頭から順に辿る.
+ */
+struct ir_list_t {
+	struct ir_t *data;	/**< IRの配列 (arenaにつないだブロック) */
+	size_t len;		/**< IRの数 */
+	size_t capacity;	/**< dataの容量 */
+	int regs;		/**< 使った仮想レジスタの数 */
+	struct arena_t *arena;	/**< 割り当てたアリーナ */
+};
+
 /**
  * @brief 表示色
  */
@@ -233,26 +408,458 @@ typedef enum {
 /**
  * @brief パーサーのメイン関数
  *
- * @param tokens  トークンベクタ
+ * @param tokens  トークンストリーム
  * @return パース結果のノード
  */
-struct node_t *parse(struct vector_t *tokens);
+node_id_t parse(struct token_stream_t *tokens);
+
+/**
+ * @brief translation_unitのexternal_declarationを1つずつパースする
+ * @param[in] tokens  トークンストリーム
+ * @return パースしたexternal_declaration. 終わりならNODE_NULL.
+ * @note parse()と同じく, 1つもなければエラーを表示して終了する. ND_PROGRAMはつくらない.
+ */
+node_id_t parse_next_declaration(struct token_stream_t *tokens);
+
+/**
+ * @brief external_declarationを1つパースする
+ * @param[in]  tokens  トークンストリーム
+ * @param[out] node    パース結果のノード. external_declarationでなければNODE_NULL.
+ * @return 成功したら0, 字句解析かパースのエラーなら-1
+ * @note エラーは表示も終了もしない. 成功したときは次のトークンまで字句解析しておく.
+ */
+int parse_external_declaration(struct token_stream_t *tokens, node_id_t *node);
+
+/**
+ * @brief 構文エラーからの復帰先
+ * @note NULLでなければ, 字句解析とパースのエラーは表示せずにここへlongjmp()する.
+ */
+extern jmp_buf *syntax_error_jmp;
+
+/* ast.c */
+/**
+ * @brief 新規ノードをつくる
+ * @param[in] type  ノードの種類
+ * @param[in] lhs   左辺
+ * @param[in] rhs   右辺
+ * @return 作成したノード. 3語目はvalue = -1で初期化する.
+ * @note ノードアリーナを拡大することがあるので, get_node()で得たポインタはこの呼び出しで無効になる.
+ */
+node_id_t new_node(node_type_t type, node_id_t lhs, node_id_t rhs);
+
+/**
+ * @brief 子リストの作成を始める
+ * @return list_end()に渡す位置
+ * @note 入れ子にでき, list_end()で後に始めたものから終える.
+ */
+size_t list_begin(void);
+
+/**
+ * @brief ノードアリーナの使用位置を取得する
+ * @return 現在の使用位置
+ */
+struct node_mark_t node_mark(void);
+
+/**
+ * @brief ノードアリーナを使用位置まで戻し, その後につくったノードと子リストを捨てる
+ * @param[in] mark  node_mark()の戻り値
+ * @note 捨てたノードを指す添字は無効になる. 容量は減らさずに次のノードで使い回す.
+ */
+void release_nodes(struct node_mark_t mark);
+
+/**
+ * @brief 作成中の子リストに子を足す
+ * @param[in] child  子のノード
+ */
+void list_push(node_id_t child);
+
+/**
+ * @brief 子リストの作成を終え, ノードアリーナに連続して置く
+ * @param[in] mark  list_begin()の戻り値
+ * @return 作成したリスト. 子がなければ0.
+ */
+list_id_t list_end(size_t mark);
+
+/**
+ * @brief 2つのND_PROGRAMの子リストをつなげる
+ * @param[in] first   前に置くND_PROGRAM (NODE_NULLなら空)
+ * @param[in] second  後ろに置くND_PROGRAM (NODE_NULLなら空)
+ * @return 新しいND_PROGRAM. 片方が空ならもう片方.
+ */
+node_id_t concat_programs(node_id_t first, node_id_t second);
+
+/**
+ * @brief 空のノードアリーナに保存したノードと子リストを読み込む
+ * @param[in] nodes      ノードの配列 (添字0を含む)
+ * @param[in] len        nodesの要素数
+ * @param[in] lists      子リストの配列 (添字0を含む)
+ * @param[in] lists_len  listsの要素数
+ * @note 添字は保存したときのまま使える.
+ */
+void load_node_arena(const struct node_t *nodes, size_t len, const node_id_t *lists, size_t lists_len);
+
+/**
+ * @brief ノードの名前を取得する
+ * @param[in] id  ノード
+ * @return ND_IDENT, ND_TYPEなら名前, ND_FUNC_CALLなら呼び出す関数の名前, それ以外はNULL
+ */
+const char *node_name(node_id_t id);
+
+/**
+ * @brief ノードを参照する
+ * @param[in] id  ノード (NODE_NULLは不可)
+ * @return ノードへのポインタ
+ */
+static inline struct node_t *get_node(node_id_t id)
+{
+	return &node_arena.nodes[id];
+}
+
+/**
+ * @brief 子リストの長さを取得する
+ * @param[in] list  子リスト
+ * @return 子の数
+ */
+static inline size_t list_length(list_id_t list)
+{
+	return node_arena.lists[list];
+}
+
+/**
+ * @brief 子リストのi番目の子を取得する
+ * @param[in] list  子リスト
+ * @param[in] i     添字
+ * @return 子のノード
+ */
+static inline node_id_t list_at(list_id_t list, size_t i)
+{
+	return node_arena.lists[list + 1 + i];
+}
+
+/**
+ * @brief 子リストのi番目の子を差し替える
+ * @param[in] list   子リスト
+ * @param[in] i      添字
+ * @param[in] child  新しい子のノード
+ */
+static inline void list_set(list_id_t list, size_t i, node_id_t child)
+{
+	node_arena.lists[list + 1 + i] = child;
+}
+
+/* incremental.c */
+/**
+ * @brief インクリメンタルパーサーを初期化し, 入力全体をパースする
+ * @param[out] ip    インクリメンタルパーサー
+ * @param[in]  code  入力文字列 (コピーして保持する)
+ * @return 全体をパースできたら0, できなかった区間があれば-1
+ */
+int init_incremental_parser(struct incremental_parser_t *ip, const char *code);
+
+/**
+ * @brief 入力を編集し, 影響を受けるexternal_declarationだけをパースし直す
+ * @param[in,out] ip     インクリメンタルパーサー
+ * @param[in]     begin  置き換える範囲の先頭のオフセット
+ * @param[in]     end    置き換える範囲の終端のオフセット (この位置は含まない)
+ * @param[in]     text   置き換える文字列
+ * @param[in]     len    textの長さ
+ * @return 全体をパースできたら0, できなかった区間があれば-1
+ * @note パースし直した区間のノードはip->programの子リストに差し替える.
+ */
+int reparse_edit(struct incremental_parser_t *ip, size_t begin, size_t end, const char *text, size_t len);
+
+/**
+ * @brief インクリメンタルパーサーを解放する
+ * @param[in] ip  インクリメンタルパーサー
+ * @note パーサーのノードがアリーナの末尾にあれば, 初期化した時点まで巻き戻して捨てる.
+ *       後から別のノードをつくっていれば, ノードはアリーナに残る.
+ */
+void release_incremental_parser(struct incremental_parser_t *ip);
+
+/* token.c */
+/**
+ * @brief 入力をEOFまで字句解析する
+ * @param[out] ts  トークンストリーム
+ * @param[in]  p   入力文字列へのポインタ
+ * @note 全てのトークンを ts->types[0] から ts->types[ts->tail - 1] に保持する.
+ *       デバッグ表示用. パーサーは必要な分だけ字句解析する.
+ */
+void tokenize(struct token_stream_t *ts, const char *p);
+
+/**
+ * @brief 入力をEOFまで複数スレッドで字句解析する
+ * @param[out] ts           トークンストリーム
+ * @param[in]  p            入力文字列へのポインタ
+ * @param[in]  num_threads  スレッド数 (0以下ならオンラインのCPU数)
+ * @note 結果はtokenize()と同じ. 入力が小さければtokenize()で済ませる.
+ */
+void tokenize_parallel(struct token_stream_t *ts, const char *p, int num_threads);
+
+/**
+ * @brief トークンストリームを初期化する
+ * @param[out] ts  トークンストリーム
+ * @param[in]  p   入力文字列へのポインタ
+ */
+void init_token_stream(struct token_stream_t *ts, const char *p);
+
+/**
+ * @brief トークンストリームのバッファを解放する
+ * @param[in] ts  トークンストリーム
+ */
+void release_token_stream(struct token_stream_t *ts);
+
+/**
+ * @brief 現在位置まで字句解析する
+ * @param[in] ts  トークンストリーム
+ * @note peek_token()から呼ばれる.
+ */
+void fill_token(struct token_stream_t *ts);
 
 /**
- * @brief tokenizer
- * @param[in] p  input stream
+ * @brief 現在位置のトークンタイプを参照する
+ * @param[in] ts  トークンストリーム
+ * @return トークンタイプ
  */
-struct vector_t *tokenize(char *p);
+static inline token_type_t peek_token(struct token_stream_t *ts)
+{
+	if (ts->pos >= ts->tail)
+		fill_token(ts);
+
+	return (token_type_t)ts->types[ts->pos & ts->mask];
+}
+
+/**
+ * @brief 現在位置を次のトークンに進める
+ * @param[in] ts  トークンストリーム
+ */
+static inline void advance_token(struct token_stream_t *ts)
+{
+	peek_token(ts);
+	ts->pos++;
+}
+
+/**
+ * @brief 現在位置の数値トークンの値を取得する
+ * @param[in] ts  トークンストリーム
+ * @return 値
+ */
+static inline int token_value(struct token_stream_t *ts)
+{
+	peek_token(ts);
+
+	return ts->values[ts->pos & ts->mask];
+}
+
+/**
+ * @brief 現在位置の識別子・予約語の名前を取得する
+ * @param[in] ts  トークンストリーム
+ * @return intern()された名前
+ */
+const char *token_name(struct token_stream_t *ts);
+
+/**
+ * @brief 現在位置のトークンの入力文字列を取得する
+ * @param[in] ts  トークンストリーム
+ * @return 入力文字列へのポインタ. EOFなら "EOF".
+ */
+const char *token_input(struct token_stream_t *ts);
+
+/**
+ * @brief 現在位置のトークンの行番号と行内の位置を取得する
+ * @param[in]  ts      トークンストリーム
+ * @param[out] line    行番号 (1オリジン)
+ * @param[out] column  行頭からのバイト数
+ * @note 初回の呼び出しで行頭の表を作る. エラー表示用.
+ */
+void token_location(struct token_stream_t *ts, int *line, int *column);
+
+/**
+ * @brief 現在位置のトークンのファイルパスを取得する
+ * @param[in] ts  トークンストリーム
+ * @return ファイルパス. 前処理していなければNULL.
+ */
+const char *token_path(struct token_stream_t *ts);
+
+/**
+ * @brief トークンを末尾に足す
+ * @param[in] ts      トークンストリーム
+ * @param[in] type    トークンタイプ
+ * @param[in] offset  入力中のオフセット
+ * @param[in] value   値
+ * @note 字句解析せずにトークンを積む. 前処理の出力用.
+ */
+void push_token(struct token_stream_t *ts, token_type_t type, uint32_t offset, int value);
+
+/**
+ * @brief 前処理用にトークンを1つ読み取る
+ * @param[in]  p        入力文字列へのポインタ
+ * @param[out] start    トークンの先頭
+ * @param[out] len      トークンの長さ
+ * @param[out] value    数値の値, 識別子のintern_id(), 予約語の表の位置
+ * @param[out] newline  トークンの前の空白に改行があったか (コメントの中の改行は数えない)
+ * @return トークンタイプ. 終端ならTK_EOF, トークンにならない文字 ('#' など) なら長さ1のTK_INVALID.
+ * @note 行末のバックスラッシュと改行は空白として読み飛ばす.
+ */
+token_type_t scan_pp_token(const char *p, const char **start, size_t *len, int *value, bool *newline);
+
+/**
+ * @brief 巻き戻し用に現在位置を記録する
+ * @param[in] ts  トークンストリーム
+ * @return 記録した位置
+ * @note マークは入れ子にでき, rewind_token()かunmark_token()で後に付けたものから解除する.
+ *       マークがある間, それ以降のトークンはリングバッファに保持される.
+ */
+size_t mark_token(struct token_stream_t *ts);
+
+/**
+ * @brief mark_token()で記録した位置に巻き戻す
+ * @param[in] ts    トークンストリーム
+ * @param[in] mark  mark_token()の戻り値
+ */
+void rewind_token(struct token_stream_t *ts, size_t mark);
+
+/**
+ * @brief mark_token()で記録した位置を破棄する
+ * @param[in] ts  トークンストリーム
+ */
+void unmark_token(struct token_stream_t *ts);
+
+/* preprocess.c */
+/**
+ * @brief 前処理してトークンストリームに全てのトークンを積む
+ * @param[out] ts                トークンストリーム
+ * @param[in]  src               ソース
+ * @param[in]  include_dirs      インクルードパス (-I)
+ * @param[in]  num_include_dirs  include_dirsの要素数
+ * @note 読み込んだヘッダーはプロセスが終わるまでマップしたままにする.
+ */
+void preprocess(struct token_stream_t *ts, const struct source_t *src, const char **include_dirs,
+		size_t num_include_dirs);
+
+/**
+ * @brief 前処理で読み込んだファイルの依存関係をmakeの形式で書き出す
+ * @param[in] fp      出力先
+ * @param[in] target  ターゲット名
+ * @param[in] pch     読み込んだプリコンパイル済みヘッダーのパス (NULLならなし)
+ */
+void write_dependencies(FILE *fp, const char *target, const char *pch);
+
+/**
+ * @brief マクロ表を書き出す
+ * @param[in] fp  出力先
+ * @return 書き出したバイト数
+ */
+size_t write_macros(FILE *fp);
+
+/**
+ * @brief write_macros()で書き出したマクロ表を読み込む
+ * @param[in] image  書き出したもの (8バイト境界)
+ * @param[in] size   imageのバイト数
+ * @return 成功したら0, 壊れていれば-1
+ * @note 前処理を始める前に呼ぶ.
+ */
+int load_macros(const char *image, size_t size);
+
+/* pch.c */
+/**
+ * @brief プリコンパイル済みヘッダーを書き出す
+ * @param[in] path     出力するファイルのパス
+ * @param[in] program  ヘッダーのND_PROGRAM
+ * @return 成功したら0を, 失敗したら-1を返す (errnoを設定する)
+ * @note 識別子プール, ノードアリーナ, マクロ表の全体を書き出す.
+ */
+int write_pch(const char *path, node_id_t program);
+
+/**
+ * @brief プリコンパイル済みヘッダーを読み込む
+ * @param[in] path  プリコンパイル済みヘッダーのパス
+ * @return ヘッダーのND_PROGRAM
+ * @note 識別子を登録したりノードをつくったりする前に呼ぶ. 読めなければ終了する.
+ */
+node_id_t load_pch(const char *path);
+
+/* scan.c */
+/**
+ * @brief 空白(改行を含む)を読み飛ばす
+ * @param[in] p  入力文字列へのポインタ
+ * @return 空白でない最初の文字へのポインタ
+ */
+const char *scan_spaces(const char *p);
+
+/**
+ * @brief 識別子の長さを測る
+ * @param[in] p  識別子の先頭へのポインタ
+ * @return 英数字と '_' が続く長さ
+ */
+size_t scan_ident(const char *p);
+
+/**
+ * @brief コメントの終端を探す
+ * @param[in] p  コメント本文の先頭へのポインタ (コメント開始記号の直後)
+ * @return "*" "/" の先頭へのポインタ. 終端がなければNULへのポインタ.
+ */
+const char *scan_comment_end(const char *p);
+
+/**
+ * @brief 次の改行を探す
+ * @param[in] p  入力文字列へのポインタ
+ * @return 改行へのポインタ. 改行がなければNULへのポインタ.
+ */
+const char *scan_newline(const char *p);
+
+/* source.c */
+/**
+ * @brief ソースを開く
+ * @param[out] src   ソース
+ * @param[in]  path  ファイルパス. "-" なら標準入力から読み込む.
+ * @return 成功したら0を, 失敗したら-1を返す (errnoを設定する)
+ *
+ * 通常ファイルは読み込み専用でmmapされ, コピーは作られない.
+ */
+int open_source(struct source_t *src, const char *path);
+
+/**
+ * @brief 文字列をそのままソースとして扱う
+ * @param[out] src   ソース
+ * @param[in]  code  ソースコード
+ */
+void string_source(struct source_t *src, const char *code);
+
+/**
+ * @brief ソースを閉じる
+ * @param[in] src  ソース
+ */
+void close_source(struct source_t *src);
 
 
 /* codegen.c */
 
 /**
  * @brief RISC-Vのアセンブラを生成する
- * @param[in] irv  中間表現(IR)のVector
+ * @param[in] irv  中間表現(IR)の列
  * @param[in] d    辞書
  */
-void gen_riscv(struct vector_t *irv, struct dict_t *d);
+void gen_riscv(struct ir_list_t *irv, struct dict_t *d);
+
+/**
+ * @brief 変数のデータを生成する
+ * @param[in] d  辞書
+ */
+void gen_riscv_data(struct dict_t *d);
+
+/**
+ * @brief IRの列から関数のコードを生成する
+ * @param[in] irv  レジスタ割り当て済みのIRの列
+ */
+void gen_riscv_text(struct ir_list_t *irv);
+
+/**
+ * @brief 第2オペランドを即値のまま命令にできるか判断する
+ * @param[in] op     IRのタイプ
+ * @param[in] value  即値
+ * @return 即値を取る命令 (addiなど) で表せればtrue
+ */
+bool riscv_imm_operand(ir_type_t op, int value);
 
 
 /* regalloc.c */
@@ -281,16 +888,51 @@ struct using_regs_list_t *get_using_regs(int index);
  * @brief allocate register
  * @param[in] irv
  */
-void allocate_regs(struct vector_t *irv);
+void allocate_regs(struct ir_list_t *irv);
+
+/* sema.c */
+/**
+ * @brief 名前を解決する
+ * @param[in]  node  ノードへのポインタ
+ * @param[out] d     宣言した変数を登録する辞書 (NULLなら登録しない)
+ *
+ * 宣言されていない識別子を参照していればエラーを表示して終了する.
+ * 仮引数は関数の中, 複文で宣言した変数はその複文の中だけで見え, 外側の同じ名前を隠す.
+ */
+void resolve_names(node_id_t node, struct dict_t *d);
+
+/**
+ * @brief 前に解決した宣言に続けて, external_declarationを1つ名前解決する
+ * @param[in]  node  external_declarationのノード
+ * @param[out] d     宣言した変数を登録する辞書 (NULLなら登録しない)
+ *
+ * ファイルスコープの宣言は次の呼び出しでも見える. 最初はresolve_names(NODE_NULL, d)で空にしておく.
+ */
+void resolve_declaration(node_id_t node, struct dict_t *d);
+
+/**
+ * @brief 識別子が指す変数のラベルを取得する
+ * @param[in] id  名前解決した識別子か宣言子のノード
+ * @return ラベルのintern_id(). 仮引数とローカル変数は "名前.番号" になる.
+ */
+unsigned int variable_label(node_id_t id);
 
 /* ir.c */
 /**
  * @brief 中間表現(IR)を生成する
- * @param[in] node  ノードへのポインタ
- * @param[in] d     辞書へのポインタ
- * @return 生成されたIRへのポインタ
+ * @param[in] node   名前解決済みのノードへのポインタ
+ * @param[in] arena  IRの列を割り当てるアリーナ
+ * @return 生成されたIRの列
+ * @note 仮想レジスタの番号は呼び出しごとに0から振り直す. ラベルの番号は振り直さない.
+ */
+struct ir_list_t *gen_ir(node_id_t node, struct arena_t *arena);
+
+/**
+ * @brief IRの名前を取得する
+ * @param[in] ir  IR
+ * @return 名前のオペランドのintern()された名前. 名前がなければNULL.
  */
-struct vector_t *gen_ir(struct node_t *node, struct dict_t *d);
+const char *ir_name(const struct ir_t *ir);
 
 
 /* display.c */
@@ -310,29 +952,96 @@ int color_printf(FILE *file, dprint_color_t color, const char *format, ...);
  */
 int error_printf(const char *format, ...);
 
-/* util.c */
+/* arena.c */
+/**
+ * @brief コンパイル1回分のアリーナ
+ */
+extern struct arena_t session_arena;
+
+/**
+ * @brief アリーナから割り当てる
+ * @param[in] arena  アリーナ
+ * @param[in] size   バイト数
+ * @param[in] align  境界 (2のべき乗)
+ * @return 割り当てた領域 (初期化しない). 確保できなければ終了する.
+ */
+void *arena_alloc(struct arena_t *arena, size_t size, size_t align);
+
+/**
+ * @brief アリーナから型typeを1つ割り当てる
+ */
+#define ARENA_NEW(arena, type) ((type *)arena_alloc((arena), sizeof(type), _Alignof(type)))
+
+/**
+ * @brief アリーナから型typeの配列を割り当てる
+ */
+#define ARENA_ARRAY(arena, type, n) ((type *)arena_alloc((arena), sizeof(type) * (n), _Alignof(type)))
+
+/**
+ * @brief アリーナにつないだブロックを確保・拡大する
+ * @param[in] arena  アリーナ
+ * @param[in] ptr    拡大するブロック (NULLなら新しく確保する)
+ * @param[in] size   新しいバイト数
+ * @return ブロックの新しい位置 (中身は引き継ぐ). 確保できなければ終了する.
+ * @note arena_release()で他の割り当てと一緒に解放される.
+ */
+void *arena_resize(struct arena_t *arena, void *ptr, size_t size);
+
+/**
+ * @brief アリーナから割り当てたものをまとめて解放する
+ * @param[in] arena  アリーナ
+ * @note 最後のチャンクだけは残して使い回す.
+ */
+void arena_release(struct arena_t *arena);
+
+/* memreport.c */
+/**
+ * @brief メモリ使用量のカウンタ
+ */
+struct mem_stats_t {
+	size_t arena_chunks;		/**< アリーナに確保したチャンクの数 */
+	size_t arena_reserved;		/**< 確保したチャンクとブロックのバイト数 */
+	size_t arena_used;		/**< arena_alloc()とarena_resize()で割り当てたバイト数 */
+	size_t arena_allocs;		/**< arena_alloc()の回数 */
+	size_t arena_resizes;		/**< arena_resize()の回数 */
+	size_t arena_blocks;		/**< 解放していないブロックの数 */
+	size_t arena_block_bytes;	/**< 解放していないブロックのバイト数 */
+	size_t arena_block_peak;	/**< arena_block_bytesの最大 */
+	size_t irs;			/**< 割り当てたIRの数 */
+	size_t variables;		/**< 割り当てた変数の数 */
+	size_t dicts;			/**< 割り当てた辞書の数 */
+	size_t dict_lookups;		/**< 辞書を参照した回数 (追加は数えない) */
+	size_t dict_probes;		/**< 参照でハッシュ表の要素を見た回数 */
+	size_t token_resizes;		/**< トークンのリングバッファを確保し直した回数 */
+	size_t token_capacity;		/**< リングバッファの最大の容量 */
+	size_t intern_reserved;		/**< 識別子プールに確保したバイト数 */
+	size_t intern_used;		/**< 識別子プールで使ったバイト数 */
+	size_t reg_snapshots;		/**< record_using_regs()で記録した回数 */
+	size_t reg_snapshots_reserved;	/**< 記録用に確保したバイト数 */
+};
 
 /**
- * @brief ベクタ要素をプッシュする
- * @param[in] v        プッシュされるベクタ
- * @param[in] element  プッシュする要素
+ * @brief メモリ使用量のカウンタ
  */
-void vector_push(struct vector_t *v, void *element);
+extern struct mem_stats_t mem_stats;
 
 /**
- * @brief ベクタをマージする
- * @param[out] dst  マージ先
- * @param[in]  src  マージ元
- * @note どちらかがNULLであれば何もしない
+ * @brief メモリ使用量を標準エラー出力に表示する
+ * @note atexit()に渡せる形にしている
  */
-void vector_merge(struct vector_t *dst, struct vector_t *src);
+void print_mem_report(void);
 
+/* util.c */
 
 /**
- * @brief 新規ベクタを生成する
- * @return 生成されたベクタ
+ * @brief 配列を拡大する
+ * @param[in,out] array     配列へのポインタ (NULLを指していれば新たに確保する)
+ * @param[in,out] capacity  配列の容量 (要素数)
+ * @param[in]     size      要素のサイズ
+ * @param[in]     needed    必要な要素数
+ * @note 容量は256から倍々に増やす. 確保できなければ終了する.
  */
-struct vector_t *new_vector(void);
+void grow_array(void *array, size_t *capacity, size_t size, size_t needed);
 
 /**
  * @brief 辞書を新規に作成する
@@ -342,30 +1051,72 @@ struct dict_t *new_dict(void);
 /**
  * @brief 辞書にデータを追加する
  * @param[in] d     辞書
- * @param[in] key   キー
+ * @param[in] key   キー (intern()された文字列)
  * @param[in] value 値
  *
  * @note 重複するキーを用いた場合でも登録される
  */
-void dict_append(struct dict_t *d, char *key, void *value);
+void dict_append(struct dict_t *d, const char *key, void *value);
 
 /**
  * @brief 辞書からデータを参照する
  * @param[in] d     辞書
- * @param[in] key   キー
+ * @param[in] key   キー (intern()された文字列)
  * @return データが存在したら値へのポインタを、存在しなければNULLを返す
  *
  * @note 複数のデータが存在した場合、一番インデックスが大きい値に一致する
+ * @note キーはポインタで比較する
+ */
+struct dict_element_t *dict_lookup(struct dict_t *d, const char *key);
+
+/**
+ * @brief 文字列を識別子プールに登録する
+ * @param[in] s    文字列へのポインタ (NUL終端でなくてよい)
+ * @param[in] len  文字列の長さ
+ * @return 正規化された文字列. 同じ綴りには常に同じポインタを返す.
+ */
+const char *intern(const char *s, size_t len);
+
+/**
+ * @brief 識別子プールを登録順に書き出す
+ * @param[in]  fp     出力先
+ * @param[out] count  書き出した文字列の数
+ * @return 書き出したバイト数
+ * @note load_intern_pool()でそのまま読める形で書く.
+ */
+size_t write_intern_pool(FILE *fp, size_t *count);
+
+/**
+ * @brief 空の識別子プールに, write_intern_pool()で書き出したものを読み込む
+ * @param[in] image  書き出したもの (4バイト境界. プロセスが終わるまで残しておく)
+ * @param[in] size   imageのバイト数
+ * @param[in] count  文字列の数
+ * @return 成功したら0, 壊れていれば-1
+ * @note 文字列はコピーせずにimageを直接指す. IDは書き出したときのまま.
+ */
+int load_intern_pool(const char *image, size_t size, size_t count);
+
+/**
+ * @brief intern()された文字列のIDを取得する
+ * @param[in] name  intern()が返した文字列
+ * @return 登録順に振られた0オリジンのID
+ */
+unsigned int intern_id(const char *name);
+
+/**
+ * @brief IDからintern()された文字列を取得する
+ * @param[in] id  intern_id()の戻り値
+ * @return intern()が返した文字列
  */
-struct dict_element_t *dict_lookup(struct dict_t *d, char *key);
+const char *intern_name(unsigned int id);
 
 /* debug.c */
 /**
  * @brief トークナイザーの出力を表示する
  * @param[out] file   出力先
- * @param[in]  tokens トークンベクター
+ * @param[in]  tokens tokenize()したトークンストリーム
  */
-void show_token(FILE *file, struct vector_t *tokens);
+void show_token(FILE *file, struct token_stream_t *tokens);
 
 /**
  * @brief トークンタイプからトークンを表す文字列を取得する.
@@ -377,9 +1128,9 @@ const char *get_token_str(token_type_t token_type);
 /**
  * @brief IRの出力を表示する
  * @param[out] file  出力先
- * @param[in]  irv   IRベクター
+ * @param[in]  irv   IRの列
  */
-void show_ir(FILE *file, struct vector_t *irv);
+void show_ir(FILE *file, struct ir_list_t *irv);
 
 /**
  * @brief パーサーの出力を表示する
@@ -387,5 +1138,5 @@ void show_ir(FILE *file, struct vector_t *irv);
  * @param[in]  node   ノードデータ
  * @param[in]  indent インデント段数
  */
-void show_node(FILE *file, struct node_t *node, unsigned int indent);
+void show_node(FILE *file, node_id_t node, unsigned int indent);
 #endif
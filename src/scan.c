@@ -0,0 +1,360 @@
+/**
+ * @brief 字句解析用の走査カーネル
+ *
+ * 空白の読み飛ばし, コメント終端の検索, 識別子の長さの計測, 改行の検索を
+ * AVX2/SSE2 で32バイトずつまとめて行う. x86以外ではスカラー版を使う.
+ *
+ * ベクタ版はアラインされたブロック単位で読み込むので, 入力の終端(NUL)を含む
+ * ブロックより先のページに触れることはない.
+ */
+#include <stdint.h>
+
+#include "rw2rvc2.h"
+
+#if defined(__x86_64__)
+#	include <immintrin.h>
+#	define SCAN_X86 1
+#endif
+
+#define SCAN_BLOCK_SIZE 32 /**< 1ブロックのバイト数 (マスクのビット数) */
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+/**
+ * @brief ブロック中の特定の文字を探す関数
+ * @param[in] block  32バイトにアラインされたブロック
+ * @return 該当する文字の位置のマスク
+ */
+typedef uint32_t (*char_mask_t)(const char *block);
+
+/**
+ * @brief ブロック中のコメント終端にかかわる文字を探す関数
+ * @param[in]  block    32バイトにアラインされたブロック
+ * @param[out] slash    '/' の位置のマスク
+ * @param[out] nul      NULの位置のマスク
+ * @return '*' の位置のマスク
+ */
+typedef uint32_t (*comment_mask_t)(const char *block, uint32_t *slash, uint32_t *nul);
+
+/**
+ * @brief ブロック単位で, マスクに該当しない最初の文字を探す
+ * @param[in] p          探索を始める位置
+ * @param[in] char_mask  読み飛ばす文字のマスクを返す関数
+ * @return 該当しない最初の文字へのポインタ
+ */
+static ALWAYS_INLINE const char *skip_chars_blocks(const char *p, char_mask_t char_mask)
+{
+	const char *block = (const char *)((uintptr_t)p & ~(uintptr_t)(SCAN_BLOCK_SIZE - 1));
+	uint32_t valid = ~0u << (p - block);
+	uint32_t stop;
+
+	for (;;) {
+		if ((stop = ~char_mask(block) & valid) != 0)
+			return block + __builtin_ctz(stop);
+
+		block += SCAN_BLOCK_SIZE;
+		valid = ~0u;
+	}
+}
+
+/**
+ * @brief ブロック単位でコメント終端を探す
+ */
+static ALWAYS_INLINE const char *find_comment_end_blocks(const char *p, comment_mask_t comment_mask)
+{
+	const char *block = (const char *)((uintptr_t)p & ~(uintptr_t)(SCAN_BLOCK_SIZE - 1));
+	uint32_t valid = ~0u << (p - block);
+	uint32_t star, slash, nul, end;
+	uint32_t carry = 0; /* 直前のブロックの最後が '*' か */
+
+	for (;;) {
+		star = comment_mask(block, &slash, &nul) & valid;
+		slash &= valid;
+		nul &= valid;
+
+		/* 前のブロックをまたいだ "*" "/" */
+		if (carry && (slash & 1))
+			return block - 1;
+
+		/* "*" の直後が "/" の位置, もしくはNUL */
+		if ((end = (star & (slash >> 1)) | nul) != 0)
+			return block + __builtin_ctz(end);
+
+		carry = star >> 31;
+		block += SCAN_BLOCK_SIZE;
+		valid = ~0u;
+	}
+}
+
+#if defined(SCAN_X86)
+/* SSE2 */
+
+static ALWAYS_INLINE __m128i sse2_in_range(__m128i v, char lo, char width)
+{
+	__m128i x = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+
+	return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(width)), x);
+}
+
+static ALWAYS_INLINE uint32_t sse2_movemask2(__m128i lo, __m128i hi)
+{
+	return (uint32_t)_mm_movemask_epi8(lo) | ((uint32_t)_mm_movemask_epi8(hi) << 16);
+}
+
+static ALWAYS_INLINE uint32_t sse2_space_mask(const char *block)
+{
+	__m128i v0 = _mm_load_si128((const __m128i *)block);
+	__m128i v1 = _mm_load_si128((const __m128i *)(block + 16));
+	__m128i sp = _mm_set1_epi8(' ');
+
+	/* ' ' と '\t' 〜 '\r' */
+	return sse2_movemask2(_mm_or_si128(_mm_cmpeq_epi8(v0, sp), sse2_in_range(v0, '\t', '\r' - '\t')),
+			      _mm_or_si128(_mm_cmpeq_epi8(v1, sp), sse2_in_range(v1, '\t', '\r' - '\t')));
+}
+
+static ALWAYS_INLINE __m128i sse2_ident_chars(__m128i v)
+{
+	__m128i alpha = sse2_in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z' - 'a');
+	__m128i digit = sse2_in_range(v, '0', '9' - '0');
+
+	return _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+static ALWAYS_INLINE uint32_t sse2_ident_mask(const char *block)
+{
+	return sse2_movemask2(sse2_ident_chars(_mm_load_si128((const __m128i *)block)),
+			      sse2_ident_chars(_mm_load_si128((const __m128i *)(block + 16))));
+}
+
+static ALWAYS_INLINE uint32_t sse2_comment_mask(const char *block, uint32_t *slash, uint32_t *nul)
+{
+	__m128i v0 = _mm_load_si128((const __m128i *)block);
+	__m128i v1 = _mm_load_si128((const __m128i *)(block + 16));
+	__m128i c;
+
+	c = _mm_set1_epi8('/');
+	*slash = sse2_movemask2(_mm_cmpeq_epi8(v0, c), _mm_cmpeq_epi8(v1, c));
+	c = _mm_setzero_si128();
+	*nul = sse2_movemask2(_mm_cmpeq_epi8(v0, c), _mm_cmpeq_epi8(v1, c));
+	c = _mm_set1_epi8('*');
+
+	return sse2_movemask2(_mm_cmpeq_epi8(v0, c), _mm_cmpeq_epi8(v1, c));
+}
+
+/* 改行とNUL以外 */
+static ALWAYS_INLINE uint32_t sse2_line_mask(const char *block)
+{
+	__m128i v0 = _mm_load_si128((const __m128i *)block);
+	__m128i v1 = _mm_load_si128((const __m128i *)(block + 16));
+	__m128i nl = _mm_set1_epi8('\n');
+	__m128i nul = _mm_setzero_si128();
+
+	return ~sse2_movemask2(_mm_or_si128(_mm_cmpeq_epi8(v0, nl), _mm_cmpeq_epi8(v0, nul)),
+			       _mm_or_si128(_mm_cmpeq_epi8(v1, nl), _mm_cmpeq_epi8(v1, nul)));
+}
+
+static const char *skip_spaces_sse2(const char *p)
+{
+	return skip_chars_blocks(p, sse2_space_mask);
+}
+
+static size_t ident_length_sse2(const char *p)
+{
+	return skip_chars_blocks(p, sse2_ident_mask) - p;
+}
+
+static const char *find_comment_end_sse2(const char *p)
+{
+	return find_comment_end_blocks(p, sse2_comment_mask);
+}
+
+static const char *find_newline_sse2(const char *p)
+{
+	return skip_chars_blocks(p, sse2_line_mask);
+}
+
+/* AVX2 */
+#	define AVX2_TARGET __attribute__((target("avx2")))
+
+static ALWAYS_INLINE AVX2_TARGET __m256i avx2_in_range(__m256i v, char lo, char width)
+{
+	__m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(width)), x);
+}
+
+static ALWAYS_INLINE AVX2_TARGET uint32_t avx2_space_mask(const char *block)
+{
+	__m256i v = _mm256_load_si256((const __m256i *)block);
+
+	/* ' ' と '\t' 〜 '\r' */
+	return _mm256_movemask_epi8(
+		_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), avx2_in_range(v, '\t', '\r' - '\t')));
+}
+
+static ALWAYS_INLINE AVX2_TARGET uint32_t avx2_ident_mask(const char *block)
+{
+	__m256i v = _mm256_load_si256((const __m256i *)block);
+	__m256i alpha = avx2_in_range(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z' - 'a');
+	__m256i digit = avx2_in_range(v, '0', '9' - '0');
+
+	return _mm256_movemask_epi8(
+		_mm256_or_si256(_mm256_or_si256(alpha, digit), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'))));
+}
+
+static ALWAYS_INLINE AVX2_TARGET uint32_t avx2_comment_mask(const char *block, uint32_t *slash, uint32_t *nul)
+{
+	__m256i v = _mm256_load_si256((const __m256i *)block);
+
+	*slash = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+	*nul = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')));
+}
+
+/* 改行とNUL以外 */
+static ALWAYS_INLINE AVX2_TARGET uint32_t avx2_line_mask(const char *block)
+{
+	__m256i v = _mm256_load_si256((const __m256i *)block);
+
+	return ~_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+						     _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+}
+
+static AVX2_TARGET const char *skip_spaces_avx2(const char *p)
+{
+	return skip_chars_blocks(p, avx2_space_mask);
+}
+
+static AVX2_TARGET size_t ident_length_avx2(const char *p)
+{
+	return skip_chars_blocks(p, avx2_ident_mask) - p;
+}
+
+static AVX2_TARGET const char *find_comment_end_avx2(const char *p)
+{
+	return find_comment_end_blocks(p, avx2_comment_mask);
+}
+
+static AVX2_TARGET const char *find_newline_avx2(const char *p)
+{
+	return skip_chars_blocks(p, avx2_line_mask);
+}
+#endif
+
+/* スカラー版 */
+
+static const char *skip_spaces_scalar(const char *p)
+{
+	while (*p == ' ' || (*p >= '\t' && *p <= '\r'))
+		p++;
+
+	return p;
+}
+
+static size_t ident_length_scalar(const char *p)
+{
+	const char *s = p;
+
+	while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_')
+		p++;
+
+	return p - s;
+}
+
+static const char *find_comment_end_scalar(const char *p)
+{
+	while (*p != '\0' && !(p[0] == '*' && p[1] == '/'))
+		p++;
+
+	return p;
+}
+
+static const char *find_newline_scalar(const char *p)
+{
+	while (*p != '\0' && *p != '\n')
+		p++;
+
+	return p;
+}
+
+/**
+ * @brief CPUに合わせて使うカーネル
+ */
+static struct {
+	const char *(*skip_spaces)(const char *p);
+	size_t (*ident_length)(const char *p);
+	const char *(*find_comment_end)(const char *p);
+	const char *(*find_newline)(const char *p);
+} scanner;
+
+/**
+ * @brief CPUに合わせてカーネルを選ぶ
+ */
+static void select_scanner(void)
+{
+	scanner.skip_spaces = skip_spaces_scalar;
+	scanner.ident_length = ident_length_scalar;
+	scanner.find_comment_end = find_comment_end_scalar;
+	scanner.find_newline = find_newline_scalar;
+
+#if defined(SCAN_X86)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		scanner.skip_spaces = skip_spaces_avx2;
+		scanner.ident_length = ident_length_avx2;
+		scanner.find_comment_end = find_comment_end_avx2;
+		scanner.find_newline = find_newline_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		scanner.skip_spaces = skip_spaces_sse2;
+		scanner.ident_length = ident_length_sse2;
+		scanner.find_comment_end = find_comment_end_sse2;
+		scanner.find_newline = find_newline_sse2;
+	}
+#endif
+}
+
+/**
+ * @brief 空白(改行を含む)を読み飛ばす
+ */
+const char *scan_spaces(const char *p)
+{
+	if (scanner.skip_spaces == NULL)
+		select_scanner();
+
+	return scanner.skip_spaces(p);
+}
+
+/**
+ * @brief 識別子の長さを測る
+ */
+size_t scan_ident(const char *p)
+{
+	if (scanner.ident_length == NULL)
+		select_scanner();
+
+	return scanner.ident_length(p);
+}
+
+/**
+ * @brief コメントの終端を探す
+ */
+const char *scan_comment_end(const char *p)
+{
+	if (scanner.find_comment_end == NULL)
+		select_scanner();
+
+	return scanner.find_comment_end(p);
+}
+
+/**
+ * @brief 次の改行を探す
+ */
+const char *scan_newline(const char *p)
+{
+	if (scanner.find_newline == NULL)
+		select_scanner();
+
+	return scanner.find_newline(p);
+}
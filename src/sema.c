@@ -0,0 +1,372 @@
+/**
+ * @brief 名前解決
+ *
+ * IR生成の前にASTを1度だけ辿り, 変数の宣言を辞書に登録して識別子の参照を確かめる.
+ * 名前はintern_id()の添字で引くので, 参照1つの確認は定数時間で済む.
+ *
+ * 関数と複文に入るたびにスコープを積む. スコープを出るときは, その中で宣言した変数を
+ * 宣言の逆順に外して, 隠していた外側の変数に戻す. 戻す手間は宣言1つにつき定数時間である.
+ *
+ * 仮引数とローカル変数は同じ名前の大域変数や他の関数の変数と置き場所を分けるため,
+ * "名前.番号" のラベルを持つ. 識別子がどの変数のラベルを指すかはノードごとに記録しておき,
+ * IR生成はvariable_label()で引く.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "rw2rvc2.h"
+
+/**
+ * @brief 名前ごとの束縛
+ *
+ * intern_id()を添字にして, 最後に宣言された変数を指す. 宣言されていない名前はNULL.
+ */
+static struct {
+	struct variable_t **vars; /**< 名前ごとの変数 */
+	size_t len;		  /**< 初期化済みの要素数 */
+	size_t capacity;	  /**< varsの容量 */
+} bindings;
+
+/**
+ * @brief スコープのスタック
+ */
+static struct {
+	unsigned int *names;   /**< 宣言した名前 (宣言順) */
+	size_t len;	       /**< 宣言した名前の数 */
+	size_t capacity;       /**< namesの容量 */
+	size_t *marks;	       /**< スコープに入った時点のlen */
+	size_t depth;	       /**< 入っているスコープの数 (0: ファイルスコープ) */
+	size_t marks_capacity; /**< marksの容量 */
+} scopes;
+
+/**
+ * @brief ノードごとの変数のラベル (識別子と宣言子のノードだけ使う)
+ */
+static struct {
+	unsigned int *labels; /**< 変数のラベルのintern_id() */
+	size_t capacity;      /**< labelsの容量 */
+} resolved;
+
+/**
+ * @brief 次に振るラベルの番号
+ */
+static unsigned int label_count;
+
+/**
+ * @brief 名前解決のスタック
+ */
+static struct {
+	node_id_t *ids;	 /**< これから辿るノード */
+	size_t len;	 /**< 積んでいるノードの数 */
+	size_t capacity; /**< idsの容量 */
+} sema_stack;
+
+/**
+ * @brief 名前解決のスタックで, スコープを出る位置の印
+ */
+#define SCOPE_END ((node_id_t)UINT32_MAX)
+
+/**
+ * @brief 新しい変数データにメモリを割り当てる
+ * @param[in] node    変数ノード
+ * @param[in] slevel  スコープレベル
+ */
+static struct variable_t *new_variable(node_id_t node, int slevel)
+{
+	struct variable_t *var;
+
+	/* assert */
+	if (node == NODE_NULL || get_node(node)->type != ND_IDENT /* @TODO たぶんおかしい*/) {
+		error_printf("unexpected error in %s() (unexpected node type: %d)\n", __FUNCTION__,
+			     (node == NODE_NULL) ? -1 : get_node(node)->type);
+		exit(1);
+	}
+
+	var = ARENA_NEW(&session_arena, struct variable_t);
+	mem_stats.variables++;
+	var->node = node;
+	var->scope_level = slevel;
+	var->shadowed = NULL;
+	var->label = get_node(node)->name;
+
+	return var;
+}
+
+/**
+ * @brief ノードが指す変数のラベルを記録する
+ */
+static void set_label(node_id_t node, unsigned int label)
+{
+	if (node >= resolved.capacity)
+		grow_array(&resolved.labels, &resolved.capacity, sizeof(unsigned int), (size_t)node + 1);
+
+	resolved.labels[node] = label;
+}
+
+/**
+ * @brief 変数を宣言する
+ * @param[in] d       変数の辞書 (NULLなら登録しない)
+ * @param[in] node    宣言子のノード
+ * @param[in] slevel  スコープレベル
+ */
+static void declare(struct dict_t *d, node_id_t node, int slevel)
+{
+	struct variable_t *var = new_variable(node, slevel);
+	unsigned int id = get_node(node)->name;
+
+	if (id >= bindings.len) {
+		if (id >= bindings.capacity)
+			grow_array(&bindings.vars, &bindings.capacity, sizeof(struct variable_t *), (size_t)id + 1);
+
+		memset(&bindings.vars[bindings.len], 0, sizeof(struct variable_t *) * (id + 1 - bindings.len));
+		bindings.len = (size_t)id + 1;
+	}
+
+	var->shadowed = bindings.vars[id];
+	bindings.vars[id] = var;
+
+	/* コード生成しないとき (d == NULL) は, 識別子プールに名前を足さない */
+	if (slevel > 0 && d != NULL) {
+		static char *label = NULL;
+		static size_t capacity = 0;
+		size_t len = (size_t)snprintf(NULL, 0, "%s.%u", intern_name(id), label_count);
+
+		if (len >= capacity)
+			grow_array(&label, &capacity, sizeof(char), len + 1);
+
+		snprintf(label, capacity, "%s.%u", intern_name(id), label_count++);
+		var->label = intern_id(intern(label, len));
+	}
+	set_label(node, var->label);
+
+	if (scopes.len >= scopes.capacity)
+		grow_array(&scopes.names, &scopes.capacity, sizeof(unsigned int), scopes.len + 1);
+	scopes.names[scopes.len++] = id;
+
+	if (d != NULL)
+		dict_append(d, intern_name(var->label), var);
+}
+
+/**
+ * @brief スコープに入る
+ */
+static void enter_scope(void)
+{
+	if (scopes.depth >= scopes.marks_capacity)
+		grow_array(&scopes.marks, &scopes.marks_capacity, sizeof(size_t), scopes.depth + 1);
+
+	scopes.marks[scopes.depth++] = scopes.len;
+}
+
+/**
+ * @brief スコープを出て, その中で宣言した変数を外す
+ */
+static void leave_scope(void)
+{
+	size_t mark = scopes.marks[--scopes.depth];
+	unsigned int id;
+
+	while (scopes.len > mark) {
+		id = scopes.names[--scopes.len];
+		bindings.vars[id] = bindings.vars[id]->shadowed;
+	}
+}
+
+/**
+ * @brief 名前解決のスタックにノードを積む
+ */
+static void push_sema_node(node_id_t id)
+{
+	if (id == NODE_NULL)
+		return;
+
+	if (sema_stack.len >= sema_stack.capacity)
+		grow_array(&sema_stack.ids, &sema_stack.capacity, sizeof(node_id_t), sema_stack.len + 1);
+
+	sema_stack.ids[sema_stack.len++] = id;
+}
+
+/**
+ * @brief 子リストを先頭から辿るように積む
+ */
+static void push_sema_list(list_id_t list)
+{
+	size_t j;
+
+	for (j = list_length(list); j > 0; j--)
+		push_sema_node(list_at(list, j - 1));
+}
+
+/**
+ * @brief 宣言子リストの変数を宣言する
+ */
+static void declare_list(struct dict_t *d, node_id_t dlist, int slevel)
+{
+	const struct node_t *n;
+	size_t j;
+
+	/* 型名だけの行は何もしない */
+	if (dlist == NODE_NULL)
+		return;
+
+	n = get_node(dlist);
+
+	if (n->type != ND_VAR_INIT_DLIST) {
+		error_printf("unexpected error\n");
+		exit(1);
+	}
+
+	for (j = 0; j < list_length(n->list); j++)
+		declare(d, list_at(n->list, j), slevel);
+}
+
+/**
+ * @brief 前に解決した宣言に続けて名前を解決する
+ *
+ * ノードはgen_ir()と同じ順に前順で辿るので, 宣言と参照の前後関係も, 最初に報告する
+ * 未宣言の識別子もIR生成と変わらない. スコープレベルは大域変数が0, 仮引数が1で,
+ * ローカル変数は入っているスコープの数になる. スコープを出る位置にはSCOPE_ENDを積んでおく.
+ */
+void resolve_declaration(node_id_t root, struct dict_t *d)
+{
+	const struct node_t *node, *decl, *n;
+	node_id_t id;
+	size_t j;
+
+	sema_stack.len = 0;
+	push_sema_node(root);
+
+	while (sema_stack.len > 0) {
+		id = sema_stack.ids[--sema_stack.len];
+
+		if (id == SCOPE_END) {
+			leave_scope();
+			continue;
+		}
+
+		node = get_node(id);
+
+		switch (node->type) {
+		case ND_PROGRAM:
+			push_sema_list(node->list);
+			break;
+
+		case ND_COMPOUND_STATEMENTS:
+			enter_scope();
+			push_sema_node(SCOPE_END);
+			push_sema_list(node->list);
+			break;
+
+		/* 静的変数の宣言 */
+		case ND_VAR_DEC_STATIC:
+			declare_list(d, node->rhs, 0);
+			break;
+
+		/* ローカル変数の宣言 (IR生成はまだ対応していない) */
+		case ND_VAR_DEC:
+			declare_list(d, node->rhs, (int)scopes.depth);
+			break;
+
+		case ND_FUNC_DEF:
+			decl = get_node(get_node(node->lhs)->lhs);
+
+			/* 仮引数のスコープは本体の複文の外側に置く */
+			enter_scope();
+			for (j = 0; j < list_length(decl->parameter_list); j++) {
+				n = get_node(list_at(decl->parameter_list, j));
+				declare(d, n->rhs, 1);
+			}
+
+			push_sema_node(SCOPE_END);
+			push_sema_node(node->rhs);
+			break;
+
+		case ND_IDENT:
+			if (node->name >= bindings.len || bindings.vars[node->name] == NULL) {
+				error_printf("uninitialized identifier: %s\n", intern_name(node->name));
+				exit(1);
+			}
+			set_label(id, bindings.vars[node->name]->label);
+			break;
+
+		case ND_ASSIGN:
+			/* 右辺を先に辿る */
+			push_sema_node(node->lhs);
+			push_sema_node(node->rhs);
+			break;
+
+		case ND_IF:
+			push_sema_node(node->alternative);
+			push_sema_node(node->consequence);
+			push_sema_node(node->condition);
+			break;
+
+		case ND_FUNC_CALL:
+			/* 呼び出せるのは名前で指した関数だけ. 名前が宣言されているかはまだ確かめない */
+			if (node->lhs == NODE_NULL || get_node(node->lhs)->type != ND_IDENT) {
+				error_printf("called object is not a function\n");
+				exit(1);
+			}
+			for (j = list_length(node->list); j > 0; j--) {
+				n = get_node(list_at(node->list, j - 1));
+				if (n->type == ND_FUNC_ARG)
+					push_sema_node(n->lhs);
+			}
+			break;
+
+		case ND_RETURN:
+		case ND_EXPRESSION:
+			push_sema_node(node->expression);
+			break;
+
+		case ND_PLUS:
+		case ND_MINUS:
+		case ND_MUL:
+		case ND_DIV:
+		case ND_MOD:
+		case ND_OR_OP:
+		case ND_AND:
+		case ND_OR:
+		case ND_XOR:
+		case ND_AND_OP:
+		case ND_EQ_OP:
+		case ND_NE_OP:
+		case ND_LESS_OP:
+		case ND_GREATER_OP:
+		case ND_LE_OP:
+		case ND_GE_OP:
+		case ND_LEFT_OP:
+		case ND_RIGHT_OP:
+			push_sema_node(node->rhs);
+			push_sema_node(node->lhs);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * @brief 名前を解決する
+ */
+void resolve_names(node_id_t root, struct dict_t *d)
+{
+	/* 前回の名前解決の束縛を外す */
+	while (scopes.len > 0) {
+		scopes.len--;
+		bindings.vars[scopes.names[scopes.len]] = NULL;
+	}
+	scopes.depth = 0;
+	label_count = 0;
+
+	resolve_declaration(root, d);
+}
+
+/**
+ * @brief 識別子が指す変数のラベルを取得する
+ */
+unsigned int variable_label(node_id_t id)
+{
+	return resolved.labels[id];
+}
@@ -0,0 +1,160 @@
+/**
+ * @brief ソース入力
+ *
+ * ファイルは読み込み専用でmmapし, トークンはマップされた領域を直接指す.
+ * 標準入力はパイプでも読めるようにチャンク単位で読み込む.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rw2rvc2.h"
+
+/**
+ * @brief ファイルを読み込み専用でmmapする
+ *
+ * 末尾に必ずNUL終端が来るように, ファイルサイズより1ページ以上大きい無名領域を確保し,
+ * その先頭にファイルを重ねてマップする. ファイル末尾のページの残りと余分のページは
+ * ゼロで埋められているので, トークナイザーはNULを番兵として使える.
+ */
+static int map_source(struct source_t *src, int fd)
+{
+	struct stat st;
+	long page = sysconf(_SC_PAGESIZE);
+	size_t map_size;
+	void *base;
+
+	if (fstat(fd, &st) != 0)
+		return -1;
+
+	if (!S_ISREG(st.st_mode)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	map_size = ((size_t)st.st_size / page + 1) * page;
+
+	if ((base = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		return -1;
+
+	if (st.st_size > 0 &&
+	    mmap(base, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(base, map_size);
+		return -1;
+	}
+
+	src->buf = base;
+	src->len = st.st_size;
+	src->map_size = map_size;
+	src->allocated = false;
+
+	return 0;
+}
+
+/**
+ * @brief ファイルディスクリプタからEOFまでチャンク単位で読み込む
+ */
+static int read_source_stream(struct source_t *src, int fd)
+{
+	const size_t CHUNK_SIZE = 64 * 1024;
+	size_t capacity = CHUNK_SIZE;
+	char *buf = malloc(capacity + 1);
+	size_t len = 0;
+	ssize_t n;
+
+	if (buf == NULL)
+		return -1;
+
+	for (;;) {
+		if (capacity - len < CHUNK_SIZE) {
+			char *p;
+
+			capacity *= 2;
+			if ((p = realloc(buf, capacity + 1)) == NULL) {
+				free(buf);
+				return -1;
+			}
+			buf = p;
+		}
+
+		if ((n = read(fd, buf + len, capacity - len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return -1;
+		}
+
+		if (n == 0)
+			break;
+
+		len += n;
+	}
+
+	buf[len] = '\0';
+
+	src->buf = buf;
+	src->len = len;
+	src->map_size = 0;
+	src->allocated = true;
+
+	return 0;
+}
+
+/**
+ * @brief ソースを開く
+ */
+int open_source(struct source_t *src, const char *path)
+{
+	int fd;
+	int ret;
+
+	src->path = path;
+
+	/* "-" は標準入力 */
+	if (strcmp(path, "-") == 0) {
+		src->path = "<stdin>";
+		return read_source_stream(src, STDIN_FILENO);
+	}
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	/* 通常ファイル以外 (名前付きパイプ等) はストリームとして読む */
+	if ((ret = map_source(src, fd)) != 0 && errno == EINVAL)
+		ret = read_source_stream(src, fd);
+
+	close(fd);
+
+	return ret;
+}
+
+/**
+ * @brief 文字列をそのままソースとして扱う
+ */
+void string_source(struct source_t *src, const char *code)
+{
+	src->path = "<command line>";
+	src->buf = code;
+	src->len = strlen(code);
+	src->map_size = 0;
+	src->allocated = false;
+}
+
+/**
+ * @brief ソースを閉じる
+ */
+void close_source(struct source_t *src)
+{
+	if (src->map_size != 0)
+		munmap((void *)src->buf, src->map_size);
+	else if (src->allocated)
+		free((void *)src->buf);
+
+	src->buf = NULL;
+	src->len = 0;
+	src->map_size = 0;
+}
@@ -1,241 +1,958 @@
 /**
  * @brief トークナイザー
  */
+#define _GNU_SOURCE /* memmem() */
 #include <ctype.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "rw2rvc2.h"
 
+#include "keyword.h"
+
+/**
+ * @brief 文字クラス
+ */
+typedef enum {
+	CC_INVALID = 0, /**< トークンにならない文字 */
+	CC_NUL,		/**< 終端 */
+	CC_SPACE,       /**< 空白 */
+	CC_NEWLINE,     /**< 改行 */
+	CC_DIGIT,       /**< 数字 */
+	CC_IDENT,       /**< 識別子の先頭になれる文字 */
+	CC_SYMBOL,      /**< 記号 */
+} char_class_t;
+
+/**
+ * @brief 文字クラス表 (1バイトにつき1回の参照で分類する)
+ */
+static const unsigned char CHAR_CLASS[256] = {
+	['\0'] = CC_NUL,							 //
+	['\t'] = CC_SPACE,   ['\v'] = CC_SPACE,   ['\f'] = CC_SPACE,		 //
+	['\r'] = CC_SPACE,   [' '] = CC_SPACE,    ['\n'] = CC_NEWLINE,	 //
+	['0' ... '9'] = CC_DIGIT,						 //
+	['a' ... 'z'] = CC_IDENT, ['A' ... 'Z'] = CC_IDENT, ['_'] = CC_IDENT,	 //
+	['+'] = CC_SYMBOL,    ['-'] = CC_SYMBOL,   ['*'] = CC_SYMBOL,		 //
+	['/'] = CC_SYMBOL,    ['%'] = CC_SYMBOL,   [';'] = CC_SYMBOL,		 //
+	[':'] = CC_SYMBOL,    ['('] = CC_SYMBOL,   [')'] = CC_SYMBOL,		 //
+	['{'] = CC_SYMBOL,    ['}'] = CC_SYMBOL,   ['\''] = CC_SYMBOL,	 //
+	['"'] = CC_SYMBOL,    ['='] = CC_SYMBOL,   ['|'] = CC_SYMBOL,		 //
+	['&'] = CC_SYMBOL,    ['^'] = CC_SYMBOL,   ['!'] = CC_SYMBOL,		 //
+	['~'] = CC_SYMBOL,    ['<'] = CC_SYMBOL,   ['>'] = CC_SYMBOL,		 //
+	[','] = CC_SYMBOL,							 //
+};
+
 /**
- * @brief トークン用にメモリを割り当てる
- * @return 新トークンへのポインタ
+ * @brief 予約語を完全ハッシュ表から引く
+ * @param[in] p    識別子の先頭へのポインタ
+ * @param[in] len  識別子の長さ (識別子全体を読み取った後の長さ)
+ * @return 予約語であれば表の要素を, そうでなければNULLを返す
+ *
+ * 長さと先頭・末尾の文字だけでハッシュ値が決まるので, 予約語の数によらず1回の比較で判定できる.
+ * 長さも一致を要求するので "iffy" や "integer" が予約語と誤判定されることはない.
  */
-static struct token_t *allocate_token(void)
+static inline const struct keyword_t *lookup_keyword(const char *p, size_t len)
 {
-	const size_t ALLOCATE_SIZE = 256;
-	static struct token_t *token_array = NULL;
-	static size_t index = 0;
+	const struct keyword_t *kw;
 
-	/* 新規のメモリプールを作成 */
-	if (token_array == NULL || index >= ALLOCATE_SIZE) {
-		if ((token_array = (struct token_t *)malloc(sizeof(struct token_t) * ALLOCATE_SIZE)) == NULL) {
-			color_printf(stderr, COL_RED, "memory allocation failed\n");
-			exit(1);
+	if (len > KEYWORD_MAX_LEN)
+		return NULL;
+
+	kw = &KEYWORD_TABLE[(len * KEYWORD_HASH_LEN + (unsigned char)p[0] * KEYWORD_HASH_FIRST +
+			     (unsigned char)p[len - 1]) &
+			    (KEYWORD_TABLE_SIZE - 1)];
+
+	if (kw->len != len || memcmp(kw->word, p, len) != 0)
+		return NULL;
+
+	return kw;
+}
+
+/**
+ * @brief 記号を最長一致で読み取る
+ * @param[in]  p    記号の先頭へのポインタ
+ * @param[out] len  読み取った文字数
+ * @return トークンタイプ(TK_XXX)
+ *
+ * 各バイトを一度だけ見て, "<<=" や ">>", ">=" などを再走査なしに確定させる.
+ */
+static token_type_t scan_symbol(const char *p, size_t *len)
+{
+	*len = 1;
+
+	switch (p[0]) {
+	case '+':
+		if (p[1] == '=') {
+			*len = 2;
+			return TK_ADD_ASSIGN;
+		}
+		return TK_PLUS;
+	case '-':
+		if (p[1] == '=') {
+			*len = 2;
+			return TK_SUB_ASSIGN;
 		}
-		index = 0;
+		return TK_MINUS;
+	case '*':
+		if (p[1] == '=') {
+			*len = 2;
+			return TK_MUL_ASSIGN;
+		}
+		return TK_MUL;
+	case '/':
+		if (p[1] == '=') {
+			*len = 2;
+			return TK_DIV_ASSIGN;
+		}
+		return TK_DIV;
+	case '%':
+		if (p[1] == '=') {
+			*len = 2;
+			return TK_MOD_ASSIGN;
+		}
+		return TK_MOD;
+	case '=':
+		if (p[1] == '=') {
+			*len = 2;
+			return TK_EQ_OP;
+		}
+		return TK_EQUAL;
+	case '!':
+		if (p[1] == '=') {
+			*len = 2;
+			return TK_NE_OP;
+		}
+		return TK_NOT;
+	case '|':
+		if (p[1] == '|') {
+			*len = 2;
+			return TK_OR_OP;
+		}
+		return TK_OR;
+	case '&':
+		if (p[1] == '&') {
+			*len = 2;
+			return TK_AND_OP;
+		}
+		return TK_AND;
+	case '<':
+		if (p[1] == '<') {
+			if (p[2] == '=') {
+				*len = 3;
+				return TK_LEFT_ASSIGN;
+			}
+			*len = 2;
+			return TK_LEFT_OP;
+		}
+		if (p[1] == '=') {
+			*len = 2;
+			return TK_LE_OP;
+		}
+		return TK_LESS_OP;
+	case '>':
+		if (p[1] == '>') {
+			if (p[2] == '=') {
+				*len = 3;
+				return TK_RIGHT_ASSIGN;
+			}
+			*len = 2;
+			return TK_RIGHT_OP;
+		}
+		if (p[1] == '=') {
+			*len = 2;
+			return TK_GE_OP;
+		}
+		return TK_GREATER_OP;
+	case '^':
+		return TK_XOR;
+	case '~':
+		return TK_INV;
+	case ';':
+		return TK_SEMICOLON;
+	case ':':
+		return TK_COLON;
+	case '(':
+		return TK_LEFT_PAREN;
+	case ')':
+		return TK_RIGHT_PAREN;
+	case '{':
+		return TK_LEFT_BRACE;
+	case '}':
+		return TK_RIGHT_BRACE;
+	case '\'':
+		return TK_SINGLE_QUOTE;
+	case '"':
+		return TK_DOUBLE_QUOTE;
+	case ',':
+		return TK_COMMA;
+	default:
+		return TK_INVALID;
 	}
-
-	return &token_array[index++];
 }
 
 /**
- * @brief add token
- * @param[in]  v      トークンを詰めるvector_t
- * @param[in]  type   タイプ (TK_XXX)
- * @param[in]  input  入力文字列へのポインタ
+ * @brief 行頭の表を作る
+ *
+ * 字句解析中は行を数えず, 診断を表示するときに初めて入力全体から改行を探す.
  */
-struct token_t *add_token(struct vector_t *v, token_type_t type, char *input, int line, int position)
+static void build_line_index(struct token_stream_t *ts)
 {
-	struct token_t *t = allocate_token();
+	size_t capacity = 256;
+	const char *p = ts->src;
+
+	if ((ts->line_starts = malloc(sizeof(uint32_t) * capacity)) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+
+	ts->line_starts[ts->num_lines++] = 0;
 
-	t->type = type;
-	t->input = input;
-	t->line = line;
-	t->position = position;
-	vector_push(v, t);
+	while (*(p = scan_newline(p)) != '\0') {
+		p++;
 
-	return t;
+		if (ts->num_lines >= capacity) {
+			capacity *= 2;
+			if ((ts->line_starts = realloc(ts->line_starts, sizeof(uint32_t) * capacity)) == NULL) {
+				color_printf(stderr, COL_RED, "memory allocation failed\n");
+				exit(1);
+			}
+		}
+
+		ts->line_starts[ts->num_lines++] = p - ts->src;
+	}
 }
 
 /**
- * @brief 文字 @p s をトークンタイプに変換する
- * @param[in]  s   文字
- * @return トークンタイプ(TK_XXX)。ただし、変換できなかった場合はTK_INVALIDを返す.
+ * @brief 入力中のオフセットを行番号と行内の位置に変換する
+ * @param[in]  ts      トークンストリーム
+ * @param[in]  offset  入力文字列の先頭からのオフセット
+ * @param[out] line    行番号 (1オリジン)
+ * @param[out] column  行頭からのバイト数
  */
-static token_type_t get_token_type_of_symbol(char s)
+static void locate_offset(struct token_stream_t *ts, size_t offset, int *line, int *column)
 {
-	const struct symbol_t {
-		char s;
-		token_type_t tkval;
-	} symbols[] = {
-		{'+', TK_PLUS},		    //
-		{'-', TK_MINUS},	    //
-		{'*', TK_MUL},		    //
-		{'/', TK_DIV},		    //
-		{'%', TK_MOD},		    //
-		{';', TK_SEMICOLON},	//
-		{':', TK_COLON},	    //
-		{'(', TK_LEFT_PAREN},       //
-		{')', TK_RIGHT_PAREN},      //
-		{'{', TK_LEFT_BRACE},       //
-		{'}', TK_RIGHT_BRACE},      //
-		{'\'', TK_SINGLE_QUOTE},    //
-		{'"', TK_DOUBLE_QUOTE},     //
-		{'=', TK_EQUAL},	    //
-		{'&', TK_AND},		    //
-		{'|', TK_OR},		    //
-		{'^', TK_XOR},		    //
-		{'!', TK_NOT},		    //
-		{'~', TK_INV},		    //
-		{'<', TK_LESS_OP},	  //
-		{'>', TK_GREATER_OP},       //
-		{',', TK_COMMA},	    //
-	};
-	unsigned int i;
+	size_t lo = 0, hi;
+
+	if (ts->line_starts == NULL)
+		build_line_index(ts);
 
-	/* テーブル参照 */
-	for (i = 0; i < sizeof(symbols) / sizeof(symbols[0]); i++) {
-		if (symbols[i].s == s)
-			return symbols[i].tkval;
+	/* offset以下で最大の行頭を二分探索する */
+	hi = ts->num_lines;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (ts->line_starts[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
 	}
 
-	return TK_INVALID;
+	*line = lo + 1;
+	*column = offset - ts->line_starts[lo];
 }
 
 /**
- * @brief トークナイザー メイン
- * @param[in] p  入力文字列へのポインタ
- */
-struct vector_t *tokenize(char *p)
-{
-	struct vector_t *v = new_vector();
-	struct token_t *t;
-	const struct keyword_t {
-		char *word;
-		token_type_t tkval;
-	} keywords[] = {
-		{"return", TK_RETURN},    //
-		{"if", TK_IF},		  //
-		{"else", TK_ELSE},	//
-		{"goto", TK_GOTO},	//
-		{"int", TK_INT},	  //
-	};
-	const struct multibytes_operation_t {
-		char *word;
-		token_type_t tkval;
-	} multibytes_operations[] = {
-		{"||", TK_OR_OP},	    //
-		{"&&", TK_AND_OP},	   //
-		{"==", TK_EQ_OP},	    //
-		{"!=", TK_NE_OP},	    //
-		{"<=", TK_LE_OP},	    //
-		{">=", TK_GE_OP},	    //
-		{"*=", TK_MUL_ASSIGN},       //
-		{"/=", TK_DIV_ASSIGN},       //
-		{"%=", TK_MOD_ASSIGN},       //
-		{"+=", TK_ADD_ASSIGN},       //
-		{"-=", TK_SUB_ASSIGN},       //
-		{"<<=", TK_LEFT_ASSIGN},     //
-		{">>=", TK_RIGHT_ASSIGN},    ///
-		{">>", TK_RIGHT_OP},	 //
-		{"<<", TK_LEFT_OP},	  //
-	};
-	unsigned int i;
-	int line = 1;
-	char *begin = p;
-
-	while (*p) {
+ * @brief 空白・コメント以外のトークンを1つ読み取る
+ * @param[in]  p      トークンの先頭へのポインタ
+ * @param[out] len    トークンの長さ
+ * @param[out] value  数値の値, 予約語の表の位置
+ * @return トークンタイプ. 識別子ならTK_IDENT, 不正な文字ならTK_INVALID.
+ * @note 識別子のintern()は呼び出し側で行う. 共有する状態を持たないので並列に呼べる.
+ */
+static inline token_type_t scan_token(const char *p, size_t *len, int *value)
+{
+	const struct keyword_t *kw;
+	char *end;
+
+	switch (CHAR_CLASS[(unsigned char)*p]) {
+	/* symbols */
+	case CC_SYMBOL:
+		return scan_symbol(p, len);
+
+	/* number */
+	case CC_DIGIT:
+		if (p[0] == '0' && (p[1] == 'X' || p[1] == 'x') && isxdigit(p[2]))
+			*value = strtol(p, &end, 16); /* hex */
+		else if (p[0] == '0' && CHAR_CLASS[(unsigned char)p[1]] == CC_DIGIT)
+			*value = strtol(p, &end, 8); /* octal */
+		else
+			*value = strtol(p, &end, 10); /* decimal */
+		*len = end - p;
+		return TK_NUM;
+
+	case CC_IDENT:
+		*len = scan_ident(p);
+
+		/* 予約語かどうかの判定 */
+		if ((kw = lookup_keyword(p, *len)) != NULL) {
+			*value = kw - KEYWORD_TABLE;
+			return kw->tkval;
+		}
+
+		/* 識別子 */
+		return TK_IDENT;
+
+	default:
+		return TK_INVALID;
+	}
+}
+
+/**
+ * @brief トークンを1つ読み取る
+ * @param[in,out] ts    トークンストリーム (字句解析器の状態を持つ)
+ * @param[in]     slot  書き込む配列の位置
+ */
+static void lex_token(struct token_stream_t *ts, size_t slot)
+{
+	const char *p = ts->p;
+	token_type_t type;
+	int value = 0;
+	int line, column;
+	size_t len = 0;
+
+	for (;;) {
+		switch (CHAR_CLASS[(unsigned char)*p]) {
+		case CC_NUL:
+			type = TK_EOF;
+			goto FOUND;
+
 		/* ignore spaces */
-		if (isspace(*p)) {
-			if (*p == '\n') {
-				line++;
-				begin = p + 1;
-			}
-			p++;
+		case CC_SPACE:
+		case CC_NEWLINE:
+			p = scan_spaces(p);
 			continue;
-		}
 
-		/* symbols */
-		if (strchr("+-*/%;(){}'\"=|&^!~<>,", *p) != NULL) {
+		/* コメントは無視する. TODO: 文字列に気をつける.  */
+		case CC_SYMBOL:
+			if (p[0] == '/' && p[1] == '*') {
+				p = scan_comment_end(p + 2);
 
-			/* コメントは無視する. TODO: 文字列に気をつける.  */
-			if (strncmp(p, "/*", 2) == 0) {
-				p += 2;
-				while (*p) {
-					if (*p == '*' && *(p + 1) == '/') {
-						p += 2;
-						goto LOOP_END;
-					}
-					p++;
-				}
+				if (*p != '\0')
+					p += 2;
+				continue;
 			}
+			break;
 
-			/* check if multibytes operations */
-			for (i = 0; i < (sizeof(multibytes_operations) / sizeof(multibytes_operations[0])); i++) {
-				size_t len = strlen(multibytes_operations[i].word);
+		default:
+			break;
+		}
 
-				if (strncmp(multibytes_operations[i].word, p, len) == 0) {
-					add_token(v, multibytes_operations[i].tkval, p, line, p - begin);
-					p += len;
-					break;
-				}
+		if ((type = scan_token(p, &len, &value)) != TK_INVALID)
+			break;
+
+		if (syntax_error_jmp != NULL) {
+			ts->p = p;
+			longjmp(*syntax_error_jmp, 1);
+		}
+
+		locate_offset(ts, p - ts->src, &line, &column);
+		color_printf(stderr, COL_RED, "tokenize error: %s at line %d position %d\n", p, line, column);
+		exit(1);
+	}
+
+	if (type == TK_IDENT)
+		value = intern_id(intern(p, len));
+
+FOUND:
+	if ((size_t)(p - ts->src) > UINT32_MAX) {
+		color_printf(stderr, COL_RED, "input too large (4GiB or more)\n");
+		exit(1);
+	}
+
+	ts->types[slot] = type;
+	ts->offsets[slot] = p - ts->src;
+	ts->values[slot] = value;
+	ts->p = p + len;
+}
+
+/**
+ * @brief オフセットを含むファイルを探す
+ * @return ファイル. 前処理していないストリームならNULL.
+ */
+static const struct token_source_t *find_source(const struct token_stream_t *ts, uint32_t offset)
+{
+	size_t lo = 0, hi = ts->num_sources;
+
+	if (hi == 0)
+		return NULL;
+
+	/* offset以下で最大のbaseを二分探索する */
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (ts->sources[mid].base <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return &ts->sources[lo];
+}
+
+/**
+ * @brief 前処理用にトークンを1つ読み取る
+ */
+token_type_t scan_pp_token(const char *p, const char **start, size_t *len, int *value, bool *newline)
+{
+	token_type_t type;
+	const char *q;
+
+	*newline = false;
+
+	for (;;) {
+		switch (CHAR_CLASS[(unsigned char)*p]) {
+		case CC_SPACE:
+		case CC_NEWLINE:
+			q = scan_spaces(p);
+			if (memchr(p, '\n', q - p) != NULL)
+				*newline = true;
+			p = q;
+			continue;
+
+		case CC_SYMBOL:
+			if (p[0] == '/' && p[1] == '*') {
+				p = scan_comment_end(p + 2);
+
+				if (*p != '\0')
+					p += 2;
+				continue;
 			}
+			break;
 
-			if (i != (sizeof(multibytes_operations) / sizeof(multibytes_operations[0])))
+		case CC_INVALID:
+			/* 行の継続 */
+			if (p[0] == '\\' && p[1] == '\n') {
+				p += 2;
 				continue;
+			}
+			break;
 
-			add_token(v, get_token_type_of_symbol(*p), p, line, p - begin);
-			p++;
-			continue;
+		default:
+			break;
 		}
 
-		/* number */
+		break;
+	}
 
-		/* hex */
-		if (*p == '0' && (*(p + 1) == 'X' || *(p + 1) == 'x') && isdigit(*(p + 2))) {
-			t = add_token(v, TK_NUM, p, line, p - begin);
-			t->value = strtol(p, &p, 16);
-			continue;
-		}
+	*start = p;
+	*len = 0;
+	*value = 0;
 
-		/* octal */
-		if (*p == '0' && isdigit(*(p + 1))) {
-			t = add_token(v, TK_NUM, p, line, p - begin);
-			t->value = strtol(p, &p, 8);
-			continue;
+	if (*p == '\0')
+		return TK_EOF;
+
+	if ((type = scan_token(p, len, value)) == TK_INVALID) {
+		*len = 1;
+		return TK_INVALID;
+	}
+
+	if (type == TK_IDENT)
+		*value = intern_id(intern(p, *len));
+
+	return type;
+}
+
+/**
+ * @brief トークン用の配列を確保し直す
+ * @param[in] ts        トークンストリーム
+ * @param[in] capacity  新しい容量 (2の冪)
+ *
+ * 保持しているトークンは新しい配列の対応する位置に移す.
+ */
+static void resize_token_buffer(struct token_stream_t *ts, size_t capacity)
+{
+	unsigned char *types = malloc(sizeof(types[0]) * capacity);
+	uint32_t *offsets = malloc(sizeof(offsets[0]) * capacity);
+	int *values = malloc(sizeof(values[0]) * capacity);
+	size_t i;
+
+	if (types == NULL || offsets == NULL || values == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+
+	for (i = ts->head; i < ts->tail; i++) {
+		types[i & (capacity - 1)] = ts->types[i & ts->mask];
+		offsets[i & (capacity - 1)] = ts->offsets[i & ts->mask];
+		values[i & (capacity - 1)] = ts->values[i & ts->mask];
+	}
+
+	free(ts->types);
+	free(ts->offsets);
+	free(ts->values);
+
+	ts->types = types;
+	ts->offsets = offsets;
+	ts->values = values;
+	ts->mask = capacity - 1;
+
+	mem_stats.token_resizes++;
+	if (capacity > mem_stats.token_capacity)
+		mem_stats.token_capacity = capacity;
+}
+
+/**
+ * @brief トークンストリームを初期化する
+ */
+void init_token_stream(struct token_stream_t *ts, const char *p)
+{
+	const size_t INITIAL_CAPACITY = 16;
+
+	ts->src = p;
+	ts->p = p;
+
+	ts->types = NULL;
+	ts->offsets = NULL;
+	ts->values = NULL;
+	ts->head = 0;
+	ts->tail = 0;
+	ts->pos = 0;
+	ts->marks = 0;
+	ts->mark_base = 0;
+	ts->keep_all = false;
+	ts->line_starts = NULL;
+	ts->num_lines = 0;
+	ts->sources = NULL;
+	ts->num_sources = 0;
+
+	resize_token_buffer(ts, INITIAL_CAPACITY);
+}
+
+/**
+ * @brief トークンストリームのバッファを解放する
+ */
+void release_token_stream(struct token_stream_t *ts)
+{
+	free(ts->types);
+	free(ts->offsets);
+	free(ts->values);
+	free(ts->line_starts);
+}
+
+/**
+ * @brief リングバッファに1トークン分の空きをつくる
+ *
+ * 現在位置とマークより前のトークンは捨てる. それでも空きがなければバッファを広げる.
+ */
+static void reserve_token(struct token_stream_t *ts)
+{
+	size_t keep = (ts->marks > 0) ? ts->mark_base : ts->pos;
+
+	if (!ts->keep_all && ts->head < keep)
+		ts->head = keep;
+
+	if (ts->tail - ts->head <= ts->mask)
+		return;
+
+	resize_token_buffer(ts, (ts->mask + 1) * 2);
+}
+
+/**
+ * @brief 現在位置まで字句解析する
+ */
+void fill_token(struct token_stream_t *ts)
+{
+	/* 必要になった時点で字句解析する */
+	while (ts->pos >= ts->tail) {
+		reserve_token(ts);
+		lex_token(ts, ts->tail & ts->mask);
+		ts->tail++;
+	}
+}
+
+/**
+ * @brief 現在位置の識別子・予約語の名前を取得する
+ */
+const char *token_name(struct token_stream_t *ts)
+{
+	token_type_t type = peek_token(ts);
+	int value = ts->values[ts->pos & ts->mask];
+
+	if (type == TK_IDENT)
+		return intern_name(value);
+
+	return KEYWORD_TABLE[value].word;
+}
+
+/**
+ * @brief 現在位置のトークンの入力文字列を取得する
+ */
+const char *token_input(struct token_stream_t *ts)
+{
+	const struct token_source_t *s;
+	uint32_t offset;
+
+	if (peek_token(ts) == TK_EOF)
+		return "EOF";
+
+	offset = ts->offsets[ts->pos & ts->mask];
+	if ((s = find_source(ts, offset)) != NULL)
+		return s->buf + (offset - s->base);
+
+	return ts->src + offset;
+}
+
+/**
+ * @brief 現在位置のトークンの行番号と行内の位置を取得する
+ */
+void token_location(struct token_stream_t *ts, int *line, int *column)
+{
+	const struct token_source_t *s;
+	const char *p, *end;
+	uint32_t offset;
+
+	peek_token(ts);
+	offset = ts->offsets[ts->pos & ts->mask];
+
+	if ((s = find_source(ts, offset)) == NULL) {
+		locate_offset(ts, offset, line, column);
+		return;
+	}
+
+	/* 前処理したストリームはファイルの先頭から数える (エラー表示でしか使わない) */
+	*line = 1;
+	for (p = s->buf, end = s->buf + (offset - s->base); (p = memchr(p, '\n', end - p)) != NULL; p++) {
+		(*line)++;
+		*column = end - p - 1;
+	}
+	if (*line == 1)
+		*column = end - s->buf;
+}
+
+/**
+ * @brief 現在位置のトークンのファイルパスを取得する
+ */
+const char *token_path(struct token_stream_t *ts)
+{
+	const struct token_source_t *s;
+
+	peek_token(ts);
+	if ((s = find_source(ts, ts->offsets[ts->pos & ts->mask])) == NULL)
+		return NULL;
+
+	return s->path;
+}
+
+/**
+ * @brief トークンを末尾に足す
+ */
+void push_token(struct token_stream_t *ts, token_type_t type, uint32_t offset, int value)
+{
+	size_t slot;
+
+	reserve_token(ts);
+
+	slot = ts->tail & ts->mask;
+	ts->types[slot] = type;
+	ts->offsets[slot] = offset;
+	ts->values[slot] = value;
+	ts->tail++;
+}
+
+/**
+ * @brief 巻き戻し用に現在位置を記録する
+ */
+size_t mark_token(struct token_stream_t *ts)
+{
+	if (ts->marks++ == 0)
+		ts->mark_base = ts->pos;
+
+	return ts->pos;
+}
+
+/**
+ * @brief mark_token()で記録した位置に巻き戻す
+ */
+void rewind_token(struct token_stream_t *ts, size_t mark)
+{
+	ts->pos = mark;
+	ts->marks--;
+}
+
+/**
+ * @brief mark_token()で記録した位置を破棄する
+ */
+void unmark_token(struct token_stream_t *ts)
+{
+	ts->marks--;
+}
+
+/**
+ * @brief トークナイザー メイン
+ * @param[out] ts  トークンストリーム
+ * @param[in]  p   入力文字列へのポインタ
+ */
+void tokenize(struct token_stream_t *ts, const char *p)
+{
+	init_token_stream(ts, p);
+	ts->keep_all = true;
+
+	do {
+		advance_token(ts);
+	} while (ts->types[ts->tail - 1] != TK_EOF);
+
+	ts->pos = 0;
+}
+
+/**
+ * @brief 並列字句解析の1チャンク・1状態分の結果
+ */
+struct lex_chunk_result_t {
+	unsigned char *types; /**< トークンタイプ */
+	uint32_t *offsets;    /**< 入力文字列の先頭からのオフセット */
+	int *values;	  /**< 数値の値, 予約語の表の位置 (識別子はマージ時にintern()する) */
+	size_t len;	   /**< トークン数 */
+	size_t capacity;      /**< 配列の容量 */
+	bool ends_in_comment; /**< チャンクの終端がコメントの途中か */
+	bool error;	   /**< 字句解析できない文字があったか */
+};
+
+/**
+ * @brief 並列字句解析のチャンク
+ *
+ * チャンクは改行の直後で区切るので, コメント以外のトークンが境界をまたぐことはない.
+ * 直前のチャンクがコメントの途中で終わるかどうかはマージするまでわからないので,
+ * 通常の状態から始めた場合とコメントの中から始めた場合の両方を字句解析しておく.
+ */
+struct lex_chunk_t {
+	const char *src;			/**< 入力文字列の先頭 */
+	const char *begin;			/**< チャンクの先頭 */
+	const char *end;			/**< チャンクの終端 (改行の直後かNUL) */
+	struct lex_chunk_result_t result[2];	/**< [0]: 通常の状態から, [1]: コメントの中から */
+	pthread_t thread;			/**< ワーカースレッド */
+};
+
+/**
+ * @brief チャンクの字句解析結果にトークンを追加する
+ */
+static void push_chunk_token(struct lex_chunk_result_t *r, token_type_t type, uint32_t offset, int value)
+{
+	if (r->len >= r->capacity) {
+		r->capacity = (r->capacity == 0) ? 1024 : r->capacity * 2;
+		r->types = realloc(r->types, sizeof(r->types[0]) * r->capacity);
+		r->offsets = realloc(r->offsets, sizeof(r->offsets[0]) * r->capacity);
+		r->values = realloc(r->values, sizeof(r->values[0]) * r->capacity);
+
+		if (r->types == NULL || r->offsets == NULL || r->values == NULL) {
+			color_printf(stderr, COL_RED, "memory allocation failed\n");
+			exit(1);
 		}
+	}
 
-		/* decimal */
-		if (isdigit(*p)) {
-			t = add_token(v, TK_NUM, p, line, p - begin);
-			t->value = strtol(p, &p, 10);
-			continue;
+	r->types[r->len] = type;
+	r->offsets[r->len] = offset;
+	r->values[r->len] = value;
+	r->len++;
+}
+
+/**
+ * @brief チャンクを字句解析する
+ * @param[in]  c           チャンク
+ * @param[out] r           結果
+ * @param[in]  in_comment  コメントの中から始めるか
+ *
+ * lex_token()と同じ規則で読むが, チャンクの終端を越えて始まるトークンは読まない.
+ */
+static void lex_chunk_state(struct lex_chunk_t *c, struct lex_chunk_result_t *r, bool in_comment)
+{
+	const char *p = c->begin;
+	token_type_t type;
+	int value;
+	size_t len;
+
+	if (in_comment) {
+		/* チャンク内に "*" "/" がなければ全体がコメント */
+		if ((p = memmem(p, c->end - p, "*/", 2)) == NULL) {
+			r->ends_in_comment = true;
+			return;
 		}
+		p += 2;
+	}
 
-		if (isalpha(*p) || *p == '_') {
-			size_t len = 1;
+	while (p < c->end) {
+		switch (CHAR_CLASS[(unsigned char)*p]) {
+		case CC_NUL:
+			return;
 
-			while (isalpha(p[len]) || isdigit(p[len]) || p[len] == '_')
-				len++;
+		case CC_SPACE:
+		case CC_NEWLINE:
+			p = scan_spaces(p);
+			continue;
+
+		case CC_SYMBOL:
+			if (p[0] == '/' && p[1] == '*') {
+				p = scan_comment_end(p + 2);
 
-			/* 予約語かどうかの判定 */
-			for (i = 0; i < (sizeof(keywords) / sizeof(keywords[0])); i++) {
-				if (strncmp(keywords[i].word, p, strlen(keywords[i].word)) == 0) {
-					t = add_token(v, keywords[i].tkval, p, line, p - begin); /* 予約語だった */
-					t->name = keywords[i].word;
-					p += len;
-					break;
+				if (p >= c->end) {
+					r->ends_in_comment = true;
+					return;
 				}
+				p += 2;
+				continue;
 			}
+			break;
 
-			/* 予約語だったら次のトークンへ */
-			if (i < (sizeof(keywords) / sizeof(keywords[0])))
-				continue;
+		default:
+			break;
+		}
 
-			/* 識別子 */
-			t = add_token(v, TK_IDENT, p, line, p - begin);
-			t->name = strndup(p, len);
-			p += len;
-			continue;
+		value = 0;
+		if ((type = scan_token(p, &len, &value)) == TK_INVALID) {
+			r->error = true;
+			return;
 		}
 
-		color_printf(stderr, COL_RED, "tokenize error: %s at line %d position %d\n", p, line, p - begin);
+		push_chunk_token(r, type, p - c->src, value);
+		p += len;
+	}
+}
+
+/**
+ * @brief チャンクの字句解析結果を解放する
+ */
+static void free_lex_chunk(struct lex_chunk_t *c)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		free(c->result[i].types);
+		free(c->result[i].offsets);
+		free(c->result[i].values);
+	}
+}
+
+/**
+ * @brief ワーカースレッド: チャンクを両方の状態から字句解析する
+ */
+static void *lex_chunk(void *arg)
+{
+	struct lex_chunk_t *c = arg;
+
+	lex_chunk_state(c, &c->result[0], false);
+
+	/* 先頭のチャンクはコメントの中から始まることはない */
+	if (c->begin != c->src)
+		lex_chunk_state(c, &c->result[1], true);
+
+	return NULL;
+}
+
+/**
+ * @brief 入力をEOFまで並列に字句解析する
+ *
+ * 入力を改行の位置でチャンクに分けてワーカースレッドで字句解析し, 先頭から順に
+ * 各チャンクの正しい状態の結果を連結する. 識別子はマージ時に出現順にintern()するので,
+ * intern_id()を含めて結果はtokenize()と一致する.
+ */
+void tokenize_parallel(struct token_stream_t *ts, const char *p, int num_threads)
+{
+	const size_t MIN_CHUNK_SIZE = 64 * 1024;
+	size_t len = strlen(p);
+	size_t num_chunks, i, j, total;
+	struct lex_chunk_t *chunks;
+	bool in_comment = false;
+	const char *q;
+
+	if (num_threads <= 0)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	num_chunks = len / MIN_CHUNK_SIZE;
+	if (num_chunks > (size_t)num_threads)
+		num_chunks = num_threads;
+
+	if (num_chunks <= 1 || len > UINT32_MAX) {
+		tokenize(ts, p);
+		return;
+	}
+
+	if ((chunks = calloc(num_chunks, sizeof(struct lex_chunk_t))) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
 		exit(1);
-	LOOP_END:;
 	}
 
-	add_token(v, TK_EOF, "EOF", line, p - begin);
+	/* 改行の直後で区切る */
+	for (i = 0, q = p; i < num_chunks; i++) {
+		chunks[i].src = p;
+		chunks[i].begin = q;
+
+		if (p + len * (i + 1) / num_chunks > q)
+			q = p + len * (i + 1) / num_chunks;
+
+		if (i == num_chunks - 1 || *(q = scan_newline(q)) == '\0')
+			q = p + len;
+		else
+			q++;
+
+		chunks[i].end = q;
+	}
+
+	/* カーネルの選択はスレッドを立てる前に済ませておく */
+	scan_spaces("");
+
+	for (i = 1; i < num_chunks; i++) {
+		if (pthread_create(&chunks[i].thread, NULL, lex_chunk, &chunks[i]) != 0) {
+			color_printf(stderr, COL_RED, "failed to create a thread\n");
+			exit(1);
+		}
+	}
+	lex_chunk(&chunks[0]);
+
+	for (i = 1; i < num_chunks; i++)
+		pthread_join(chunks[i].thread, NULL);
+
+	/* 前のチャンクの終わりの状態に合う結果を選ぶ */
+	for (i = 0, total = 0; i < num_chunks; i++) {
+		struct lex_chunk_result_t *r = &chunks[i].result[in_comment];
+
+		/* エラーは逐次版で報告させる */
+		if (r->error) {
+			for (i = 0; i < num_chunks; i++)
+				free_lex_chunk(&chunks[i]);
+			free(chunks);
+			tokenize(ts, p);
+			return;
+		}
+
+		total += r->len;
+		in_comment = r->ends_in_comment;
+	}
+
+	init_token_stream(ts, p);
+	ts->keep_all = true;
+	resize_token_buffer(ts, (size_t)1 << (64 - __builtin_clzl(total + 1)));
+
+	/* 出現順に連結し, 識別子をintern()する */
+	for (i = 0, in_comment = false; i < num_chunks; i++) {
+		struct lex_chunk_result_t *r = &chunks[i].result[in_comment];
+
+		memcpy(ts->types + ts->tail, r->types, r->len * sizeof(r->types[0]));
+		memcpy(ts->offsets + ts->tail, r->offsets, r->len * sizeof(r->offsets[0]));
+		memcpy(ts->values + ts->tail, r->values, r->len * sizeof(r->values[0]));
+
+		for (j = ts->tail; j < ts->tail + r->len; j++) {
+			if (ts->types[j] == TK_IDENT) {
+				q = p + ts->offsets[j];
+				ts->values[j] = intern_id(intern(q, scan_ident(q)));
+			}
+		}
+
+		ts->tail += r->len;
+		in_comment = r->ends_in_comment;
+
+		free_lex_chunk(&chunks[i]);
+	}
+	free(chunks);
+
+	/* EOF */
+	ts->types[ts->tail] = TK_EOF;
+	ts->offsets[ts->tail] = len;
+	ts->values[ts->tail] = 0;
+	ts->tail++;
 
-	return v;
+	ts->p = p + len;
+	ts->pos = 0;
 }
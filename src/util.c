@@ -1,169 +1,359 @@
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "rw2rvc2.h"
 
 /**
- * @brief ベクタにメモリを割り当てる
+ * @brief 配列を拡大する
  */
-static struct vector_t *allocate_vector(void)
+void grow_array(void *array, size_t *capacity, size_t size, size_t needed)
 {
 	const size_t ALLOCATE_SIZE = 256;
+	void **p = array;
+	void *q;
+	size_t c = (*capacity == 0) ? ALLOCATE_SIZE : *capacity;
 
-	static struct vector_t *vector_array = NULL;
-	static size_t index = 0;
-	static size_t size = 0;
+	while (c < needed)
+		c *= 2;
 
-	/* initial allocation */
-	if (vector_array == NULL) {
-		size += ALLOCATE_SIZE;
-		vector_array = (struct vector_t *)malloc(sizeof(struct vector_t) * size);
+	if ((q = realloc(*p, size * c)) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
 	}
 
-	/* リサイズ */
-	if (index >= size) {
-		size *= 2;
-		if ((vector_array = (struct vector_t *)realloc(vector_array, sizeof(struct vector_t) * size)) == NULL) {
-			color_printf(stderr, COL_RED, "memory allocation failed\n");
-			exit(1);
-		}
-	}
+	*p = q;
+	*capacity = c;
+}
+
+/**
+ * @brief 辞書を新規に作成する
+ */
+struct dict_t *new_dict(void)
+{
+	const size_t DICT_SIZE = 32;
+	struct dict_t *d = ARENA_NEW(&session_arena, struct dict_t);
+
+	d->len = 0;
+	d->capacity = DICT_SIZE;
+	d->dict = arena_resize(&session_arena, NULL, sizeof(struct dict_element_t) * d->capacity);
+	d->index = arena_resize(&session_arena, NULL, sizeof(uint32_t) * d->capacity * 2);
+	memset(d->index, 0, sizeof(uint32_t) * d->capacity * 2);
 
-	return &vector_array[index++];
+	mem_stats.dicts++;
+
+	return d;
 }
 
-const size_t VECTOR_DATA_DEFAULT_CAPACITY = 16;
+/**
+ * @brief キーのハッシュ値を求める
+ *
+ * キーはintern()された文字列なので, ポインタをそのまま混ぜる.
+ */
+static inline size_t dict_hash(const char *key)
+{
+	uint64_t h = (uint64_t)(uintptr_t)key * 0x9e3779b97f4a7c15u;
+
+	return (size_t)(h ^ (h >> 32));
+}
 
 /**
- * @brief 新規ベクタを生成する
+ * @brief ハッシュ表にキーの位置を探す
+ * @param[in] d       辞書
+ * @param[in] key     キー
+ * @param[in] lookup  参照のために探すか (参照だけを-fmem-reportの回数に数え, 追加や作り直しは数えない)
+ * @return キーの入った要素, なければ空の要素
+ *
+ * 表の容量はdictの容量の2倍 (2の冪) で, 要素には辞書要素の添字+1を入れる (0は空).
  */
-struct vector_t *new_vector(void)
+static uint32_t *dict_slot(const struct dict_t *d, const char *key, bool lookup)
 {
-	const size_t ALLOCATE_SIZE = 256;
+	size_t mask = d->capacity * 2 - 1;
+	size_t h = dict_hash(key);
+	size_t probes = 1;
 
-	static void *vector_data_array = NULL;
-	static size_t index = 0;
-	static size_t size = 0;
+	while (d->index[h & mask] != 0 && d->dict[d->index[h & mask] - 1].key != key) {
+		h++;
+		probes++;
+	}
+
+	if (lookup) {
+		mem_stats.dict_lookups++;
+		mem_stats.dict_probes += probes;
+	}
 
-	struct vector_t *v = allocate_vector();
+	return &d->index[h & mask];
+}
 
-	/* initial allocation */
-	if (vector_data_array == NULL) {
-		size += ALLOCATE_SIZE;
-		vector_data_array = (void *)malloc(sizeof(void *) * VECTOR_DATA_DEFAULT_CAPACITY * size);
+/**
+ * @brief 辞書にデータを追加する
+ *
+ * 同じキーはハッシュ表の同じ要素を使い, 後から追加した方を指すように書き換える.
+ */
+void dict_append(struct dict_t *d, const char *key, void *value)
+{
+	size_t i;
+
+	/* サイズを拡大し, ハッシュ表を作り直す */
+	if (d->len >= d->capacity) {
+		d->capacity *= 2;
+		d->dict = arena_resize(&session_arena, d->dict, sizeof(struct dict_element_t) * d->capacity);
+		d->index = arena_resize(&session_arena, d->index, sizeof(uint32_t) * d->capacity * 2);
+		memset(d->index, 0, sizeof(uint32_t) * d->capacity * 2);
+
+		for (i = 0; i < d->len; i++)
+			*dict_slot(d, (d->dict)[i].key, false) = i + 1;
 	}
 
-	/* リサイズ */
-	if (index >= size) {
-		size *= 2;
-		vector_data_array =
-			(void *)realloc(vector_data_array, sizeof(void *) * VECTOR_DATA_DEFAULT_CAPACITY * size);
+	(d->dict)[d->len].key = key;
+	(d->dict)[d->len].value = value;
+
+	d->len++;
+	*dict_slot(d, key, false) = d->len;
+}
+
+/**
+ * @brief 辞書からデータを参照する
+ */
+struct dict_element_t *dict_lookup(struct dict_t *d, const char *key)
+{
+	uint32_t i = *dict_slot(d, key, true);
+
+	return (i == 0) ? NULL : &(d->dict)[i - 1];
+}
+
+/**
+ * @brief 識別子プールの要素
+ */
+struct interned_t {
+	unsigned int id;  /**< 登録順のID */
+	unsigned int len; /**< 文字列の長さ */
+	char str[];       /**< 文字列本体 (NUL終端) */
+};
+
+/**
+ * @brief 識別子プール
+ */
+static struct {
+	struct interned_t **table; /**< オープンアドレス法のハッシュ表 */
+	size_t capacity;	   /**< ハッシュ表の容量 (2の冪) */
+	size_t len;		   /**< 登録済みの数 */
+	struct interned_t **entries; /**< IDから文字列を引く表 */
+	size_t entries_capacity;   /**< entriesの容量 */
+	char *chunk;		   /**< 文字列を切り出すメモリブロック */
+	size_t chunk_left;	 /**< メモリブロックの残り */
+} intern_pool;
+
+/**
+ * @brief 識別子のハッシュ値を求める (FNV-1a)
+ */
+static inline size_t intern_hash(const char *s, size_t len)
+{
+	size_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)s[i]) * 16777619u;
+
+	return h;
+}
+
+/**
+ * @brief 識別子プールのハッシュ表を拡大する
+ */
+static void intern_grow(void)
+{
+	struct interned_t **old = intern_pool.table;
+	size_t old_capacity = intern_pool.capacity;
+	size_t i, h;
+
+	intern_pool.capacity = (old_capacity == 0) ? 1024 : old_capacity * 2;
+
+	if ((intern_pool.table = calloc(intern_pool.capacity, sizeof(struct interned_t *))) == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
 	}
 
-	v->capacity = VECTOR_DATA_DEFAULT_CAPACITY;
-	v->len = 0;
-	v->data = ((void *)vector_data_array + sizeof(void *) * VECTOR_DATA_DEFAULT_CAPACITY * index);
-	index++;
+	for (i = 0; i < old_capacity; i++) {
+		if (old[i] == NULL)
+			continue;
+
+		h = intern_hash(old[i]->str, old[i]->len);
+		while (intern_pool.table[h & (intern_pool.capacity - 1)] != NULL)
+			h++;
+		intern_pool.table[h & (intern_pool.capacity - 1)] = old[i];
+	}
 
-	return v;
+	free(old);
 }
 
 /**
- * @brief ベクタ要素をプッシュする
+ * @brief 識別子プールから文字列用のメモリを切り出す
+ * @param[in] size  必要なサイズ
  */
-void vector_push(struct vector_t *v, void *element)
+static struct interned_t *intern_allocate(size_t size)
 {
-	if (v->len >= v->capacity) {
-		if (v->capacity == VECTOR_DATA_DEFAULT_CAPACITY) {
-			void *old = v->data;
-			v->capacity *= 2;
-			v->data = malloc(sizeof(void *) * VECTOR_DATA_DEFAULT_CAPACITY * v->capacity);
-			memcpy(v->data, old, sizeof(void *) * VECTOR_DATA_DEFAULT_CAPACITY);
-		} else {
-			v->capacity *= 2;
-			v->data = realloc(v->data, sizeof(void *) * VECTOR_DATA_DEFAULT_CAPACITY * v->capacity);
+	const size_t CHUNK_SIZE = 64 * 1024;
+	struct interned_t *e;
+
+	size = (size + sizeof(unsigned int) - 1) & ~(sizeof(unsigned int) - 1);
+
+	if (size > intern_pool.chunk_left) {
+		size_t s = (size > CHUNK_SIZE) ? size : CHUNK_SIZE;
+
+		if ((intern_pool.chunk = malloc(s)) == NULL) {
+			color_printf(stderr, COL_RED, "memory allocation failed\n");
+			exit(1);
 		}
+		intern_pool.chunk_left = s;
+		mem_stats.intern_reserved += s;
 	}
 
-	v->data[v->len++] = element;
+	mem_stats.intern_used += size;
+
+	e = (struct interned_t *)intern_pool.chunk;
+	intern_pool.chunk += size;
+	intern_pool.chunk_left -= size;
+
+	return e;
 }
 
 /**
- * @brief ベクタをマージする
+ * @brief IDから文字列を引く表に1つ分の空きをつくる
  */
-void vector_merge(struct vector_t *dst, struct vector_t *src)
+static void intern_reserve_entry(void)
 {
-	size_t i;
+	struct interned_t **entries;
 
-	/* どちらかがNULLなら何もしない */
-	if (dst == NULL || src == NULL)
+	if (intern_pool.len < intern_pool.entries_capacity)
 		return;
 
-	for (i = 0; i < src->len; i++)
-		vector_push(dst, src->data[i]);
+	intern_pool.entries_capacity = (intern_pool.entries_capacity == 0) ? 512 : intern_pool.entries_capacity * 2;
+	entries = realloc(intern_pool.entries, sizeof(struct interned_t *) * intern_pool.entries_capacity);
+	if (entries == NULL) {
+		color_printf(stderr, COL_RED, "memory allocation failed\n");
+		exit(1);
+	}
+	intern_pool.entries = entries;
 }
 
 /**
- * @brief 辞書を新規に作成する
+ * @brief 文字列を識別子プールに登録する
  */
-struct dict_t *new_dict(void)
+const char *intern(const char *s, size_t len)
 {
-	const size_t ALLOCATE_SIZE = 8;
-	const size_t DICT_SIZE = 32;
+	struct interned_t *e;
+	size_t h;
 
-	static struct dict_t *dict_array = NULL;
-	static size_t index = 0;
-	static size_t size = ALLOCATE_SIZE;
+	/* 負荷率を1/2以下に保つ */
+	if ((intern_pool.len + 1) * 2 > intern_pool.capacity)
+		intern_grow();
 
-	struct dict_t *d;
+	for (h = intern_hash(s, len);; h++) {
+		e = intern_pool.table[h & (intern_pool.capacity - 1)];
 
-	/* 初期化 */
-	if (dict_array == NULL)
-		dict_array = (struct dict_t *)malloc(sizeof(struct dict_t) * size);
+		if (e == NULL)
+			break;
 
-	/* サイズを拡大する */
-	if (index >= size) {
-		size *= 2;
-		dict_array = (struct dict_t *)realloc(dict_array, sizeof(struct dict_t) * size);
+		if (e->len == len && memcmp(e->str, s, len) == 0)
+			return e->str; /* 登録済み */
 	}
 
-	d = &dict_array[index++];
+	intern_reserve_entry();
 
-	d->len = 0;
-	d->capacity = DICT_SIZE;
-	d->dict = (struct dict_element_t *)malloc(sizeof(struct dict_element_t) * d->capacity);
+	e = intern_allocate(sizeof(struct interned_t) + len + 1);
+	intern_pool.entries[intern_pool.len] = e;
+	e->id = intern_pool.len++;
+	e->len = len;
+	memcpy(e->str, s, len);
+	e->str[len] = '\0';
 
-	return d;
+	intern_pool.table[h & (intern_pool.capacity - 1)] = e;
+
+	return e->str;
 }
 
 /**
- * @brief 辞書にデータを追加する
+ * @brief intern()された文字列のIDを取得する
  */
-void dict_append(struct dict_t *d, char *key, void *value)
+unsigned int intern_id(const char *name)
 {
-	/* サイズを拡大する */
-	if (d->len >= d->capacity) {
-		d->capacity *= 2;
-		d->dict = (struct dict_element_t *)realloc(d->dict, sizeof(struct dict_element_t) * d->capacity);
+	const struct interned_t *e = (const struct interned_t *)(name - offsetof(struct interned_t, str));
+
+	return e->id;
+}
+
+/**
+ * @brief IDからintern()された文字列を取得する
+ */
+const char *intern_name(unsigned int id)
+{
+	return intern_pool.entries[id]->str;
+}
+
+/**
+ * @brief 識別子プールの要素のバイト数 (intern_allocate()と同じく4バイト境界に揃える)
+ */
+static size_t interned_size(const struct interned_t *e)
+{
+	return (sizeof(struct interned_t) + e->len + 1 + sizeof(unsigned int) - 1) & ~(sizeof(unsigned int) - 1);
+}
+
+/**
+ * @brief 識別子プールを登録順に書き出す
+ */
+size_t write_intern_pool(FILE *fp, size_t *count)
+{
+	static const char PADDING[sizeof(unsigned int)];
+	const struct interned_t *e;
+	size_t i, n, total = 0;
+
+	for (i = 0; i < intern_pool.len; i++) {
+		e = intern_pool.entries[i];
+		n = sizeof(struct interned_t) + e->len + 1;
+
+		fwrite(e, n, 1, fp);
+		fwrite(PADDING, interned_size(e) - n, 1, fp);
+		total += interned_size(e);
 	}
 
-	(d->dict)[d->len].key = key;
-	(d->dict)[d->len].value = value;
+	*count = intern_pool.len;
 
-	d->len++;
+	return total;
 }
 
 /**
- * @brief 辞書からデータを参照する
+ * @brief 空の識別子プールに, write_intern_pool()で書き出したものを読み込む
  */
-struct dict_element_t *dict_lookup(struct dict_t *d, char *key)
+int load_intern_pool(const char *image, size_t size, size_t count)
 {
-	size_t i;
+	struct interned_t *e;
+	size_t i, h, pos = 0;
+
+	if (intern_pool.len != 0) {
+		error_printf("unexpected error in %s() (intern pool is not empty)\n", __FUNCTION__);
+		exit(1);
+	}
+
+	for (i = 0; i < count; i++) {
+		e = (struct interned_t *)(image + pos);
+
+		if (size - pos < sizeof(struct interned_t) || e->id != i || e->len >= size - pos ||
+		    interned_size(e) > size - pos || e->str[e->len] != '\0')
+			return -1;
+		pos += interned_size(e);
+
+		if ((intern_pool.len + 1) * 2 > intern_pool.capacity)
+			intern_grow();
+
+		/* 書き出した文字列に重複はないので空きを探すだけでよい */
+		for (h = intern_hash(e->str, e->len); intern_pool.table[h & (intern_pool.capacity - 1)] != NULL; h++)
+			;
+		intern_pool.table[h & (intern_pool.capacity - 1)] = e;
 
-	for (i = d->len; i > 0; i--) {
-		if (strcmp((d->dict)[i - 1].key, key) == 0)
-			return &(d->dict)[i - 1];
+		intern_reserve_entry();
+		intern_pool.entries[intern_pool.len++] = e;
 	}
 
-	return NULL;
+	return 0;
 }
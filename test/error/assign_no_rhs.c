@@ -0,0 +1,6 @@
+/* 代入の右辺がない */
+int f()
+{
+	int a;
+	a = ;
+}
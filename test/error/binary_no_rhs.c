@@ -0,0 +1,5 @@
+/* 二項演算子の右辺がない */
+int f()
+{
+	return 1 +;
+}
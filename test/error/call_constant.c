@@ -0,0 +1,5 @@
+/* 定数は呼び出せない */
+int f()
+{
+	return 3();
+}
@@ -0,0 +1,10 @@
+/* 括弧で囲んだ式は呼び出せない */
+int g(int a)
+{
+	return a;
+}
+
+int f()
+{
+	return (g)(1);
+}
@@ -0,0 +1,10 @@
+/* 呼び出しの結果は呼び出せない */
+int g(int a)
+{
+	return a;
+}
+
+int f()
+{
+	return g(1)(2);
+}
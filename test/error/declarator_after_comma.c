@@ -0,0 +1,2 @@
+/* コンマの後に宣言子がない */
+int a, ;
@@ -0,0 +1,3 @@
+/* ファイルスコープに文は書けない */
+int x;
+x = 3;
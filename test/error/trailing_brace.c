@@ -0,0 +1,6 @@
+/* 関数の後に余分な閉じ括弧がある */
+int f()
+{
+	return 1;
+}
+}
@@ -0,0 +1,5 @@
+/* 閉じ括弧がない */
+int f()
+{
+	return (1;
+}
@@ -28,6 +28,15 @@ int test_if_assign() /* */ /* 1 */
 }
 
 
+int test_if_assign_zero() /* */ /* 7 */
+{
+	if (a = 0) {
+		return 1;
+	}
+
+	return 7;
+}
+
 int test_if_else_true() /* */ /* 1 */
 {
 	if (2) {
@@ -49,3 +58,16 @@ int test_if_else_false() /* */ /* 3 */
 
 	return a;
 }
+
+int test_if_empty_statement() /* */ /* 3 */
+{
+	a = 1;
+	if (a)
+		;
+	else
+		a = 2;
+	;
+	a = a + 2;
+
+	return a;
+}
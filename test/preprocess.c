@@ -0,0 +1,38 @@
+#include "preprocess.h"
+#include "preprocess.h"
+
+#define PP_ANSWER (PP_BASE + pp_value)
+#define PP_SQUARE(x) ((x) * (x))
+
+int test_pp_object_macro() /* */ /* 42 */
+{
+	return PP_ANSWER;
+}
+
+int test_pp_function_macro() /* */ /* 49 */
+{
+	return PP_SQUARE(3 + 4);
+}
+
+int test_pp_nested_macro() /* */ /* 14 */
+{
+	return PP_TWICE(PP_ADD(PP_SQUARE(2), 3));
+}
+
+int test_pp_if() /* */ /* 1 */
+{
+#if PP_BASE > 10 && defined(PP_TWICE)
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+int test_pp_ifdef() /* */ /* 2 */
+{
+#ifdef PP_UNDEFINED
+	return 0;
+#elif PP_BASE == 40
+	return 2;
+#endif
+}
@@ -0,0 +1,10 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#define PP_BASE 40
+#define PP_TWICE(x) ((x) + (x))
+#define PP_ADD(a, b) (a + b)
+
+int pp_value = 2;
+
+#endif
@@ -0,0 +1,52 @@
+int scope_g = 4;
+
+int scope_twice(int scope_p)
+{
+	return scope_p * 2;
+}
+
+int scope_add_g(int scope_p)
+{
+	{
+		return scope_p + scope_g;
+	}
+}
+
+int test_scope_param_in_two_functions() /* */ /* 13 */
+{
+	return scope_twice(3) + scope_add_g(3);
+}
+
+int test_scope_global_after_function() /* */ /* 4 */
+{
+	{
+		return scope_g;
+	}
+}
+
+int scope_x = 1;
+
+int scope_shadow(int scope_x)
+{
+	return scope_x;
+}
+
+int test_scope_param_shadows_global() /* */ /* 6 */
+{
+	return scope_shadow(5) + scope_x;
+}
+
+int scope_inner(int scope_p)
+{
+	return scope_p * 10;
+}
+
+int scope_outer(int scope_p)
+{
+	return scope_inner(scope_p + 1) + scope_p;
+}
+
+int test_scope_same_param_in_caller_and_callee() /* */ /* 32 */
+{
+	return scope_outer(2);
+}
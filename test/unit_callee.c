@@ -0,0 +1,5 @@
+/* unit_caller.c の関数と同じ名前の仮引数を持つ */
+int unit_callee(int x)
+{
+	return x * 2;
+}
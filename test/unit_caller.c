@@ -0,0 +1,5 @@
+/* 別の翻訳単位の関数を同じ名前の仮引数で呼ぶ (unit_callee.c) */
+int test_unit_same_param(int x) /* 3 */ /* 11 */
+{
+	return unit_callee(x + 1) + x;
+}
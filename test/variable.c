@@ -47,3 +47,33 @@ int test_declarate_va4() /* */ /* 1 */
 
 	return f;
 }
+
+int iffy;
+int integer = 3;
+
+int test_keyword_prefix_ident() /* */ /* 5 */
+{
+	iffy = 2;
+	return iffy + integer;
+}
+
+int test_return_assign() /* */ /* 5 */
+{
+	return b = 5;
+}
+
+int test_chain_assign() /* */ /* 6 */
+{
+	c = d = 3;
+
+	return c + d;
+}
+
+int multi_x, multi_y = 4;
+
+int test_multi_declarator() /* */ /* 7 */
+{
+	multi_x = 3;
+
+	return multi_x + multi_y;
+}
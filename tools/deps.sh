@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# -MD で書き出す依存関係に, インクルードしたヘッダーと -fpch-use のプリコンパイル済みヘッダーが入るか確かめる
+
+RW2RVC2=$(realpath ./release/rw2rvc2)
+TEMP=$(mktemp -d)
+
+cd ${TEMP}
+printf 'int pre_h;\n' > pre.h
+printf 'int dep_h;\n' > dep.h
+printf '#include "dep.h"\nint main() { return dep_h + pre_h; }\n' > u.c
+
+${RW2RVC2} -fpch-emit=pre.pch pre.h &&
+    ${RW2RVC2} -MD -fpch-use=pre.pch u.c > u.s
+
+RESULT=$?
+DEPS=$(cat u.d 2> /dev/null)
+
+cd - > /dev/null
+rm -rf ${TEMP}
+
+echo -n "-MD -fpch-use -> \"${DEPS}\" ... "
+
+if [ "${RESULT}" = "0" ] && [[ "${DEPS}" =~ ^u\.s: ]] && [[ " ${DEPS} " =~ " u.c " ]] &&
+    [[ "${DEPS}" =~ dep\.h ]] && [[ " ${DEPS} " =~ " pre.pch " ]]; then
+    echo -e "\e[1;32mOK\e[m"
+else
+    echo -e "\e[1;31mNG\e[m"
+    exit 1
+fi
@@ -1,13 +1,16 @@
 #!/bin/bash
 
-./release/rw2rvc2 "$1" > /dev/null 2>&1
+# 2つ目以降の引数はオプションとして渡す
+./release/rw2rvc2 "${@:2}" "$1" > /dev/null 2>&1
 
 RESULT=$?
 
-echo -n "\"$1\" (error is expected) ... "
+echo -n "\"$1\"${2:+ ${*:2}} (error is expected) ... "
 
-if [ "${RESULT}" != "0" ]; then
+# シグナルで落ちた場合 (128以上) はエラーを報告したことにならない
+if [ "${RESULT}" != "0" ] && [ "${RESULT}" -lt 128 ]; then
     echo -e "\e[1;32mFAILD -> OK\e[m"
 else
     echo -e "\e[1;31mINCORRECTLY SUCCEEDED -> NG\e[m"
+    exit 1
 fi
@@ -0,0 +1,86 @@
+#!/usr/bin/python3
+"""
+予約語の完全ハッシュ表 (src/keyword.h) を生成する.
+
+    ./tools/gen_keyword.py > src/keyword.h
+
+ハッシュ値は 識別子の長さ, 先頭文字, 末尾文字 だけから求める.
+
+    h = (len * KEYWORD_HASH_LEN + first * KEYWORD_HASH_FIRST + last) & (KEYWORD_TABLE_SIZE - 1)
+
+予約語を追加したら KEYWORDS に足して再生成すること.
+"""
+
+import sys
+
+KEYWORDS = [
+    ("return", "TK_RETURN"),
+    ("if", "TK_IF"),
+    ("else", "TK_ELSE"),
+    ("goto", "TK_GOTO"),
+    ("int", "TK_INT"),
+]
+
+
+def hash_keyword(word, m_len, m_first, size):
+    return (len(word) * m_len + ord(word[0]) * m_first + ord(word[-1])) & (size - 1)
+
+
+def search(words):
+    size = 1
+    while size < len(words) * 2:
+        size *= 2
+
+    while size <= 1024:
+        for m_len in range(1, 256):
+            for m_first in range(1, 256):
+                hashes = set(hash_keyword(w, m_len, m_first, size) for w in words)
+                if len(hashes) == len(words):
+                    return size, m_len, m_first
+        size *= 2
+
+    return None
+
+
+def main():
+    words = [w for w, _ in KEYWORDS]
+    found = search(words)
+
+    if found is None:
+        print("perfect hash not found", file=sys.stderr)
+        sys.exit(1)
+
+    size, m_len, m_first = found
+    table = [None] * size
+
+    for word, tk in KEYWORDS:
+        table[hash_keyword(word, m_len, m_first, size)] = (word, tk)
+
+    print("""/**
+ * @brief 予約語の完全ハッシュ表
+ * @note tools/gen_keyword.py が生成したファイルです. 直接編集しないでください.
+ */
+#if !defined(KEYWORD_H_INCLUDED)
+#define KEYWORD_H_INCLUDED
+
+#define KEYWORD_TABLE_SIZE	{}
+#define KEYWORD_HASH_LEN	{}
+#define KEYWORD_HASH_FIRST	{}
+#define KEYWORD_MAX_LEN		{}
+""".format(size, m_len, m_first, max(len(w) for w in words)))
+
+    print("static const struct keyword_t {")
+    print("\tconst char *word;\t/**< 予約語 */")
+    print("\tsize_t len;\t\t/**< 予約語の長さ (0: 空き) */")
+    print("\ttoken_type_t tkval;\t/**< トークンタイプ */")
+    print("} KEYWORD_TABLE[KEYWORD_TABLE_SIZE] = {")
+
+    for i, entry in enumerate(table):
+        if entry is not None:
+            print("\t[{}] = {{\"{}\", {}, {}}},".format(i, entry[0], len(entry[0]), entry[1]))
+
+    print("};\n#endif")
+
+
+if __name__ == '__main__':
+    main()